@@ -18,11 +18,16 @@
 #include <ctype.h>
 #include <netdb.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "sockaddr.h"
 #include "misc.h"
 #include "nfslib.h"
 #include "exportfs.h"
+#include "xcommon.h"
+#include "latency.h"
 
 /* netgroup stuff never seems to be defined in any header file. Linux is
  * not alone in this.
@@ -32,9 +37,35 @@ extern int	innetgr(char *netgr, char *host, char *, char *);
 #endif
 
 static char	*add_name(char *old, const char *add);
+static char	*client_match_all(const struct addrinfo *ai, char *name);
+static unsigned int addr_hash(const struct sockaddr *sap);
 
 nfs_client	*clientlist[MCL_MAXTYPES] = { NULL, };
 
+/* Bumped whenever clientlist changes */
+static unsigned int	client_gen;
+
+/*
+ * Client indexes
+ *
+ * Reading exports or etab looks up a client for every entry, so
+ * searching clientlist[] in turn made loading quadratic in the number
+ * of clients.  Each client is hashed by its case-folded name in
+ * client_names[], and MCL_FQDN clients also by each of their
+ * addresses in client_addrs.  clientlist[] keeps its order; m_seq
+ * tells which of several address matches comes first in it.
+ */
+struct client_addr {
+	struct hash_node	a_node;
+	nfs_client *		a_client;
+	int			a_index;	/* into m_addrlist */
+};
+
+static struct hash_table	client_names[MCL_MAXTYPES];
+static struct hash_table	client_addrs = HASH_TABLE_INIT;
+static nfs_client **		client_tails[MCL_MAXTYPES];
+static unsigned int		client_seq;
+
 
 static void
 init_addrlist(nfs_client *clp, const struct addrinfo *ai)
@@ -55,6 +86,7 @@ init_addrlist(nfs_client *clp, const struct addrinfo *ai)
 static void
 client_free(nfs_client *clp)
 {
+	free(clp->m_addrkeys);
 	free(clp->m_hostname);
 	free(clp);
 }
@@ -237,6 +269,7 @@ client_init(nfs_client *clp, const char *hname, const struct addrinfo *ai)
 	clp->m_exported = 0;
 	clp->m_count = 0;
 	clp->m_naddr = 0;
+	clp->m_addrkeys = NULL;
 
 	if (clp->m_type == MCL_SUBNETWORK)
 		return init_subnetwork(clp);
@@ -245,16 +278,296 @@ client_init(nfs_client *clp, const char *hname, const struct addrinfo *ai)
 	return 1;
 }
 
+static void
+client_index_addrs(nfs_client *clp)
+{
+	int i;
+
+	if (clp->m_type != MCL_FQDN || clp->m_naddr == 0)
+		return;
+
+	clp->m_addrkeys = xmalloc(clp->m_naddr * sizeof(*clp->m_addrkeys));
+	for (i = 0; i < clp->m_naddr; i++) {
+		struct client_addr *a = &clp->m_addrkeys[i];
+
+		a->a_client = clp;
+		a->a_index = i;
+		hash_insert(&client_addrs, &a->a_node,
+				addr_hash(get_addrlist(clp, i)));
+	}
+}
+
+static void
+client_unindex(nfs_client *clp)
+{
+	int i;
+
+	hash_remove(&client_names[clp->m_type], &clp->m_hnode);
+	if (clp->m_addrkeys == NULL)
+		return;
+	for (i = 0; i < clp->m_naddr; i++)
+		hash_remove(&client_addrs, &clp->m_addrkeys[i].a_node);
+	free(clp->m_addrkeys);
+	clp->m_addrkeys = NULL;
+}
+
+/*
+ * Returns the first client of type @htype named @hname, ignoring case.
+ */
+static nfs_client *
+client_find_name(int htype, const char *hname)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&client_names[htype], hash_string_nocase(hname));
+	     n; n = hash_lookup_next(n)) {
+		nfs_client *clp = hash_entry(n, nfs_client, m_hnode);
+
+		if (strcasecmp(hname, clp->m_hostname) == 0)
+			return clp;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the first MCL_FQDN client with an address in @ai, which is
+ * the one client_check() would find walking clientlist[MCL_FQDN].
+ */
+static nfs_client *
+client_find_addr(const struct addrinfo *ai)
+{
+	nfs_client *clp = NULL;
+	struct hash_node *n;
+
+	for (; ai; ai = ai->ai_next) {
+		for (n = hash_lookup(&client_addrs, addr_hash(ai->ai_addr)); n;
+		     n = hash_lookup_next(n)) {
+			struct client_addr *a =
+				hash_entry(n, struct client_addr, a_node);
+
+			if (clp != NULL && a->a_client->m_seq >= clp->m_seq)
+				continue;
+			if (nfs_compare_sockaddr(ai->ai_addr,
+					get_addrlist(a->a_client, a->a_index)))
+				clp = a->a_client;
+		}
+	}
+	return clp;
+}
+
 static void
 client_add(nfs_client *clp)
 {
-	nfs_client **cpp;
+	int htype = clp->m_type;
 
-	cpp = &clientlist[clp->m_type];
-	while (*cpp != NULL)
-		cpp = &((*cpp)->m_next);
+	if (client_tails[htype] == NULL)
+		client_tails[htype] = &clientlist[htype];
 	clp->m_next = NULL;
-	*cpp = clp;
+	*client_tails[htype] = clp;
+	client_tails[htype] = &clp->m_next;
+	clp->m_seq = client_seq++;
+	hash_insert(&client_names[htype], &clp->m_hnode,
+			hash_string_nocase(clp->m_hostname));
+	client_index_addrs(clp);
+	client_gen++;
+}
+
+/*
+ * Forward lookups started ahead of client_lookup().  Reading a large
+ * exports file used to resolve each host name in turn, so the time
+ * taken was the sum of every lookup.  Names are now handed to a pool
+ * of threads as soon as they are read, each name once, and
+ * client_lookup() picks up the answer when it gets to that entry.
+ */
+struct client_prefetch {
+	struct hash_node	p_node;
+	struct client_prefetch *p_next;		/* all entries */
+	struct client_prefetch *p_qnext;	/* waiting for a thread */
+	char *			p_name;
+	struct addrinfo *	p_ai;
+	int			p_done;
+};
+
+static struct hash_table	prefetch_tbl = HASH_TABLE_INIT;
+static struct client_prefetch *	prefetch_list;
+static struct client_prefetch *	prefetch_queue;
+static struct client_prefetch **prefetch_tail = &prefetch_queue;
+static pthread_mutex_t		prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		prefetch_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t		prefetch_done = PTHREAD_COND_INITIALIZER;
+static pthread_t *		prefetch_threads;
+static unsigned int		prefetch_nthreads;
+static int			prefetch_stopping;
+
+static struct client_prefetch *
+prefetch_find(const char *hname)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&prefetch_tbl, hash_string_nocase(hname)); n;
+	     n = hash_lookup_next(n)) {
+		struct client_prefetch *p =
+			hash_entry(n, struct client_prefetch, p_node);
+
+		if (strcasecmp(p->p_name, hname) == 0)
+			return p;
+	}
+	return NULL;
+}
+
+static void *
+prefetch_thread(void *UNUSED(arg))
+{
+	struct client_prefetch *p;
+	struct addrinfo *ai;
+
+	pthread_mutex_lock(&prefetch_lock);
+	for (;;) {
+		while (prefetch_queue == NULL && !prefetch_stopping)
+			pthread_cond_wait(&prefetch_work, &prefetch_lock);
+		if (prefetch_queue == NULL)
+			break;
+		p = prefetch_queue;
+		prefetch_queue = p->p_qnext;
+		if (prefetch_queue == NULL)
+			prefetch_tail = &prefetch_queue;
+		pthread_mutex_unlock(&prefetch_lock);
+
+		ai = host_addrinfo(p->p_name);
+
+		pthread_mutex_lock(&prefetch_lock);
+		p->p_ai = ai;
+		p->p_done = 1;
+		pthread_cond_broadcast(&prefetch_done);
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+	return NULL;
+}
+
+/**
+ * client_prefetch_start - start resolving host names ahead of time
+ * @nthreads: number of lookups to run at once
+ *
+ * Until client_prefetch_stop() is called, names passed to
+ * client_prefetch() are resolved in the background.
+ */
+void
+client_prefetch_start(unsigned int nthreads)
+{
+	sigset_t set, oldset;
+
+	if (prefetch_threads != NULL || nthreads == 0)
+		return;
+
+	/* Signals are for the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	prefetch_threads = xmalloc(nthreads * sizeof(*prefetch_threads));
+	prefetch_stopping = 0;
+	for (; prefetch_nthreads < nthreads; prefetch_nthreads++) {
+		int err = pthread_create(&prefetch_threads[prefetch_nthreads],
+					 NULL, prefetch_thread, NULL);
+
+		if (err != 0) {
+			xlog(L_ERROR, "%s: can't start resolver thread: %s",
+				__func__, strerror(err));
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+}
+
+/**
+ * client_prefetch - resolve a client name before it is looked up
+ * @hname: '\0'-terminated ASCII string containing a client name
+ *
+ * Only host names are resolved, and each of them only once.  Does
+ * nothing unless client_prefetch_start() was called.
+ */
+void
+client_prefetch(char *hname)
+{
+	struct client_prefetch *p;
+
+	if (prefetch_nthreads == 0 || client_gettype(hname) != MCL_FQDN)
+		return;
+
+	pthread_mutex_lock(&prefetch_lock);
+	if (prefetch_find(hname) == NULL) {
+		p = xmalloc(sizeof(*p));
+		p->p_name = xstrdup(hname);
+		p->p_ai = NULL;
+		p->p_done = 0;
+		p->p_next = prefetch_list;
+		prefetch_list = p;
+		p->p_qnext = NULL;
+		*prefetch_tail = p;
+		prefetch_tail = &p->p_qnext;
+		hash_insert(&prefetch_tbl, &p->p_node,
+			    hash_string_nocase(hname));
+		pthread_cond_signal(&prefetch_work);
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+}
+
+/*
+ * If @hname was prefetched, wait for the answer and return 1.  *@aip
+ * still belongs to the prefetch table, and may be NULL.
+ */
+static int
+client_prefetched(const char *hname, struct addrinfo **aip)
+{
+	struct client_prefetch *p;
+
+	if (prefetch_nthreads == 0)
+		return 0;
+
+	pthread_mutex_lock(&prefetch_lock);
+	p = prefetch_find(hname);
+	if (p != NULL) {
+		while (!p->p_done)
+			pthread_cond_wait(&prefetch_done, &prefetch_lock);
+		*aip = p->p_ai;
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+	return p != NULL;
+}
+
+/**
+ * client_prefetch_stop - stop resolving names ahead of time
+ *
+ * Waits for lookups in progress, and forgets every answer.
+ */
+void
+client_prefetch_stop(void)
+{
+	struct client_prefetch *p;
+	unsigned int i;
+
+	if (prefetch_threads == NULL)
+		return;
+
+	pthread_mutex_lock(&prefetch_lock);
+	prefetch_stopping = 1;
+	/* Names nobody asked for yet needn't be looked up */
+	prefetch_queue = NULL;
+	prefetch_tail = &prefetch_queue;
+	pthread_cond_broadcast(&prefetch_work);
+	pthread_mutex_unlock(&prefetch_lock);
+
+	for (i = 0; i < prefetch_nthreads; i++)
+		pthread_join(prefetch_threads[i], NULL);
+	free(prefetch_threads);
+	prefetch_threads = NULL;
+	prefetch_nthreads = 0;
+
+	while ((p = prefetch_list) != NULL) {
+		prefetch_list = p->p_next;
+		freeaddrinfo(p->p_ai);
+		free(p->p_name);
+		free(p);
+	}
+	hash_clear(&prefetch_tbl);
 }
 
 /**
@@ -269,28 +582,24 @@ nfs_client *
 client_lookup(char *hname, int canonical)
 {
 	nfs_client	*clp = NULL;
-	int		htype;
+	int		htype, borrowed = 0;
 	struct addrinfo	*ai = NULL;
 
 	htype = client_gettype(hname);
 
 	if (htype == MCL_FQDN && !canonical) {
-		ai = host_addrinfo(hname);
+		if (client_prefetched(hname, &ai))
+			borrowed = 1;
+		else
+			ai = host_addrinfo(hname);
 		if (!ai) {
 			xlog(L_WARNING, "Failed to resolve %s", hname);
 			goto out;
 		}
 		hname = ai->ai_canonname;
-
-		for (clp = clientlist[htype]; clp; clp = clp->m_next)
-			if (client_check(clp, ai))
-				break;
-	} else {
-		for (clp = clientlist[htype]; clp; clp = clp->m_next) {
-			if (strcasecmp(hname, clp->m_hostname)==0)
-				break;
-		}
-	}
+		clp = client_find_addr(ai);
+	} else
+		clp = client_find_name(htype, hname);
 
 	if (clp == NULL) {
 		clp = calloc(1, sizeof(*clp));
@@ -305,11 +614,15 @@ client_lookup(char *hname, int canonical)
 		client_add(clp);
 	}
 
-	if (htype == MCL_FQDN && clp->m_naddr == 0)
+	if (htype == MCL_FQDN && clp->m_naddr == 0) {
 		init_addrlist(clp, ai);
+		client_index_addrs(clp);
+		client_gen++;
+	}
 
 out:
-	freeaddrinfo(ai);
+	if (!borrowed)
+		freeaddrinfo(ai);
 	return clp;
 }
 
@@ -333,6 +646,7 @@ client_dup(const nfs_client *clp, const struct addrinfo *ai)
 	memcpy(new, clp, sizeof(*new));
 	new->m_type = MCL_FQDN;
 	new->m_hostname = NULL;
+	new->m_addrkeys = NULL;
 
 	if (!client_init(new, ai->ai_canonname, ai)) {
 		client_free(new);
@@ -370,7 +684,39 @@ client_freeall(void)
 			*head = (clp = *head)->m_next;
 			client_free(clp);
 		}
+		client_tails[i] = NULL;
+		hash_clear(&client_names[i]);
+	}
+	hash_clear(&client_addrs);
+	client_gen++;
+}
+
+/**
+ * client_prune - deallocate nfs_client records that no export uses
+ *
+ */
+void
+client_prune(void)
+{
+	nfs_client	*clp, **cpp;
+	int		i, pruned = 0;
+
+	for (i = 0; i < MCL_MAXTYPES; i++) {
+		cpp = clientlist + i;
+		while ((clp = *cpp) != NULL) {
+			if (clp->m_count > 0) {
+				cpp = &clp->m_next;
+				continue;
+			}
+			*cpp = clp->m_next;
+			client_unindex(clp);
+			client_free(clp);
+			pruned++;
+		}
+		client_tails[i] = cpp;
 	}
+	if (pruned)
+		client_gen++;
 }
 
 /**
@@ -408,18 +754,7 @@ client_resolve(const struct sockaddr *sap)
 char *
 client_compose(const struct addrinfo *ai)
 {
-	char *name = NULL;
-	int i;
-
-	for (i = 0 ; i < MCL_MAXTYPES; i++) {
-		nfs_client	*clp;
-		for (clp = clientlist[i]; clp ; clp = clp->m_next) {
-			if (!client_check(clp, ai))
-				continue;
-			name = add_name(name, clp->m_hostname);
-		}
-	}
-	return name;
+	return client_match_all(ai, NULL);
 }
 
 /**
@@ -599,6 +934,111 @@ check_subnetwork(const nfs_client *clp, const struct addrinfo *ai)
 	return 0;
 }
 
+/*
+ * Find the aliases of @hname.  Unlike gethostbyname(3), this is safe
+ * to call from several threads.  The caller frees *bufp.
+ */
+static struct hostent *
+client_gethostbyname(const char *hname, struct hostent *he, char **bufp)
+{
+#ifdef HAVE_GETHOSTBYNAME_R
+	struct hostent *hp = NULL;
+	size_t len = 1024;
+	char *buf = NULL, *nbuf;
+	int herr;
+
+	for (;;) {
+		nbuf = realloc(buf, len);
+		if (nbuf == NULL)
+			break;
+		buf = nbuf;
+		if (gethostbyname_r(hname, he, buf, len, &hp, &herr) != ERANGE)
+			break;
+		len <<= 1;
+	}
+	*bufp = buf;
+	return hp;
+#else	/* !HAVE_GETHOSTBYNAME_R */
+	*bufp = NULL;
+	return gethostbyname(hname);
+#endif	/* !HAVE_GETHOSTBYNAME_R */
+}
+
+/*
+ * Return a NULL-terminated copy of the aliases of @hname, or NULL if
+ * it has none.  Free it with client_aliases_free().
+ */
+static char **
+client_aliases(const char *hname)
+{
+	struct hostent he, *hp;
+	char **aliases = NULL;
+	char *buf;
+	int i, n;
+
+	hp = client_gethostbyname(hname, &he, &buf);
+	if (hp != NULL) {
+		for (n = 0; hp->h_aliases[n]; n++)
+			;
+		aliases = calloc(n + 1, sizeof(*aliases));
+		for (i = 0; aliases && i < n; i++)
+			if ((aliases[i] = strdup(hp->h_aliases[i])) == NULL)
+				break;
+	}
+	free(buf);
+	return aliases;
+}
+
+static void
+client_aliases_free(char **aliases)
+{
+	char **ap;
+
+	if (aliases == NULL)
+		return;
+	for (ap = aliases; *ap; ap++)
+		free(*ap);
+	free(aliases);
+}
+
+/*
+ * Lookups done ahead for one client
+ *
+ * Matching a host against wildcard and netgroup clients may ask DNS,
+ * NIS or LDAP, and wait for them.  A caller that must not wait while
+ * it holds something, as mountd holds its export table, does those
+ * lookups first with client_check_prepare().  Until it calls
+ * client_check_forget(), client_check() on the same thread answers
+ * for that host from what was found.
+ */
+struct netgroup_verdict {
+	char *			v_name;		/* m_hostname, "@group" */
+	int			v_match;
+};
+
+struct client_facts {
+	char *			f_name;		/* ai_canonname */
+	union nfs_sockaddr	f_addr;
+	char **			f_aliases;	/* of f_name */
+	char *			f_cname;	/* if f_name is an address */
+	struct netgroup_verdict *f_verdicts;
+	int			f_nverdicts;
+};
+
+static __thread struct client_facts *client_facts;
+
+static const struct client_facts *
+client_facts_for(const struct addrinfo *ai)
+{
+	const struct client_facts *f = client_facts;
+
+	if (f == NULL || ai->ai_canonname == NULL ||
+	    strcmp(f->f_name, ai->ai_canonname) != 0 ||
+	    !nfs_compare_sockaddr(&f->f_addr.sa, ai->ai_addr))
+		return NULL;
+	return f;
+}
+
 /*
  * Check if a wildcard nfs_client record matches the canonical name
  * or the aliases of a host.  Return 1 if a match is found, otherwise
@@ -607,127 +1047,556 @@ check_subnetwork(const nfs_client *clp, const struct addrinfo *ai)
 static int
 check_wildcard(const nfs_client *clp, const struct addrinfo *ai)
 {
+	const struct client_facts *f = client_facts_for(ai);
 	char *cname = clp->m_hostname;
 	char *hname = ai->ai_canonname;
-	struct hostent *hp;
-	char **ap;
+	char **aliases, **ap;
+	int match = 0;
 
 	if (wildmat(hname, cname))
 		return 1;
 
 	/* See if hname aliases listed in /etc/hosts or nis[+]
 	 * match the requested wildcard */
-	hp = gethostbyname(hname);
-	if (hp != NULL) {
-		for (ap = hp->h_aliases; *ap; ap++)
-			if (wildmat(*ap, cname))
-				return 1;
+	aliases = f ? f->f_aliases : client_aliases(hname);
+	if (aliases != NULL) {
+		for (ap = aliases; *ap; ap++)
+			if (wildmat(*ap, cname)) {
+				match = 1;
+				break;
+			}
 	}
+	if (f == NULL)
+		client_aliases_free(aliases);
 
-	return 0;
+	return match;
 }
 
+#ifdef HAVE_INNETGR
 /*
- * Check if @ai's hostname or aliases fall in a given netgroup.
- * Return 1 if @ai represents a host in the netgroup, otherwise
- * zero.
+ * innetgr(3) is not thread safe.
  */
-#ifdef HAVE_INNETGR
+static pthread_mutex_t netgroup_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int
-check_netgroup(const nfs_client *clp, const struct addrinfo *ai)
+client_innetgr(const char *netgroup, const char *host)
 {
-	const char *netgroup = clp->m_hostname + 1;
-	struct addrinfo *tmp = NULL;
-	struct hostent *hp;
-	char *dot, *hname, *ip;
-	int i, match;
+	uint64_t start = latency_start();
+	int ret;
+
+	pthread_mutex_lock(&netgroup_lock);
+	ret = innetgr(netgroup, host, NULL, NULL);
+	pthread_mutex_unlock(&netgroup_lock);
+	latency_record(LAT_NETGROUP_INNETGR, start);
+	return ret;
+}
 
-	match = 0;
+/*
+ * Netgroup expansion cache
+ *
+ * Each netgroup named in the exports is enumerated once with
+ * getnetgrent(3) into a hash of its member hosts, so testing a
+ * candidate hostname or address costs a lookup instead of an
+ * innetgr(3) call per name.  Expansions are refreshed every
+ * netgroup_ttl seconds, and dropped by client_netgroup_flush().
+ * Netgroups that can't be enumerated are left to innetgr(3).
+ *
+ * Enumerating a large NIS or LDAP netgroup takes a while, so it is
+ * done without netgroup_cache_lock: checks against other netgroups
+ * carry on, and while an expired expansion is being refreshed the
+ * old one keeps answering.
+ */
+#define NETGROUP_DEFAULT_TTL	(5 * 60)
+
+#define NG_ANYHOST	0x01	/* a member with an empty host field */
+#define NG_INNETGR	0x02	/* can't be enumerated */
+
+struct netgroup_host {
+	struct hash_node	nh_node;
+	struct netgroup_host *	nh_next;
+	char *			nh_name;
+};
+
+struct netgroup {
+	struct hash_node	ng_node;
+	char *			ng_name;
+	time_t			ng_expires;
+	int			ng_flags;
+	int			ng_refreshing;
+	struct hash_table	ng_hosts;
+	struct netgroup_host *	ng_list;
+};
+
+static struct hash_table	netgroup_cache = HASH_TABLE_INIT;
+static pthread_mutex_t		netgroup_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int		netgroup_ttl = NETGROUP_DEFAULT_TTL;
 
-	hname = strdup(ai->ai_canonname);
-	if (hname == NULL) {
-		xlog(D_GENERAL, "%s: no memory for strdup", __func__);
-		goto out;
-	}
+static void
+netgroup_free(struct netgroup *ng)
+{
+	struct netgroup_host *nh, *next;
 
-	/* First, try to match the hostname without
-	 * splitting off the domain */
-	if (innetgr(netgroup, hname, NULL, NULL)) {
-		match = 1;
-		goto out;
+	for (nh = ng->ng_list; nh; nh = next) {
+		next = nh->nh_next;
+		free(nh->nh_name);
+		free(nh);
 	}
+	hash_clear(&ng->ng_hosts);
+	free(ng->ng_name);
+	free(ng);
+}
 
-	/* See if hname aliases listed in /etc/hosts or nis[+]
-	 * match the requested netgroup */
-	hp = gethostbyname(hname);
-	if (hp != NULL) {
-		for (i = 0; hp->h_aliases[i]; i++)
-			if (innetgr(netgroup, hp->h_aliases[i], NULL, NULL)) {
-				match = 1;
-				goto out;
-			}
-	}
+static int
+netgroup_has(const struct netgroup *ng, const char *host)
+{
+	struct hash_node *n;
 
-	/* If hname happens to be an IP address, convert it
-	 * to a the canonical DNS name bound to this address. */
-	tmp = host_pton(hname);
-	if (tmp != NULL) {
-		char *cname = host_canonname(tmp->ai_addr);
-		freeaddrinfo(tmp);
-
-		/* The resulting FQDN may be in our netgroup. */
-		if (cname != NULL) {
-			free(hname);
-			hname = cname;
-			if (innetgr(netgroup, hname, NULL, NULL)) {
-				match = 1;
-				goto out;
-			}
-		}
-	}
+	for (n = hash_lookup(&ng->ng_hosts, hash_string_nocase(host)); n;
+	     n = hash_lookup_next(n)) {
+		struct netgroup_host *nh =
+			hash_entry(n, struct netgroup_host, nh_node);
 
-	/* check whether the IP itself is in the netgroup */
-	ip = calloc(INET6_ADDRSTRLEN, 1);
-	if (inet_ntop(ai->ai_family, &(((struct sockaddr_in *)ai->ai_addr)->sin_addr), ip, INET6_ADDRSTRLEN) == ip) {
-		if (innetgr(netgroup, ip, NULL, NULL)) {
-			free(hname);
-			hname = ip;
-			match = 1;
-			goto out;
-		}
+		if (strcasecmp(nh->nh_name, host) == 0)
+			return 1;
 	}
-	free(ip);
+	return 0;
+}
 
-	/* Okay, strip off the domain (if we have one) */
-	dot = strchr(hname, '.');
-	if (dot == NULL)
-		goto out;
+static int
+netgroup_add(struct netgroup *ng, const char *host)
+{
+	struct netgroup_host *nh;
 
-	*dot = '\0';
-	match = innetgr(netgroup, hname, NULL, NULL);
+	if (netgroup_has(ng, host))
+		return 1;
 
-out:
-	free(hname);
-	return match;
+	nh = malloc(sizeof(*nh));
+	if (nh == NULL)
+		return 0;
+	nh->nh_name = strdup(host);
+	if (nh->nh_name == NULL) {
+		free(nh);
+		return 0;
+	}
+	nh->nh_next = ng->ng_list;
+	ng->ng_list = nh;
+	hash_insert(&ng->ng_hosts, &nh->nh_node, hash_string_nocase(host));
+	return 1;
 }
-#else	/* !HAVE_INNETGR */
+
+/*
+ * Add an address literal in the form check_netgroup() will look it
+ * up in, so "fe80::0:1" matches a client at fe80::1.
+ */
 static int
-check_netgroup(__attribute__((unused)) const nfs_client *clp,
-		__attribute__((unused)) const struct addrinfo *ai)
+netgroup_add_addr(struct netgroup *ng, const char *host)
 {
-	return 0;
+	char buf[INET6_ADDRSTRLEN];
+	struct addrinfo *ai;
+	int ret = 1;
+
+	ai = host_pton(host);
+	if (ai == NULL)
+		return 1;
+	host_ntop(ai->ai_addr, buf, sizeof(buf));
+	if (strcmp(buf, host) != 0)
+		ret = netgroup_add(ng, buf);
+	freeaddrinfo(ai);
+	return ret;
 }
-#endif	/* !HAVE_INNETGR */
 
-/**
- * client_check - check if IP address information matches a cached nfs_client
- * @clp: pointer to a cached nfs_client record
- * @ai: pointer to addrinfo to compare it with
- *
- * Returns 1 if the address information matches the cached nfs_client,
- * otherwise zero.
- */
-int
+static struct netgroup *
+netgroup_expand(const char *name)
+{
+	uint64_t start = latency_start();
+	struct netgroup *ng;
+	int count = 0;
+
+	ng = calloc(1, sizeof(*ng));
+	if (ng == NULL)
+		return NULL;
+	ng->ng_name = strdup(name);
+	if (ng->ng_name == NULL) {
+		free(ng);
+		return NULL;
+	}
+
+#ifdef HAVE_GETNETGRENT
+	pthread_mutex_lock(&netgroup_lock);
+	if (setnetgrent(name)) {
+		char *host, *user, *domain;
+
+		while (getnetgrent(&host, &user, &domain)) {
+			count++;
+			if (host == NULL)
+				ng->ng_flags |= NG_ANYHOST;
+			else if (!netgroup_add(ng, host))
+				ng->ng_flags |= NG_INNETGR;
+		}
+	}
+	endnetgrent();
+	pthread_mutex_unlock(&netgroup_lock);
+#endif
+
+	if (count == 0 || (ng->ng_flags & NG_INNETGR)) {
+		xlog(D_GENERAL, "%s: can't enumerate netgroup %s, "
+			"using innetgr(3)", __func__, name);
+		ng->ng_flags = NG_INNETGR;
+	} else {
+		struct netgroup_host *nh;
+
+		for (nh = ng->ng_list; nh; nh = nh->nh_next)
+			if (!netgroup_add_addr(ng, nh->nh_name))
+				ng->ng_flags = NG_INNETGR;
+		xlog(D_GENERAL, "%s: netgroup %s has %u hosts%s", __func__,
+			name, ng->ng_hosts.h_count,
+			(ng->ng_flags & NG_ANYHOST) ? " and a wildcard" : "");
+	}
+
+	ng->ng_expires = time(NULL) + netgroup_ttl;
+	latency_record(LAT_NETGROUP_EXPAND, start);
+	return ng;
+}
+
+static struct netgroup *
+netgroup_find(const char *netgroup, unsigned int hash)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&netgroup_cache, hash); n;
+	     n = hash_lookup_next(n)) {
+		struct netgroup *ng = hash_entry(n, struct netgroup, ng_node);
+
+		if (strcmp(ng->ng_name, netgroup) == 0)
+			return ng;
+	}
+	return NULL;
+}
+
+/*
+ * Enumerate @netgroup without holding netgroup_cache_lock, then
+ * publish the result unless another thread got there first.  Called
+ * and returns with the lock held; returns the entry to use, or NULL.
+ */
+static struct netgroup *
+netgroup_refresh(const char *netgroup, unsigned int hash)
+{
+	struct netgroup *ng, *new;
+
+	pthread_mutex_unlock(&netgroup_cache_lock);
+	new = netgroup_expand(netgroup);
+	pthread_mutex_lock(&netgroup_cache_lock);
+
+	/* The entry may have been flushed or replaced meanwhile */
+	ng = netgroup_find(netgroup, hash);
+	if (new == NULL) {
+		if (ng != NULL)
+			ng->ng_refreshing = 0;
+		return ng;
+	}
+	if (ng != NULL) {
+		if (!ng->ng_refreshing && ng->ng_expires > time(NULL)) {
+			netgroup_free(new);
+			return ng;
+		}
+		hash_remove(&netgroup_cache, &ng->ng_node);
+		netgroup_free(ng);
+	}
+	hash_insert(&netgroup_cache, &new->ng_node, hash);
+	return new;
+}
+
+/*
+ * Returns 1 if @host is in @netgroup, otherwise zero.
+ */
+static int
+netgroup_match(const char *netgroup, const char *host)
+{
+	unsigned int hash = hash_string(netgroup);
+	struct netgroup *ng;
+	int ret;
+
+	if (netgroup_ttl == 0)
+		return client_innetgr(netgroup, host);
+
+	pthread_mutex_lock(&netgroup_cache_lock);
+	ng = netgroup_find(netgroup, hash);
+	if (ng == NULL || (ng->ng_expires <= time(NULL) &&
+			   !ng->ng_refreshing)) {
+		if (ng != NULL)
+			ng->ng_refreshing = 1;
+		ng = netgroup_refresh(netgroup, hash);
+	}
+
+	if (ng == NULL || (ng->ng_flags & NG_INNETGR)) {
+		pthread_mutex_unlock(&netgroup_cache_lock);
+		return client_innetgr(netgroup, host);
+	}
+	ret = (ng->ng_flags & NG_ANYHOST) || netgroup_has(ng, host);
+	pthread_mutex_unlock(&netgroup_cache_lock);
+	return ret;
+}
+
+/**
+ * client_netgroup_flush - forget all netgroup expansions
+ *
+ * Netgroups are enumerated again the next time they are used.
+ */
+void
+client_netgroup_flush(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&netgroup_cache_lock);
+	for (i = 0; i < netgroup_cache.h_size; i++) {
+		struct hash_node *n, *next;
+
+		for (n = netgroup_cache.h_buckets[i]; n; n = next) {
+			next = n->h_next;
+			netgroup_free(hash_entry(n, struct netgroup, ng_node));
+		}
+	}
+	hash_clear(&netgroup_cache);
+	pthread_mutex_unlock(&netgroup_cache_lock);
+}
+
+/**
+ * client_netgroup_ttl - set how long netgroup expansions are used
+ * @seconds: refresh interval; zero disables the cache
+ *
+ */
+void
+client_netgroup_ttl(unsigned int seconds)
+{
+	netgroup_ttl = seconds;
+	client_netgroup_flush();
+}
+
+/*
+ * The canonical DNS name bound to @hname, if @hname happens to be an
+ * IP address.  Returns NULL otherwise; the caller frees the string.
+ */
+static char *
+client_address_name(const char *hname)
+{
+	struct addrinfo *tmp;
+	char *cname;
+
+	tmp = host_pton(hname);
+	if (tmp == NULL)
+		return NULL;
+	cname = host_canonname(tmp->ai_addr);
+	freeaddrinfo(tmp);
+	return cname;
+}
+
+/*
+ * Check if @ai's hostname or aliases fall in @netgroup.  @f, if not
+ * NULL, holds the aliases and address name already looked up.
+ * Return 1 if @ai represents a host in the netgroup, otherwise zero.
+ */
+static int
+netgroup_check(const char *netgroup, const struct addrinfo *ai,
+	       const struct client_facts *f)
+{
+	char **aliases;
+	char *dot, *hname, *cname;
+	char ip[INET6_ADDRSTRLEN];
+	int i, match;
+
+	match = 0;
+
+	hname = strdup(ai->ai_canonname);
+	if (hname == NULL) {
+		xlog(D_GENERAL, "%s: no memory for strdup", __func__);
+		goto out;
+	}
+
+	/* First, try to match the hostname without
+	 * splitting off the domain */
+	if (netgroup_match(netgroup, hname)) {
+		match = 1;
+		goto out;
+	}
+
+	/* check whether the IP itself is in the netgroup */
+	host_ntop(ai->ai_addr, ip, sizeof(ip));
+	if (netgroup_match(netgroup, ip)) {
+		match = 1;
+		goto out;
+	}
+
+	/* See if hname aliases listed in /etc/hosts or nis[+]
+	 * match the requested netgroup */
+	aliases = f ? f->f_aliases : client_aliases(hname);
+	if (aliases != NULL) {
+		for (i = 0; aliases[i]; i++)
+			if (netgroup_match(netgroup, aliases[i])) {
+				match = 1;
+				break;
+			}
+	}
+	if (f == NULL)
+		client_aliases_free(aliases);
+	if (match)
+		goto out;
+
+	/* If hname happens to be an IP address, convert it
+	 * to a the canonical DNS name bound to this address. */
+	if (f == NULL)
+		cname = client_address_name(hname);
+	else if (f->f_cname != NULL)
+		cname = strdup(f->f_cname);
+	else
+		cname = NULL;
+
+	/* The resulting FQDN may be in our netgroup. */
+	if (cname != NULL) {
+		free(hname);
+		hname = cname;
+		if (netgroup_match(netgroup, hname)) {
+			match = 1;
+			goto out;
+		}
+	}
+
+	/* Okay, strip off the domain (if we have one) */
+	dot = strchr(hname, '.');
+	if (dot == NULL)
+		goto out;
+
+	*dot = '\0';
+	match = netgroup_match(netgroup, hname);
+
+out:
+	free(hname);
+	return match;
+}
+
+/*
+ * Check if @ai's hostname or aliases fall in a given netgroup.
+ * Return 1 if @ai represents a host in the netgroup, otherwise
+ * zero.
+ */
+static int
+check_netgroup(const nfs_client *clp, const struct addrinfo *ai)
+{
+	const struct client_facts *f = client_facts_for(ai);
+	int i;
+
+	if (f != NULL)
+		for (i = 0; i < f->f_nverdicts; i++)
+			if (strcmp(f->f_verdicts[i].v_name,
+				   clp->m_hostname) == 0)
+				return f->f_verdicts[i].v_match;
+
+	/* A netgroup that was added since, if any, is checked here */
+	return netgroup_check(clp->m_hostname + 1, ai, f);
+}
+#else	/* !HAVE_INNETGR */
+void
+client_netgroup_flush(void)
+{
+}
+
+void
+client_netgroup_ttl(__attribute__((unused)) unsigned int seconds)
+{
+}
+
+static int
+check_netgroup(__attribute__((unused)) const nfs_client *clp,
+		__attribute__((unused)) const struct addrinfo *ai)
+{
+	return 0;
+}
+#endif	/* !HAVE_INNETGR */
+
+/**
+ * client_check_prepare - look up ahead what matching a host needs
+ * @ai: addrinfo of the host, with ai_canonname filled in
+ * @netgroups: m_hostname of every MCL_NETGROUP client
+ * @count: number of entries in @netgroups
+ *
+ * Does every lookup that client_check() would need to match @ai
+ * against wildcard and netgroup clients, so that callers can do it
+ * without holding anything.  Replaces what an earlier call found.
+ */
+void
+client_check_prepare(const struct addrinfo *ai, char **netgroups,
+		     int count)
+{
+	struct client_facts *f;
+	int i;
+
+	client_check_forget();
+	if (ai->ai_canonname == NULL || ai->ai_addrlen > sizeof(f->f_addr))
+		return;
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL)
+		return;
+	f->f_name = strdup(ai->ai_canonname);
+	if (f->f_name == NULL) {
+		free(f);
+		return;
+	}
+	memcpy(&f->f_addr, ai->ai_addr, ai->ai_addrlen);
+	f->f_aliases = client_aliases(f->f_name);
+
+#ifdef HAVE_INNETGR
+	if (count > 0) {
+		f->f_cname = client_address_name(f->f_name);
+		f->f_verdicts = calloc(count, sizeof(*f->f_verdicts));
+	}
+	for (i = 0; f->f_verdicts && i < count; i++) {
+		f->f_verdicts[i].v_name = strdup(netgroups[i]);
+		if (f->f_verdicts[i].v_name == NULL)
+			break;
+		f->f_verdicts[i].v_match =
+			netgroup_check(netgroups[i] + 1, ai, f);
+		f->f_nverdicts++;
+	}
+#else	/* !HAVE_INNETGR */
+	(void)netgroups;
+	(void)count;
+	(void)i;
+#endif	/* !HAVE_INNETGR */
+
+	client_facts = f;
+}
+
+/**
+ * client_check_forget - drop what client_check_prepare() found
+ *
+ */
+void
+client_check_forget(void)
+{
+	struct client_facts *f = client_facts;
+	int i;
+
+	if (f == NULL)
+		return;
+	client_facts = NULL;
+	for (i = 0; i < f->f_nverdicts; i++)
+		free(f->f_verdicts[i].v_name);
+	free(f->f_verdicts);
+	free(f->f_cname);
+	client_aliases_free(f->f_aliases);
+	free(f->f_name);
+	free(f);
+}
+
+/**
+ * client_check - check if IP address information matches a cached nfs_client
+ * @clp: pointer to a cached nfs_client record
+ * @ai: pointer to addrinfo to compare it with
+ *
+ * Returns 1 if the address information matches the cached nfs_client,
+ * otherwise zero.
+ */
+int
 client_check(const nfs_client *clp, const struct addrinfo *ai)
 {
 	switch (clp->m_type) {
@@ -784,3 +1653,467 @@ client_gettype(char *ident)
 
 	return MCL_FQDN;
 }
+
+/*
+ * Compiled client matcher
+ *
+ * client_compose() has to find every client that matches an address,
+ * which used to mean calling client_check() on every client in turn.
+ * Instead, MCL_FQDN clients are found through client_addrs, and the
+ * rest are compiled into indexes the first time they are needed after
+ * the list changes:
+ *
+ *  - MCL_SUBNETWORK clients with a prefix netmask go into a binary
+ *    trie per address family, so walking the address's bits once
+ *    finds every subnet containing it;
+ *  - MCL_WILDCARD clients of the form "*suffix" are hashed by suffix,
+ *    so a hostname is matched by looking up each of its suffixes.
+ *
+ * Subnets with a non-contiguous netmask and other wildcard patterns
+ * are still checked one by one, as are netgroups.
+ */
+struct client_ref {
+	struct client_ref *	r_next;
+	nfs_client *		r_client;
+};
+
+struct subnet_node {
+	struct subnet_node *	sn_child[2];
+	struct client_ref *	sn_clients;
+};
+
+struct client_key {
+	struct hash_node	k_node;
+	nfs_client *		k_client;
+	const void *		k_key;		/* suffix */
+};
+
+struct client_matcher {
+	unsigned int		cm_gen;
+	int			cm_built;
+	struct subnet_node *	cm_trie4;
+	struct subnet_node *	cm_trie6;
+	struct client_ref *	cm_subnets;	/* non-prefix netmasks */
+	struct hash_table	cm_suffixes;	/* "*suffix" wildcards */
+	struct client_ref *	cm_wildcards;	/* other wildcards */
+};
+
+static struct client_matcher	matcher = {
+	.cm_suffixes		= HASH_TABLE_INIT,
+};
+static pthread_rwlock_t		matcher_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void
+client_ref_add(struct client_ref **list, nfs_client *clp)
+{
+	struct client_ref *ref = xmalloc(sizeof(*ref));
+
+	ref->r_client = clp;
+	ref->r_next = *list;
+	*list = ref;
+}
+
+static void
+client_ref_free(struct client_ref *ref)
+{
+	struct client_ref *next;
+
+	for (; ref; ref = next) {
+		next = ref->r_next;
+		free(ref);
+	}
+}
+
+static void
+subnet_free(struct subnet_node *node)
+{
+	if (node == NULL)
+		return;
+	subnet_free(node->sn_child[0]);
+	subnet_free(node->sn_child[1]);
+	client_ref_free(node->sn_clients);
+	free(node);
+}
+
+static void
+client_keys_free(struct hash_table *tbl)
+{
+	unsigned int i;
+
+	for (i = 0; i < tbl->h_size; i++) {
+		struct hash_node *n, *next;
+
+		for (n = tbl->h_buckets[i]; n; n = next) {
+			next = n->h_next;
+			free(hash_entry(n, struct client_key, k_node));
+		}
+	}
+	hash_clear(tbl);
+}
+
+static void
+client_key_add(struct hash_table *tbl, nfs_client *clp, const void *key,
+		unsigned int hash)
+{
+	struct client_key *k = xmalloc(sizeof(*k));
+
+	k->k_client = clp;
+	k->k_key = key;
+	hash_insert(tbl, &k->k_node, hash);
+}
+
+static inline int
+addr_bit(const unsigned char *addr, unsigned int i)
+{
+	return (addr[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+/*
+ * Returns the prefix length of @mask, or -1 if it isn't a prefix.
+ */
+static int
+mask_prefixlen(const unsigned char *mask, unsigned int bits)
+{
+	unsigned int i, len = 0;
+
+	while (len < bits && addr_bit(mask, len))
+		len++;
+	for (i = len; i < bits; i++)
+		if (addr_bit(mask, i))
+			return -1;
+	return len;
+}
+
+static void
+subnet_insert(struct subnet_node **root, const unsigned char *addr,
+		unsigned int prefixlen, nfs_client *clp)
+{
+	struct subnet_node **node = root;
+	unsigned int i;
+
+	for (i = 0; ; i++) {
+		if (*node == NULL) {
+			*node = xmalloc(sizeof(**node));
+			(*node)->sn_child[0] = (*node)->sn_child[1] = NULL;
+			(*node)->sn_clients = NULL;
+		}
+		if (i == prefixlen)
+			break;
+		node = &(*node)->sn_child[addr_bit(addr, i)];
+	}
+	client_ref_add(&(*node)->sn_clients, clp);
+}
+
+static unsigned int
+addr_hash(const struct sockaddr *sap)
+{
+	switch (sap->sa_family) {
+	case AF_INET:
+		return hash_bytes(&((const struct sockaddr_in *)sap)->sin_addr,
+				sizeof(struct in_addr));
+	case AF_INET6:
+		return hash_bytes(&((const struct sockaddr_in6 *)sap)->sin6_addr,
+				sizeof(struct in6_addr));
+	}
+	return 0;
+}
+
+static void
+matcher_add_subnet(nfs_client *clp)
+{
+	const struct sockaddr *sap = get_addrlist(clp, 0);
+	const unsigned char *addr, *mask;
+	unsigned int bits;
+	int prefixlen;
+
+	switch (sap->sa_family) {
+	case AF_INET:
+		addr = (const unsigned char *)
+			&get_addrlist_in(clp, 0)->sin_addr;
+		mask = (const unsigned char *)
+			&get_addrlist_in(clp, 1)->sin_addr;
+		bits = 32;
+		break;
+#ifdef IPV6_SUPPORTED
+	case AF_INET6:
+		addr = (const unsigned char *)
+			&get_addrlist_in6(clp, 0)->sin6_addr;
+		mask = (const unsigned char *)
+			&get_addrlist_in6(clp, 1)->sin6_addr;
+		bits = 128;
+		break;
+#endif
+	default:
+		return;
+	}
+
+	prefixlen = mask_prefixlen(mask, bits);
+	if (prefixlen < 0)
+		client_ref_add(&matcher.cm_subnets, clp);
+	else
+		subnet_insert(bits == 32 ? &matcher.cm_trie4 : &matcher.cm_trie6,
+				addr, prefixlen, clp);
+}
+
+/*
+ * Returns the literal suffix of a "*suffix" pattern, or NULL if
+ * @pattern has any other form.
+ */
+static const char *
+wildcard_suffix(const char *pattern)
+{
+	const char *p;
+
+	if (*pattern != '*')
+		return NULL;
+	while (*pattern == '*')
+		pattern++;
+	for (p = pattern; *p; p++)
+		if (*p == '*' || *p == '?' || *p == '[' || *p == '\\')
+			return NULL;
+	return pattern;
+}
+
+static void
+matcher_free(void)
+{
+	subnet_free(matcher.cm_trie4);
+	subnet_free(matcher.cm_trie6);
+	matcher.cm_trie4 = matcher.cm_trie6 = NULL;
+	client_ref_free(matcher.cm_subnets);
+	matcher.cm_subnets = NULL;
+	client_keys_free(&matcher.cm_suffixes);
+	client_ref_free(matcher.cm_wildcards);
+	matcher.cm_wildcards = NULL;
+	matcher.cm_built = 0;
+}
+
+static void
+matcher_build(void)
+{
+	const char *suffix;
+	nfs_client *clp;
+
+	matcher_free();
+
+	for (clp = clientlist[MCL_SUBNETWORK]; clp; clp = clp->m_next)
+		matcher_add_subnet(clp);
+
+	for (clp = clientlist[MCL_WILDCARD]; clp; clp = clp->m_next) {
+		suffix = wildcard_suffix(clp->m_hostname);
+		if (suffix != NULL)
+			client_key_add(&matcher.cm_suffixes, clp, suffix,
+					hash_string_nocase(suffix));
+		else
+			client_ref_add(&matcher.cm_wildcards, clp);
+	}
+
+	matcher.cm_gen = client_gen;
+	matcher.cm_built = 1;
+}
+
+/*
+ * Collects matching clients without duplicates.
+ */
+struct client_matches {
+	nfs_client **		m_clients;
+	unsigned int		m_count;
+	unsigned int		m_size;
+};
+
+static void
+client_matches_add(struct client_matches *m, nfs_client *clp)
+{
+	unsigned int i;
+
+	for (i = 0; i < m->m_count; i++)
+		if (m->m_clients[i] == clp)
+			return;
+	if (m->m_count == m->m_size) {
+		m->m_size = m->m_size ? m->m_size << 1 : 16;
+		m->m_clients = xrealloc(m->m_clients,
+				m->m_size * sizeof(*m->m_clients));
+	}
+	m->m_clients[m->m_count++] = clp;
+}
+
+static void
+subnet_match(const struct subnet_node *node, const unsigned char *addr,
+		unsigned int bits, struct client_matches *m)
+{
+	const struct client_ref *ref;
+	unsigned int i;
+
+	for (i = 0; node; i++) {
+		for (ref = node->sn_clients; ref; ref = ref->r_next)
+			client_matches_add(m, ref->r_client);
+		if (i == bits)
+			break;
+		node = node->sn_child[addr_bit(addr, i)];
+	}
+}
+
+static void
+match_address(const struct sockaddr *sap, struct client_matches *m)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&client_addrs, addr_hash(sap)); n;
+	     n = hash_lookup_next(n)) {
+		struct client_addr *a =
+			hash_entry(n, struct client_addr, a_node);
+
+		if (nfs_compare_sockaddr(sap,
+				get_addrlist(a->a_client, a->a_index)))
+			client_matches_add(m, a->a_client);
+	}
+
+	switch (sap->sa_family) {
+	case AF_INET:
+		subnet_match(matcher.cm_trie4, (const unsigned char *)
+			&((const struct sockaddr_in *)sap)->sin_addr, 32, m);
+		break;
+	case AF_INET6:
+		subnet_match(matcher.cm_trie6, (const unsigned char *)
+			&((const struct sockaddr_in6 *)sap)->sin6_addr, 128, m);
+		break;
+	}
+
+}
+
+static void
+match_hostname(char *hname, struct client_matches *m)
+{
+	const struct client_ref *ref;
+	const char *suffix;
+	struct hash_node *n;
+
+	for (suffix = hname; ; suffix++) {
+		for (n = hash_lookup(&matcher.cm_suffixes,
+					hash_string_nocase(suffix)); n;
+		     n = hash_lookup_next(n)) {
+			struct client_key *k =
+				hash_entry(n, struct client_key, k_node);
+
+			if (strcasecmp(suffix, k->k_key) == 0)
+				client_matches_add(m, k->k_client);
+		}
+		if (*suffix == '\0')
+			break;
+	}
+
+	for (ref = matcher.cm_wildcards; ref; ref = ref->r_next)
+		if (wildmat(hname, ref->r_client->m_hostname))
+			client_matches_add(m, ref->r_client);
+}
+
+static void
+match_wildcards(const struct addrinfo *ai, struct client_matches *m)
+{
+	const struct client_facts *f = client_facts_for(ai);
+	char **aliases, **ap;
+
+	if (ai->ai_canonname == NULL)
+		return;
+	match_hostname(ai->ai_canonname, m);
+
+	/* See if hname aliases listed in /etc/hosts or nis[+]
+	 * match any of the wildcards */
+	aliases = f ? f->f_aliases : client_aliases(ai->ai_canonname);
+	if (aliases != NULL)
+		for (ap = aliases; *ap; ap++)
+			match_hostname(*ap, m);
+	if (f == NULL)
+		client_aliases_free(aliases);
+}
+
+static int
+client_seq_cmp(const void *a, const void *b)
+{
+	const nfs_client *ca = *(nfs_client * const *)a;
+	const nfs_client *cb = *(nfs_client * const *)b;
+
+	if (ca->m_type != cb->m_type)
+		return ca->m_type < cb->m_type ? -1 : 1;
+	if (ca->m_seq != cb->m_seq)
+		return ca->m_seq < cb->m_seq ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Collect the MCL_FQDN, MCL_SUBNETWORK and MCL_WILDCARD clients
+ * that match @ai, through the indexes.
+ */
+static void
+client_match_indexed(const struct addrinfo *ai, struct client_matches *m)
+{
+	const struct client_ref *ref;
+	const struct addrinfo *a;
+
+	pthread_rwlock_rdlock(&matcher_lock);
+	while (!matcher.cm_built || matcher.cm_gen != client_gen) {
+		pthread_rwlock_unlock(&matcher_lock);
+		pthread_rwlock_wrlock(&matcher_lock);
+		if (!matcher.cm_built || matcher.cm_gen != client_gen)
+			matcher_build();
+		pthread_rwlock_unlock(&matcher_lock);
+		pthread_rwlock_rdlock(&matcher_lock);
+	}
+
+	for (a = ai; a; a = a->ai_next)
+		match_address(a->ai_addr, m);
+	for (ref = matcher.cm_subnets; ref; ref = ref->r_next)
+		if (check_subnetwork(ref->r_client, ai))
+			client_matches_add(m, ref->r_client);
+	if (clientlist[MCL_WILDCARD])
+		match_wildcards(ai, m);
+	pthread_rwlock_unlock(&matcher_lock);
+}
+
+/**
+ * client_match_list - find the clients that match a host, through indexes
+ * @ai: addrinfo of the host
+ * @count: OUT: number of clients returned
+ *
+ * Returns the MCL_FQDN, MCL_SUBNETWORK and MCL_WILDCARD clients that
+ * client_check() would match with @ai, in no particular order, or
+ * NULL if there are none.  Other types are left to the caller.  The
+ * caller frees the array with free(3).
+ */
+nfs_client **
+client_match_list(const struct addrinfo *ai, unsigned int *count)
+{
+	struct client_matches m = { NULL, 0, 0 };
+
+	client_match_indexed(ai, &m);
+	*count = m.m_count;
+	return m.m_clients;
+}
+
+/*
+ * Add the names of all clients that match @ai to @name, in the
+ * order client_check() would find them walking clientlist[].
+ */
+static char *
+client_match_all(const struct addrinfo *ai, char *name)
+{
+	struct client_matches m = { NULL, 0, 0 };
+	nfs_client *clp;
+	unsigned int i;
+
+	client_match_indexed(ai, &m);
+
+	/* Netgroups, anonymous and gss clients */
+	for (i = MCL_NETGROUP; i < MCL_MAXTYPES; i++)
+		for (clp = clientlist[i]; clp; clp = clp->m_next)
+			if (client_check(clp, ai))
+				client_matches_add(&m, clp);
+
+	if (m.m_count > 1)
+		qsort(m.m_clients, m.m_count, sizeof(*m.m_clients),
+				client_seq_cmp);
+	for (i = 0; i < m.m_count; i++)
+		name = add_name(name, m.m_clients[i]->m_hostname);
+	free(m.m_clients);
+	return name;
+}
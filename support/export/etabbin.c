@@ -0,0 +1,613 @@
+/*
+ * support/export/etabbin.c
+ *
+ * Compiled copy of the etab file.
+ *
+ * Every reader of etab used to tokenize it and parse each entry's
+ * options again.  Whenever exportfs writes etab, it now also writes
+ * etab.bin: the same entries as fixed-size records, with strings
+ * interned in one table and security flavors numbered in another.
+ * Readers map the file and hand out exportents pointing into it.
+ *
+ * The text etab stays the master copy.  etab.bin records the device,
+ * inode, size and mtime of the etab it was compiled from, and is
+ * ignored unless they still match, so a hand-edited etab or one
+ * written by an older exportfs is read as text.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nfslib.h"
+#include "exportfs.h"
+#include "hashtable.h"
+#include "pseudoflavors.h"
+#include "xmalloc.h"
+#include "xlog.h"
+
+#define ETAB_BIN_MAGIC		0x4e465345	/* "ESFN" */
+#define ETAB_BIN_VERSION	1
+#define ETAB_BIN_ALIGN		8
+
+/*
+ * The sections follow the header in this order, each at an offset
+ * that is a multiple of ETAB_BIN_ALIGN.  The file is only ever read
+ * on the host that wrote it, so fields are in host byte order; a
+ * foreign file fails the magic check.
+ */
+struct etab_bin_hdr {
+	uint32_t		h_magic;
+	uint32_t		h_version;
+	uint32_t		h_hdrsize;
+	uint32_t		h_recsize;
+	uint32_t		h_nsecinfo;	/* SECFLAVOR_COUNT + 1 */
+	uint32_t		h_count;	/* records */
+	uint32_t		h_nflavors;
+	uint32_t		h_nids;
+	uint64_t		h_strsize;
+	uint64_t		h_flavors;	/* section offsets */
+	uint64_t		h_records;
+	uint64_t		h_ids;
+	uint64_t		h_strings;
+	/* the etab this was compiled from */
+	uint64_t		h_etab_dev;
+	uint64_t		h_etab_ino;
+	uint64_t		h_etab_size;
+	int64_t			h_etab_mtime;
+	int64_t			h_etab_mtime_nsec;
+};
+
+struct etab_bin_flav {
+	int32_t			f_fnum;
+	uint32_t		f_name;		/* string offset */
+};
+
+/*
+ * One etab entry.  Strings are offsets into the string table, where
+ * zero stands for NULL; squash lists are indexes into the id table.
+ */
+struct etab_bin_rec {
+	uint32_t		r_hostname;
+	uint32_t		r_path;
+	uint32_t		r_mountpoint;
+	uint32_t		r_fslocdata;
+	uint32_t		r_uuid;
+	uint32_t		r_squids;
+	uint32_t		r_sqgids;
+	int32_t			r_nsquids;
+	int32_t			r_nsqgids;
+	int32_t			r_flags;
+	int32_t			r_anonuid;
+	int32_t			r_anongid;
+	int32_t			r_fslocmethod;
+	uint32_t		r_fsid;
+	uint32_t		r_ttl;
+	struct {
+		int32_t		s_flav;		/* flavor table index, or -1 */
+		int32_t		s_flags;
+	}			r_secinfo[SECFLAVOR_COUNT+1];
+};
+
+/* A mapped etab.bin, as returned by etab_bin_open() */
+struct etab_bin {
+	char *				b_map;
+	size_t				b_len;
+	const struct etab_bin_rec *	b_recs;
+	const int32_t *			b_ids;
+	const char *			b_strs;
+	struct flav_info **		b_flavs;
+	unsigned int			b_count;
+	unsigned int			b_next;
+	struct exportent		b_ent;
+};
+
+static uint64_t
+etab_bin_align(uint64_t n)
+{
+	return (n + ETAB_BIN_ALIGN - 1) & ~(uint64_t)(ETAB_BIN_ALIGN - 1);
+}
+
+static int
+etab_bin_hdr_ok(const struct etab_bin_hdr *hdr)
+{
+	return hdr->h_magic == ETAB_BIN_MAGIC &&
+		hdr->h_version == ETAB_BIN_VERSION &&
+		hdr->h_hdrsize == sizeof(*hdr) &&
+		hdr->h_recsize == sizeof(struct etab_bin_rec) &&
+		hdr->h_nsecinfo == SECFLAVOR_COUNT + 1;
+}
+
+static int
+etab_bin_matches(const struct etab_bin_hdr *hdr, const struct stat *stb)
+{
+	return hdr->h_etab_dev == (uint64_t)stb->st_dev &&
+		hdr->h_etab_ino == (uint64_t)stb->st_ino &&
+		hdr->h_etab_size == (uint64_t)stb->st_size &&
+		hdr->h_etab_mtime == (int64_t)stb->st_mtim.tv_sec &&
+		hdr->h_etab_mtime_nsec == (int64_t)stb->st_mtim.tv_nsec;
+}
+
+/**
+ * etab_bin_check - see whether a compiled etab is up to date
+ * @bin: name of the compiled file
+ * @stb: what stat(2) says about the etab it should match
+ *
+ * Returns 1 if @bin has a header this version understands and was
+ * compiled from the etab @stb describes, otherwise zero.
+ */
+int
+etab_bin_check(const char *bin, const struct stat *stb)
+{
+	struct etab_bin_hdr hdr;
+	ssize_t n;
+	int fd;
+
+	fd = open(bin, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	n = read(fd, &hdr, sizeof(hdr));
+	close(fd);
+	return n == sizeof(hdr) && etab_bin_hdr_ok(&hdr) &&
+		etab_bin_matches(&hdr, stb);
+}
+
+/*
+ * Building a compiled etab.  Strings are interned, so the host names
+ * and paths that etab repeats on many lines are stored once.
+ */
+struct etab_bin_str {
+	struct hash_node	s_node;
+	struct etab_bin_str *	s_next;
+	uint32_t		s_off;
+};
+
+struct etab_bin_builder {
+	struct etab_bin_rec *	w_recs;
+	unsigned int		w_count, w_size;
+	int32_t *		w_ids;
+	unsigned int		w_nids, w_idsize;
+	char *			w_strs;
+	size_t			w_strlen, w_strsize;
+	struct hash_table	w_strtbl;
+	struct etab_bin_str *	w_strlist;
+	struct etab_bin_flav	w_flavs[SECFLAVOR_COUNT];
+	unsigned int		w_nflavors;
+};
+
+static uint32_t
+etab_bin_put_str(struct etab_bin_builder *w, const char *str)
+{
+	unsigned int hash;
+	struct hash_node *n;
+	struct etab_bin_str *s;
+	size_t len;
+
+	if (str == NULL)
+		return 0;
+
+	hash = hash_string(str);
+	for (n = hash_lookup(&w->w_strtbl, hash); n; n = hash_lookup_next(n)) {
+		s = hash_entry(n, struct etab_bin_str, s_node);
+		if (strcmp(w->w_strs + s->s_off, str) == 0)
+			return s->s_off;
+	}
+
+	len = strlen(str) + 1;
+	while (w->w_strlen + len > w->w_strsize) {
+		w->w_strsize <<= 1;
+		w->w_strs = xrealloc(w->w_strs, w->w_strsize);
+	}
+	s = xmalloc(sizeof(*s));
+	s->s_next = w->w_strlist;
+	w->w_strlist = s;
+	s->s_off = w->w_strlen;
+	memcpy(w->w_strs + w->w_strlen, str, len);
+	w->w_strlen += len;
+	hash_insert(&w->w_strtbl, &s->s_node, hash);
+	return s->s_off;
+}
+
+static uint32_t
+etab_bin_put_ids(struct etab_bin_builder *w, const int *ids, int n)
+{
+	uint32_t first = w->w_nids;
+	int i;
+
+	while (w->w_nids + n > w->w_idsize) {
+		w->w_idsize = w->w_idsize ? w->w_idsize << 1 : 64;
+		w->w_ids = xrealloc(w->w_ids, w->w_idsize * sizeof(*w->w_ids));
+	}
+	for (i = 0; i < n; i++)
+		w->w_ids[w->w_nids++] = ids[i];
+	return first;
+}
+
+static int32_t
+etab_bin_put_flav(struct etab_bin_builder *w, const struct flav_info *flav)
+{
+	unsigned int i;
+
+	for (i = 0; i < w->w_nflavors; i++)
+		if (strcmp(w->w_strs + w->w_flavs[i].f_name,
+			   flav->flavour) == 0)
+			return i;
+	if (w->w_nflavors == SECFLAVOR_COUNT)
+		return -1;
+	w->w_flavs[i].f_fnum = flav->fnum;
+	w->w_flavs[i].f_name = etab_bin_put_str(w, flav->flavour);
+	w->w_nflavors++;
+	return i;
+}
+
+static void
+etab_bin_add(struct etab_bin_builder *w, const struct exportent *xp)
+{
+	struct etab_bin_rec *r;
+	int i;
+
+	if (w->w_count == w->w_size) {
+		w->w_size = w->w_size ? w->w_size << 1 : 256;
+		w->w_recs = xrealloc(w->w_recs, w->w_size * sizeof(*r));
+	}
+	r = &w->w_recs[w->w_count++];
+	memset(r, 0, sizeof(*r));
+
+	r->r_hostname = etab_bin_put_str(w, xp->e_hostname);
+	r->r_path = etab_bin_put_str(w, xp->e_path);
+	r->r_mountpoint = etab_bin_put_str(w, xp->e_mountpoint);
+	r->r_fslocdata = etab_bin_put_str(w, xp->e_fslocdata);
+	r->r_uuid = etab_bin_put_str(w, xp->e_uuid);
+	r->r_squids = etab_bin_put_ids(w, xp->e_squids, xp->e_nsquids);
+	r->r_nsquids = xp->e_nsquids;
+	r->r_sqgids = etab_bin_put_ids(w, xp->e_sqgids, xp->e_nsqgids);
+	r->r_nsqgids = xp->e_nsqgids;
+	r->r_flags = xp->e_flags;
+	r->r_anonuid = xp->e_anonuid;
+	r->r_anongid = xp->e_anongid;
+	r->r_fslocmethod = xp->e_fslocmethod;
+	r->r_fsid = xp->e_fsid;
+	r->r_ttl = xp->e_ttl;
+	for (i = 0; i <= SECFLAVOR_COUNT; i++) {
+		const struct sec_entry *p = &xp->e_secinfo[i];
+
+		r->r_secinfo[i].s_flav = p->flav ?
+			etab_bin_put_flav(w, p->flav) : -1;
+		r->r_secinfo[i].s_flags = p->flags;
+		if (r->r_secinfo[i].s_flav < 0)
+			break;
+	}
+}
+
+static int
+etab_bin_write_section(int fd, const void *buf, size_t len, uint64_t *pos)
+{
+	static const char pad[ETAB_BIN_ALIGN];
+	size_t padlen = etab_bin_align(*pos + len) - (*pos + len);
+
+	if (len && write(fd, buf, len) != (ssize_t)len)
+		return -1;
+	if (padlen && write(fd, pad, padlen) != (ssize_t)padlen)
+		return -1;
+	*pos += len + padlen;
+	return 0;
+}
+
+static int
+etab_bin_store(struct etab_bin_builder *w, const char *tmp,
+		const struct stat *stb)
+{
+	struct etab_bin_hdr hdr;
+	uint64_t pos = 0;
+	int fd, err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.h_magic = ETAB_BIN_MAGIC;
+	hdr.h_version = ETAB_BIN_VERSION;
+	hdr.h_hdrsize = sizeof(hdr);
+	hdr.h_recsize = sizeof(struct etab_bin_rec);
+	hdr.h_nsecinfo = SECFLAVOR_COUNT + 1;
+	hdr.h_count = w->w_count;
+	hdr.h_nflavors = w->w_nflavors;
+	hdr.h_nids = w->w_nids;
+	hdr.h_strsize = w->w_strlen;
+	hdr.h_flavors = etab_bin_align(sizeof(hdr));
+	hdr.h_records = hdr.h_flavors +
+		etab_bin_align(w->w_nflavors * sizeof(struct etab_bin_flav));
+	hdr.h_ids = hdr.h_records +
+		etab_bin_align((uint64_t)w->w_count * sizeof(*w->w_recs));
+	hdr.h_strings = hdr.h_ids +
+		etab_bin_align((uint64_t)w->w_nids * sizeof(*w->w_ids));
+	hdr.h_etab_dev = stb->st_dev;
+	hdr.h_etab_ino = stb->st_ino;
+	hdr.h_etab_size = stb->st_size;
+	hdr.h_etab_mtime = stb->st_mtim.tv_sec;
+	hdr.h_etab_mtime_nsec = stb->st_mtim.tv_nsec;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	err = etab_bin_write_section(fd, &hdr, sizeof(hdr), &pos) ||
+	      etab_bin_write_section(fd, w->w_flavs,
+			w->w_nflavors * sizeof(*w->w_flavs), &pos) ||
+	      etab_bin_write_section(fd, w->w_recs,
+			w->w_count * sizeof(*w->w_recs), &pos) ||
+	      etab_bin_write_section(fd, w->w_ids,
+			w->w_nids * sizeof(*w->w_ids), &pos) ||
+	      etab_bin_write_section(fd, w->w_strs, w->w_strlen, &pos);
+	if (close(fd) < 0)
+		err = 1;
+	return err ? -1 : 0;
+}
+
+static void
+etab_bin_builder_free(struct etab_bin_builder *w)
+{
+	struct etab_bin_str *s;
+
+	while ((s = w->w_strlist) != NULL) {
+		w->w_strlist = s->s_next;
+		free(s);
+	}
+	hash_clear(&w->w_strtbl);
+	free(w->w_recs);
+	free(w->w_ids);
+	free(w->w_strs);
+}
+
+/**
+ * etab_bin_compile - write a compiled copy of etab
+ * @etab: name of the etab file
+ * @bin: name of the compiled file to write
+ *
+ * The caller holds the etab lock.  Nothing is written if @bin is
+ * already up to date.  Returns 0 if @bin is up to date on return,
+ * otherwise -1.
+ */
+int
+etab_bin_compile(const char *etab, const char *bin)
+{
+	struct etab_bin_builder w;
+	struct exportent *xp;
+	struct stat stb;
+	char tmp[PATH_MAX];
+	int ret = -1;
+
+	if (stat(etab, &stb) < 0)
+		return -1;
+	if (etab_bin_check(bin, &stb))
+		return 0;
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", bin) >= (int)sizeof(tmp))
+		return -1;
+
+	memset(&w, 0, sizeof(w));
+	w.w_strsize = 4096;
+	w.w_strs = xmalloc(w.w_strsize);
+	w.w_strs[0] = '\0';		/* offset zero is NULL */
+	w.w_strlen = 1;
+
+	setexportent((char *)etab, "r");
+	while ((xp = getexportent(0, 0)) != NULL)
+		etab_bin_add(&w, xp);
+	endexportent();
+
+	if (w.w_strlen > UINT32_MAX)
+		xlog(L_WARNING, "%s is too large to compile", etab);
+	else if (etab_bin_store(&w, tmp, &stb) < 0)
+		xlog(L_WARNING, "can't write %s: %m", tmp);
+	else if (rename(tmp, bin) < 0)
+		xlog(L_WARNING, "can't rename %s to %s: %m", tmp, bin);
+	else
+		ret = 0;
+	if (ret < 0)
+		unlink(tmp);
+
+	etab_bin_builder_free(&w);
+	return ret;
+}
+
+static int
+etab_bin_str_ok(const struct etab_bin_hdr *hdr, uint32_t off)
+{
+	return off < hdr->h_strsize;
+}
+
+/*
+ * Check everything etab_bin_next() will use, so it needn't fail
+ * halfway through a file.
+ */
+static int
+etab_bin_valid(struct etab_bin *b, const struct etab_bin_hdr *hdr)
+{
+	const struct etab_bin_flav *flavs;
+	const struct etab_bin_rec *r;
+	unsigned int i, j;
+	int k;
+
+	if (hdr->h_flavors > b->b_len ||
+	    hdr->h_nflavors > (b->b_len - hdr->h_flavors) / sizeof(*flavs) ||
+	    hdr->h_records > b->b_len ||
+	    hdr->h_count > (b->b_len - hdr->h_records) / sizeof(*r) ||
+	    hdr->h_ids > b->b_len ||
+	    hdr->h_nids > (b->b_len - hdr->h_ids) / sizeof(int32_t) ||
+	    hdr->h_strings > b->b_len ||
+	    hdr->h_strsize > b->b_len - hdr->h_strings ||
+	    hdr->h_strsize == 0 ||
+	    (hdr->h_flavors | hdr->h_records | hdr->h_ids) %
+	    ETAB_BIN_ALIGN != 0)
+		return 0;
+
+	b->b_strs = b->b_map + hdr->h_strings;
+	if (b->b_strs[hdr->h_strsize - 1] != '\0')
+		return 0;
+	b->b_recs = (const struct etab_bin_rec *)(b->b_map + hdr->h_records);
+	b->b_ids = (const int32_t *)(b->b_map + hdr->h_ids);
+	b->b_count = hdr->h_count;
+
+	/* Flavors are stored by name, not by their place in flav_map[];
+	 * "sys" and "unix" share a number, but not a name. */
+	flavs = (const struct etab_bin_flav *)(b->b_map + hdr->h_flavors);
+	b->b_flavs = xmalloc((hdr->h_nflavors + 1) * sizeof(*b->b_flavs));
+	for (i = 0; i < hdr->h_nflavors; i++) {
+		b->b_flavs[i] = NULL;
+		if (!etab_bin_str_ok(hdr, flavs[i].f_name))
+			return 0;
+		for (k = 0; k < flav_map_size; k++)
+			if (flav_map[k].fnum == flavs[i].f_fnum &&
+			    strcmp(flav_map[k].flavour,
+				   b->b_strs + flavs[i].f_name) == 0)
+				b->b_flavs[i] = &flav_map[k];
+		if (b->b_flavs[i] == NULL)
+			return 0;
+	}
+
+	for (i = 0, r = b->b_recs; i < b->b_count; i++, r++) {
+		if (r->r_path == 0 ||
+		    !etab_bin_str_ok(hdr, r->r_hostname) ||
+		    !etab_bin_str_ok(hdr, r->r_path) ||
+		    strlen(b->b_strs + r->r_path) > NFS_MAXPATHLEN ||
+		    !etab_bin_str_ok(hdr, r->r_mountpoint) ||
+		    !etab_bin_str_ok(hdr, r->r_fslocdata) ||
+		    !etab_bin_str_ok(hdr, r->r_uuid) ||
+		    r->r_nsquids < 0 || r->r_nsqgids < 0 ||
+		    r->r_squids > hdr->h_nids ||
+		    (uint32_t)r->r_nsquids > hdr->h_nids - r->r_squids ||
+		    r->r_sqgids > hdr->h_nids ||
+		    (uint32_t)r->r_nsqgids > hdr->h_nids - r->r_sqgids)
+			return 0;
+		for (j = 0; j <= SECFLAVOR_COUNT; j++) {
+			if (r->r_secinfo[j].s_flav < 0)
+				break;
+			if ((uint32_t)r->r_secinfo[j].s_flav >= hdr->h_nflavors)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * etab_bin_open - map the compiled copy of etab
+ * @etab: name of the etab file
+ * @bin: name of the compiled file
+ *
+ * Returns a source for etab_bin_next(), which must be released with
+ * etab_bin_close(), or NULL if @bin is missing, out of date or
+ * damaged and @etab should be read instead.  The caller holds the
+ * etab lock.
+ */
+void *
+etab_bin_open(const char *etab, const char *bin)
+{
+	const struct etab_bin_hdr *hdr;
+	struct stat stb, bstb;
+	struct etab_bin *b;
+	void *map;
+	int fd;
+
+	if (stat(etab, &stb) < 0)
+		return NULL;
+	fd = open(bin, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &bstb) < 0 ||
+	    (size_t)bstb.st_size < sizeof(struct etab_bin_hdr)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, bstb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	b = xmalloc(sizeof(*b));
+	memset(b, 0, sizeof(*b));
+	b->b_map = map;
+	b->b_len = bstb.st_size;
+	hdr = map;
+	if (!etab_bin_hdr_ok(hdr) || !etab_bin_matches(hdr, &stb)) {
+		etab_bin_close(b);
+		return NULL;
+	}
+	if (!etab_bin_valid(b, hdr)) {
+		xlog(L_WARNING, "%s is damaged; reading %s", bin, etab);
+		etab_bin_close(b);
+		return NULL;
+	}
+	return b;
+}
+
+static char *
+etab_bin_str(const struct etab_bin *b, uint32_t off)
+{
+	return off ? (char *)b->b_strs + off : NULL;
+}
+
+/**
+ * etab_bin_next - return the next entry of a compiled etab
+ * @src: source returned by etab_bin_open()
+ *
+ * Returns NULL after the last entry.  The entry points into the
+ * mapped file, and is valid until the next call.
+ */
+struct exportent *
+etab_bin_next(void *src)
+{
+	struct etab_bin *b = src;
+	const struct etab_bin_rec *r;
+	struct exportent *ee = &b->b_ent;
+	int i;
+
+	if (b->b_next == b->b_count)
+		return NULL;
+	r = &b->b_recs[b->b_next++];
+
+	memset(ee, 0, sizeof(*ee));
+	ee->e_hostname = etab_bin_str(b, r->r_hostname);
+	strncpy(ee->e_path, b->b_strs + r->r_path, sizeof(ee->e_path) - 1);
+	ee->e_flags = r->r_flags;
+	ee->e_anonuid = r->r_anonuid;
+	ee->e_anongid = r->r_anongid;
+	ee->e_squids = r->r_nsquids ? (int *)&b->b_ids[r->r_squids] : NULL;
+	ee->e_nsquids = r->r_nsquids;
+	ee->e_sqgids = r->r_nsqgids ? (int *)&b->b_ids[r->r_sqgids] : NULL;
+	ee->e_nsqgids = r->r_nsqgids;
+	ee->e_fsid = r->r_fsid;
+	ee->e_mountpoint = etab_bin_str(b, r->r_mountpoint);
+	ee->e_fslocmethod = r->r_fslocmethod;
+	ee->e_fslocdata = etab_bin_str(b, r->r_fslocdata);
+	ee->e_uuid = etab_bin_str(b, r->r_uuid);
+	ee->e_ttl = r->r_ttl;
+	for (i = 0; i <= SECFLAVOR_COUNT; i++) {
+		if (r->r_secinfo[i].s_flav < 0)
+			break;
+		ee->e_secinfo[i].flav = b->b_flavs[r->r_secinfo[i].s_flav];
+		ee->e_secinfo[i].flags = r->r_secinfo[i].s_flags;
+	}
+	return ee;
+}
+
+/**
+ * etab_bin_close - release a source returned by etab_bin_open()
+ * @src: source to release
+ *
+ */
+void
+etab_bin_close(void *src)
+{
+	struct etab_bin *b = src;
+
+	munmap(b->b_map, b->b_len);
+	free(b->b_flavs);
+	free(b);
+}
@@ -21,8 +21,9 @@
 #include "nfslib.h"
 #include "exportfs.h"
 
-exp_hash_table exportlist[MCL_MAXTYPES] = {{NULL, {{NULL,NULL}, }}, }; 
-static int export_hash(char *);
+exp_hash_table exportlist[MCL_MAXTYPES] = {
+	{NULL, HASH_TABLE_INIT, HASH_TABLE_INIT},
+};
 
 static void	export_init(nfs_export *exp, nfs_client *clp,
 					struct exportent *nep);
@@ -51,6 +52,9 @@ export_free(nfs_export *exp)
 	xfree(exp);
 }
 
+/* Entries export_read() parses ahead of the one it is adding */
+#define EXPORT_READ_AHEAD	256
+
 static void warn_duplicated_exports(nfs_export *exp, struct exportent *eep)
 {
 	if (exp->m_export.e_flags != eep->e_flags) {
@@ -76,13 +80,45 @@ static void warn_duplicated_exports(nfs_export *exp, struct exportent *eep)
 int
 export_read(char *fname)
 {
-	struct exportent	*eep;
+	struct exportent	*eep, *ring;
+	struct xlog_msg		**msgs, *last = NULL;
 	nfs_export		*exp;
+	unsigned int		head = 0, count = 0, slot;
+	int			eof = 0;
 
 	int volumes = 0;
 
+	/* Read ahead, so client_prefetch() can resolve the names of
+	 * later entries while earlier ones are being looked up.  What
+	 * the parser says about an entry is held back until the
+	 * entry's turn, so messages come out in file order. */
+	ring = xmalloc(EXPORT_READ_AHEAD * sizeof(*ring));
+	msgs = xmalloc(EXPORT_READ_AHEAD * sizeof(*msgs));
+	memset(msgs, 0, EXPORT_READ_AHEAD * sizeof(*msgs));
 	setexportent(fname, "r");
-	while ((eep = getexportent(0,1)) != NULL) {
+	for (;;) {
+		while (!eof && count < EXPORT_READ_AHEAD) {
+			slot = (head + count) % EXPORT_READ_AHEAD;
+			xlog_hold(&msgs[slot]);
+			eep = getexportent(0,1);
+			xlog_hold(NULL);
+			if (eep == NULL) {
+				/* Said after every entry before it */
+				last = msgs[slot];
+				msgs[slot] = NULL;
+				eof = 1;
+				break;
+			}
+			count++;
+			dupexportent(&ring[slot], eep);
+			ring[slot].e_hostname = xstrdup(eep->e_hostname);
+			client_prefetch(ring[slot].e_hostname);
+		}
+		if (count == 0)
+			break;
+
+		xlog_release(&msgs[head]);
+		eep = &ring[head];
 		exp = export_lookup(eep->e_hostname, eep->e_path, 0);
 		if (!exp) {
 			if (export_create(eep, 0))
@@ -91,8 +127,14 @@ export_read(char *fname)
 		}
 		else
 			warn_duplicated_exports(exp, eep);
+		exportent_release(eep);
+		head = (head + 1) % EXPORT_READ_AHEAD;
+		count--;
 	}
+	xlog_release(&last);
 	endexportent();
+	free(msgs);
+	free(ring);
 
 	return volumes;
 }
@@ -172,12 +214,27 @@ nfs_export *
 export_create(struct exportent *xep, int canonical)
 {
 	nfs_client	*clp;
-	nfs_export	*exp;
 
 	if (!(clp = client_lookup(xep->e_hostname, canonical))) {
 		/* bad export entry; complaint already logged */
 		return NULL;
 	}
+	return export_create_client(xep, clp);
+}
+
+/**
+ * export_create_client - create an nfs_export record for a known client
+ * @xep: export entry to add
+ * @clp: client the export is for
+ *
+ * Unlike export_create(), @xep's hostname is not looked up.  Returns
+ * a freshly instantiated export record.
+ */
+nfs_export *
+export_create_client(struct exportent *xep, nfs_client *clp)
+{
+	nfs_export	*exp;
+
 	exp = (nfs_export *) xmalloc(sizeof(*exp));
 	export_init(exp, clp, xep);
 	export_add(exp);
@@ -236,32 +293,90 @@ export_dup(nfs_export *exp, const struct addrinfo *ai)
 	return new;
 }
 
+static unsigned int
+export_client_hash(const nfs_client *clp, const char *path)
+{
+	return hash_bytes(&clp, sizeof(clp)) ^ hash_string(path);
+}
+
 static void
 export_add(nfs_export *exp)
 {
-	exp_hash_table *p_tbl;
-	exp_hash_entry *p_hen;
-	nfs_export *p_next;
-
-	int type = exp->m_client->m_type;
-	int pos;
-
-	pos = export_hash(exp->m_export.e_path);
-	p_tbl = &(exportlist[type]); /* pointer to hash table */
-	p_hen = &(p_tbl->entries[pos]); /* pointer to hash table entry */
-
-	if (!(p_hen->p_first)) { /* hash table entry is empty */ 
- 		p_hen->p_first = exp;
- 		p_hen->p_last  = exp;
-
- 		exp->m_next = p_tbl->p_head;
- 		p_tbl->p_head = exp;
-	} else { /* hash table entry is NOT empty */
-		p_next = p_hen->p_last->m_next;
-		p_hen->p_last->m_next = exp;
-		exp->m_next = p_next;
-		p_hen->p_last = exp;
+	exp_hash_table *p_tbl = &exportlist[exp->m_client->m_type];
+	unsigned int hash = hash_string(exp->m_export.e_path);
+	nfs_export *last = NULL, *p;
+	struct hash_node *n;
+
+	/* Keep exports for the same path together: append after the
+	 * last one already indexed, or start a new run at the head.
+	 * Short of a hash collision, the last one is the latest entry
+	 * with the same hash value. */
+	n = hash_lookup_last(&p_tbl->p_index, hash);
+	p = n ? hash_entry(n, nfs_export, m_hnode) : NULL;
+	if (p && strcmp(p->m_export.e_path, exp->m_export.e_path) == 0)
+		last = p;
+	else if (p)
+		for (p = export_first_by_path(exp->m_client->m_type,
+					      exp->m_export.e_path);
+		     p; p = export_next_by_path(p))
+			last = p;
+
+	if (last)
+		exp->m_pprev = &last->m_next;
+	else
+		exp->m_pprev = &p_tbl->p_head;
+	exp->m_next = *exp->m_pprev;
+	if (exp->m_next)
+		exp->m_next->m_pprev = &exp->m_next;
+	*exp->m_pprev = exp;
+	hash_insert(&p_tbl->p_index, &exp->m_hnode, hash);
+	hash_insert(&p_tbl->p_clients, &exp->m_cnode,
+		    export_client_hash(exp->m_client, exp->m_export.e_path));
+}
+
+/**
+ * export_first_by_path - find the first export of a path
+ * @type: client type (MCL_FQDN etc.) whose exports are searched
+ * @path: '\0'-terminated ASCII string containing export path
+ *
+ * Returns the earliest added nfs_export of client type @type whose
+ * e_path is exactly @path, or NULL.  Use export_next_by_path() to
+ * visit the others, in the order they appear on the export list.
+ */
+nfs_export *
+export_first_by_path(int type, const char *path)
+{
+	unsigned int hash = hash_string(path);
+	struct hash_node *n;
+
+	for (n = hash_lookup(&exportlist[type].p_index, hash); n;
+	     n = hash_lookup_next(n)) {
+		nfs_export *exp = hash_entry(n, nfs_export, m_hnode);
+
+		if (strcmp(exp->m_export.e_path, path) == 0)
+			return exp;
 	}
+	return NULL;
+}
+
+/**
+ * export_next_by_path - find the next export with the same path
+ * @exp: export returned by export_{first,next}_by_path()
+ *
+ */
+nfs_export *
+export_next_by_path(const nfs_export *exp)
+{
+	const char *path = exp->m_export.e_path;
+	struct hash_node *n;
+
+	for (n = hash_lookup_next(&exp->m_hnode); n; n = hash_lookup_next(n)) {
+		nfs_export *next = hash_entry(n, nfs_export, m_hnode);
+
+		if (strcmp(next->m_export.e_path, path) == 0)
+			return next;
+	}
+	return NULL;
 }
 
 /**
@@ -279,7 +394,8 @@ export_find(const struct addrinfo *ai, const char *path)
 	int		i;
 
 	for (i = 0; i < MCL_MAXTYPES; i++) {
-		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
+		for (exp = export_first_by_path(i, path); exp;
+		     exp = export_next_by_path(exp)) {
 			if (!export_check(exp, ai, path))
 				continue;
 			if (exp->m_client->m_type == MCL_FQDN)
@@ -298,7 +414,8 @@ export_allowed_internal(const struct addrinfo *ai, const char *path)
 	int		i;
 
 	for (i = 0; i < MCL_MAXTYPES; i++) {
-		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
+		for (exp = export_first_by_path(i, path); exp;
+		     exp = export_next_by_path(exp)) {
 			if (!exp->m_mayexport ||
 			    !export_check(exp, ai, path))
 				continue;
@@ -351,28 +468,28 @@ export_allowed(const struct addrinfo *ai, const char *path)
  * @canonical: if set, @hname is known to be canonical DNS name
  *
  * Returns a pointer to nfs_export record matching @hname and @path,
- * or NULL if the export was not found.
+ * or NULL if the export was not found.  Readers of exports and etab
+ * call this for every entry, so it must not depend on how many
+ * exports a path has.
  */
 nfs_export *
 export_lookup(char *hname, char *path, int canonical)
 {
 	nfs_client *clp;
 	nfs_export *exp;
-	exp_hash_entry *p_hen;
-
-	int pos;
+	struct hash_node *n;
 
 	clp = client_lookup(hname, canonical);
 	if(clp == NULL)
 		return NULL;
 
-	pos = export_hash(path);
-	p_hen = &(exportlist[clp->m_type].entries[pos]); 
-	for(exp = p_hen->p_first; exp && (exp != p_hen->p_last->m_next); 
-  			exp = exp->m_next) {
-		if (exp->m_client == clp && !strcmp(exp->m_export.e_path, path)) {
-  			return exp;
-		}
+	for (n = hash_lookup(&exportlist[clp->m_type].p_clients,
+			     export_client_hash(clp, path)); n;
+	     n = hash_lookup_next(n)) {
+		exp = hash_entry(n, nfs_export, m_cnode);
+		if (exp->m_client == clp &&
+		    strcmp(exp->m_export.e_path, path) == 0)
+			return exp;
 	}
 	return NULL;
 }
@@ -386,6 +503,73 @@ export_check(const nfs_export *exp, const struct addrinfo *ai, const char *path)
 	return client_check(exp->m_client, ai);
 }
 
+static void
+export_unlink(nfs_export *exp)
+{
+	exp_hash_table *p_tbl = &exportlist[exp->m_client->m_type];
+
+	*exp->m_pprev = exp->m_next;
+	if (exp->m_next)
+		exp->m_next->m_pprev = exp->m_pprev;
+	hash_remove(&p_tbl->p_index, &exp->m_hnode);
+	hash_remove(&p_tbl->p_clients, &exp->m_cnode);
+	exp->m_next = NULL;
+	exp->m_pprev = NULL;
+}
+
+/**
+ * export_remove - remove one nfs_export record and deallocate it
+ * @exp: export to remove
+ *
+ * The client stays on the client list even if this was its last
+ * export; client_prune() disposes of unused clients.
+ */
+void
+export_remove(nfs_export *exp)
+{
+	export_unlink(exp);
+	client_release(exp->m_client);
+	export_free(exp);
+}
+
+/**
+ * export_update - replace the options of an nfs_export record
+ * @exp: export to update
+ * @xep: export entry with the new options
+ *
+ * @xep must name the same client and path as @exp.
+ */
+void
+export_update(nfs_export *exp, struct exportent *xep)
+{
+	struct exportent	*e = &exp->m_export;
+
+	exportent_release(e);
+	dupexportent(e, xep);
+	if (xep->e_hostname)
+		e->e_hostname = xstrdup(xep->e_hostname);
+	exp->m_changed = 1;
+	exp->m_warned = 0;
+}
+
+/**
+ * export_reorder - put the exports of one path back in order
+ * @exps: every export of the same client type and path, in the
+ *	order they should be found
+ * @count: number of elements in @exps
+ *
+ */
+void
+export_reorder(nfs_export **exps, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		export_unlink(exps[i]);
+	for (i = 0; i < count; i++)
+		export_add(exps[i]);
+}
+
 /**
  * export_freeall - deallocate all nfs_export records
  *
@@ -394,7 +578,7 @@ void
 export_freeall(void)
 {
 	nfs_export	*exp, *nxt;
-	int		i, j;
+	int		i;
 
 	for (i = 0; i < MCL_MAXTYPES; i++) {
 		for (exp = exportlist[i].p_head; exp; exp = nxt) {
@@ -402,40 +586,9 @@ export_freeall(void)
 			client_release(exp->m_client);
 			export_free(exp);
 		}
-		for (j = 0; j < HASH_TABLE_SIZE; j++) {
-			exportlist[i].entries[j].p_first = NULL;
-			exportlist[i].entries[j].p_last = NULL;
-		}
+		hash_clear(&exportlist[i].p_index);
+		hash_clear(&exportlist[i].p_clients);
 		exportlist[i].p_head = NULL;
 	}
 	client_freeall();
 }
-
-/*
- * Compute and returns integer from string. 
- * Note: Its understood the smae integers can be same for 
- *       different strings, but it should not matter.
- */
-static unsigned int 
-strtoint(char *str)
-{
-	int i = 0;
-	unsigned int n = 0;
-
-	while ( str[i] != '\0') {
-		n+=((int)str[i])*i;
-		i++;
-	}
-	return n;
-}
-
-/*
- * Hash function
- */
-static int 
-export_hash(char *str)
-{
-	unsigned int num = strtoint(str);
-
-	return num % HASH_TABLE_SIZE;
-}
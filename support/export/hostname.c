@@ -26,9 +26,13 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "sockaddr.h"
 #include "exportfs.h"
+#include "latency.h"
 
 /**
  * host_ntop - generate presentation address given a sockaddr
@@ -172,9 +176,12 @@ host_addrinfo(const char *hostname)
 		.ai_protocol	= (int)IPPROTO_UDP,
 		.ai_flags	= AI_CANONNAME,
 	};
+	uint64_t start;
 	int error;
 
+	start = latency_start();
 	error = getaddrinfo(hostname, NULL, &hint, &ai);
+	latency_record(LAT_DNS_FORWARD, start);
 	switch (error) {
 	case 0:
 		return ai;
@@ -209,6 +216,7 @@ host_canonname(const struct sockaddr *sap)
 {
 	socklen_t salen = nfs_sockaddr_length(sap);
 	char buf[NI_MAXHOST];
+	uint64_t start;
 	int error;
 
 	if (salen == 0) {
@@ -218,8 +226,10 @@ host_canonname(const struct sockaddr *sap)
 	}
 
 	memset(buf, 0, sizeof(buf));
+	start = latency_start();
 	error = getnameinfo(sap, salen, buf, (socklen_t)sizeof(buf),
 							NULL, 0, NI_NAMEREQD);
+	latency_record(LAT_DNS_REVERSE, start);
 	switch (error) {
 	case 0:
 		break;
@@ -245,11 +255,14 @@ host_canonname(const struct sockaddr *sap)
 	const struct sockaddr_in *sin = (const struct sockaddr_in *)(char *)sap;
 	const struct in_addr *addr = &sin->sin_addr;
 	struct hostent *hp;
+	uint64_t start;
 
 	if (sap->sa_family != AF_INET)
 		return NULL;
 
+	start = latency_start();
 	hp = gethostbyaddr(addr, (socklen_t)sizeof(addr), AF_INET);
+	latency_record(LAT_DNS_REVERSE, start);
 	if (hp == NULL)
 		return NULL;
 
@@ -257,22 +270,13 @@ host_canonname(const struct sockaddr *sap)
 }
 #endif	/* !HAVE_GETNAMEINFO */
 
-/**
- * host_reliable_addrinfo - return addrinfo for a given address
- * @sap: pointer to socket address to look up
- *
- * Reverse and forward lookups are performed to ensure the address has
- * matching forward and reverse mappings.
- *
- * Returns addrinfo structure with just the provided address with
- * ai_canonname filled in. If there is a problem with resolution or
- * the resolved records don't match up properly then it returns NULL
- *
- * Caller must free the returned structure with freeaddrinfo(3).
+/*
+ * Find the canonical hostname for @sap, and make sure it maps back to
+ * @sap.  Returns NULL if there is no such hostname; otherwise the
+ * caller must free the string.
  */
-__attribute__((__malloc__))
-struct addrinfo *
-host_reliable_addrinfo(const struct sockaddr *sap)
+static char *
+host_verified_name(const struct sockaddr *sap)
 {
 	struct addrinfo *ai, *a;
 	char *hostname;
@@ -294,21 +298,375 @@ host_reliable_addrinfo(const struct sockaddr *sap)
 	if (!a)
 		goto out_free_hostname;
 
+	return hostname;
+
+out_free_hostname:
+	free(hostname);
+	return NULL;
+}
+
+/*
+ * Build the result of host_reliable_addrinfo() from a verified
+ * hostname.  Consumes @hostname.
+ */
+static struct addrinfo *
+host_named_addrinfo(const struct sockaddr *sap, char *hostname)
+{
+	struct addrinfo *ai;
+
+	if (hostname == NULL)
+		return NULL;
+
 	/* get addrinfo with just the original address */
 	ai = host_numeric_addrinfo(sap);
-	if (!ai)
-		goto out_free_hostname;
+	if (!ai) {
+		free(hostname);
+		return NULL;
+	}
 
 	/* and populate its ai_canonname field */
 	free(ai->ai_canonname);
 	ai->ai_canonname = hostname;
 	return ai;
+}
 
-out_free_hostname:
+/*
+ * Reverse lookup cache
+ *
+ * Verified hostnames are remembered for HOST_CACHE_TTL seconds, and
+ * addresses without one for HOST_CACHE_NEG_TTL seconds, so the same
+ * client is not looked up again on every upcall and after every
+ * export table reload.  An address being looked up has a pending
+ * entry: callers asking for it meanwhile wait for that lookup
+ * instead of starting their own.
+ */
+#define HOST_CACHE_TTL		(10 * 60)
+#define HOST_CACHE_NEG_TTL	60
+#define HOST_CACHE_MAX		4096
+
+struct host_waiter {
+	struct host_waiter *	w_next;
+	host_addrinfo_cb	w_cb;
+	void *			w_data;
+};
+
+struct host_cache_ent {
+	struct hash_node	hc_node;
+	struct sockaddr_storage	hc_addr;
+	char *			hc_name;	/* NULL: no reliable name */
+	time_t			hc_expires;
+	int			hc_pending;
+	struct host_waiter *	hc_waiters;
+	struct host_cache_ent *	hc_qnext;	/* resolver queue */
+};
+
+static struct hash_table	host_cache = HASH_TABLE_INIT;
+static pthread_mutex_t		host_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		host_cache_cond = PTHREAD_COND_INITIALIZER;
+
+static struct host_cache_ent *	host_queue;
+static struct host_cache_ent **	host_queue_tail = &host_queue;
+static pthread_cond_t		host_queue_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int		host_nresolvers;
+
+static unsigned int
+host_cache_hash(const struct sockaddr *sap)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)sap;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sap;
+
+	switch (sap->sa_family) {
+	case AF_INET:
+		return hash_bytes(&sin->sin_addr, sizeof(sin->sin_addr));
+	case AF_INET6:
+		return hash_bytes(&sin6->sin6_addr, sizeof(sin6->sin6_addr));
+	}
+	return 0;
+}
+
+static struct host_cache_ent *
+host_cache_find(const struct sockaddr *sap)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&host_cache, host_cache_hash(sap)); n;
+	     n = hash_lookup_next(n)) {
+		struct host_cache_ent *ent =
+			hash_entry(n, struct host_cache_ent, hc_node);
+
+		if (nfs_compare_sockaddr((struct sockaddr *)&ent->hc_addr, sap))
+			return ent;
+	}
+	return NULL;
+}
+
+/*
+ * Drop entries that have expired.  Pending entries are never expired,
+ * so nobody waiting for a lookup loses the entry underneath them.
+ */
+static void
+host_cache_prune(time_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < host_cache.h_size; i++) {
+		struct hash_node *n = host_cache.h_buckets[i], *next;
+
+		for (; n; n = next) {
+			struct host_cache_ent *ent =
+				hash_entry(n, struct host_cache_ent, hc_node);
+
+			next = n->h_next;
+			if (ent->hc_pending || ent->hc_expires > now)
+				continue;
+			hash_remove(&host_cache, n);
+			free(ent->hc_name);
+			free(ent);
+		}
+	}
+}
+
+/*
+ * Find or create the entry for @sap, and mark it pending if the
+ * caller has to look it up.  Returns NULL if @sap can't be cached.
+ */
+static struct host_cache_ent *
+host_cache_get(const struct sockaddr *sap, time_t now)
+{
+	socklen_t salen = nfs_sockaddr_length(sap);
+	struct host_cache_ent *ent;
+
+	ent = host_cache_find(sap);
+	if (ent != NULL) {
+		if (!ent->hc_pending && ent->hc_expires <= now)
+			ent->hc_pending = 1;
+		return ent;
+	}
+
+	if (salen == 0)
+		return NULL;
+	if (host_cache.h_count >= HOST_CACHE_MAX)
+		host_cache_prune(now);
+
+	ent = calloc(1, sizeof(*ent));
+	if (ent == NULL)
+		return NULL;
+	memcpy(&ent->hc_addr, sap, salen);
+	ent->hc_pending = 1;
+	hash_insert(&host_cache, &ent->hc_node, host_cache_hash(sap));
+	return ent;
+}
+
+/*
+ * Record the result of looking up @ent, then hand it to everyone who
+ * was waiting for it.  Consumes @hostname.
+ */
+static void
+host_cache_complete(struct host_cache_ent *ent, char *hostname)
+{
+	struct sockaddr_storage addr;
+	struct host_waiter *w, *next;
+
+	pthread_mutex_lock(&host_cache_lock);
+	free(ent->hc_name);
+	ent->hc_name = NULL;
+	if (hostname != NULL)
+		ent->hc_name = strdup(hostname);
+	ent->hc_expires = time(NULL) +
+		(ent->hc_name ? HOST_CACHE_TTL : HOST_CACHE_NEG_TTL);
+	ent->hc_pending = 0;
+	w = ent->hc_waiters;
+	ent->hc_waiters = NULL;
+	memcpy(&addr, &ent->hc_addr, sizeof(addr));
+	pthread_cond_broadcast(&host_cache_cond);
+	pthread_mutex_unlock(&host_cache_lock);
+
+	for (; w; w = next) {
+		char *name = NULL;
+
+		next = w->w_next;
+		if (hostname != NULL)
+			name = strdup(hostname);
+		w->w_cb(host_named_addrinfo((struct sockaddr *)&addr, name),
+				w->w_data);
+		free(w);
+	}
 	free(hostname);
+}
+
+/**
+ * host_reliable_addrinfo - return addrinfo for a given address
+ * @sap: pointer to socket address to look up
+ *
+ * Reverse and forward lookups are performed to ensure the address has
+ * matching forward and reverse mappings.  Results are cached.
+ *
+ * Returns addrinfo structure with just the provided address with
+ * ai_canonname filled in. If there is a problem with resolution or
+ * the resolved records don't match up properly then it returns NULL
+ *
+ * If the address is already being looked up, this waits for that
+ * lookup, which may be a resolver thread's.  Callers must not hold
+ * anything that host_reliable_addrinfo_async() callbacks need.
+ *
+ * Caller must free the returned structure with freeaddrinfo(3).
+ */
+__attribute__((__malloc__))
+struct addrinfo *
+host_reliable_addrinfo(const struct sockaddr *sap)
+{
+	struct host_cache_ent *ent;
+	char *hostname = NULL;
+	time_t now;
+
+	pthread_mutex_lock(&host_cache_lock);
+	while ((ent = host_cache_find(sap)) != NULL && ent->hc_pending)
+		pthread_cond_wait(&host_cache_cond, &host_cache_lock);
+
+	now = time(NULL);
+	ent = host_cache_get(sap, now);
+	if (ent != NULL && !ent->hc_pending) {
+		if (ent->hc_name != NULL)
+			hostname = strdup(ent->hc_name);
+		pthread_mutex_unlock(&host_cache_lock);
+		return host_named_addrinfo(sap, hostname);
+	}
+	pthread_mutex_unlock(&host_cache_lock);
+
+	hostname = host_verified_name(sap);
+	if (ent != NULL) {
+		char *name = hostname ? strdup(hostname) : NULL;
+
+		host_cache_complete(ent, name);
+	}
+	return host_named_addrinfo(sap, hostname);
+}
+
+static void *
+host_resolver(void *UNUSED(arg))
+{
+	struct host_cache_ent *ent;
+	struct sockaddr_storage addr;
+
+	for (;;) {
+		pthread_mutex_lock(&host_cache_lock);
+		while (host_queue == NULL)
+			pthread_cond_wait(&host_queue_cond, &host_cache_lock);
+		ent = host_queue;
+		host_queue = ent->hc_qnext;
+		if (host_queue == NULL)
+			host_queue_tail = &host_queue;
+		memcpy(&addr, &ent->hc_addr, sizeof(addr));
+		pthread_mutex_unlock(&host_cache_lock);
+
+		host_cache_complete(ent,
+			host_verified_name((struct sockaddr *)&addr));
+	}
 	return NULL;
 }
 
+/**
+ * host_resolver_start - look up addresses for host_reliable_addrinfo_async()
+ * @nthreads: number of resolver threads to start
+ *
+ * Returns the number of threads started.  Must be called after any
+ * fork().
+ */
+unsigned int
+host_resolver_start(unsigned int nthreads)
+{
+	sigset_t set, oldset;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	/* Signals are for the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (; nthreads; nthreads--) {
+		int err = pthread_create(&thread, &attr, host_resolver, NULL);
+
+		if (err != 0) {
+			xlog(L_ERROR, "%s: can't start resolver thread: %s",
+				__func__, strerror(err));
+			break;
+		}
+		pthread_mutex_lock(&host_cache_lock);
+		host_nresolvers++;
+		pthread_mutex_unlock(&host_cache_lock);
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	return host_nresolvers;
+}
+
+/**
+ * host_reliable_addrinfo_async - host_reliable_addrinfo() without waiting
+ * @sap: pointer to socket address to look up
+ * @cb: function to call with the result
+ * @data: passed to @cb
+ *
+ * @cb receives what host_reliable_addrinfo() would have returned, and
+ * must free it.  Cached results are passed to @cb before this function
+ * returns; otherwise @cb is called from a resolver thread once the
+ * lookup is done.  Concurrent requests for the same address share one
+ * lookup.  Without resolver threads, the lookup is done in place.
+ */
+void
+host_reliable_addrinfo_async(const struct sockaddr *sap,
+		host_addrinfo_cb cb, void *data)
+{
+	struct host_cache_ent *ent;
+	struct host_waiter *w;
+	char *hostname = NULL;
+	int queue;
+
+	pthread_mutex_lock(&host_cache_lock);
+	if (host_nresolvers == 0)
+		goto out_sync;
+
+	ent = host_cache_find(sap);
+	queue = ent == NULL || !ent->hc_pending;
+	ent = host_cache_get(sap, time(NULL));
+	if (ent == NULL)
+		goto out_sync;
+
+	if (!ent->hc_pending) {
+		if (ent->hc_name != NULL)
+			hostname = strdup(ent->hc_name);
+		pthread_mutex_unlock(&host_cache_lock);
+		cb(host_named_addrinfo(sap, hostname), data);
+		return;
+	}
+
+	w = malloc(sizeof(*w));
+	if (w == NULL) {
+		if (queue)
+			ent->hc_pending = 0;
+		goto out_sync;
+	}
+	w->w_cb = cb;
+	w->w_data = data;
+	w->w_next = ent->hc_waiters;
+	ent->hc_waiters = w;
+
+	if (queue) {
+		ent->hc_qnext = NULL;
+		*host_queue_tail = ent;
+		host_queue_tail = &ent->hc_qnext;
+		pthread_cond_signal(&host_queue_cond);
+	}
+	pthread_mutex_unlock(&host_cache_lock);
+	return;
+
+out_sync:
+	pthread_mutex_unlock(&host_cache_lock);
+	cb(host_reliable_addrinfo(sap), data);
+}
+
 /**
  * host_numeric_addrinfo - return addrinfo without doing DNS queries
  * @sap: pointer to socket address
@@ -17,6 +17,8 @@
 
 #include "nfslib.h"
 #include "exportfs.h"
+#include "hashtable.h"
+#include "xmalloc.h"
 #include "xio.h"
 #include "xlog.h"
 #include "v4root.h"
@@ -24,6 +26,31 @@
 int v4root_needed;
 static void cond_rename(char *newfile, char *oldfile);
 
+static void
+xtab_read_ent(struct exportent *xp, int is_export)
+{
+	nfs_export		*exp;
+
+	if (!(exp = export_lookup(xp->e_hostname, xp->e_path, is_export != 1)) &&
+	    !(exp = export_create(xp, is_export!=1))) {
+		return;
+	}
+	switch (is_export) {
+	case 0:
+		exp->m_exported = 1;
+		break;
+	case 1:
+		exp->m_xtabent = 1;
+		exp->m_mayexport = 1;
+		if ((xp->e_flags & NFSEXP_FSID) && xp->e_fsid == 0)
+			v4root_needed = 0;
+		break;
+	case 2:
+		exp->m_exported = -1;/* may be exported */
+		break;
+	}
+}
+
 static int
 xtab_read(char *xtab, char *lockfn, int is_export)
 {
@@ -32,35 +59,25 @@ xtab_read(char *xtab, char *lockfn, int is_export)
      * is_export == 2  => reading /var/lib/nfs/xtab - these things might be known to kernel
      */
 	struct exportent	*xp;
-	nfs_export		*exp;
+	void			*bin = NULL;
 	int			lockid;
 
 	if ((lockid = xflock(lockfn, "r")) < 0)
 		return 0;
-	setexportent(xtab, "r");
-	if (is_export == 1)
+	if (is_export == 1) {
 		v4root_needed = 1;
-	while ((xp = getexportent(is_export==0, 0)) != NULL) {
-		if (!(exp = export_lookup(xp->e_hostname, xp->e_path, is_export != 1)) &&
-		    !(exp = export_create(xp, is_export!=1))) {
-			continue;
-		}
-		switch (is_export) {
-		case 0:
-			exp->m_exported = 1;
-			break;
-		case 1:
-			exp->m_xtabent = 1;
-			exp->m_mayexport = 1;
-			if ((xp->e_flags & NFSEXP_FSID) && xp->e_fsid == 0)
-				v4root_needed = 0;
-			break;
-		case 2:
-			exp->m_exported = -1;/* may be exported */
-			break;
-		}
+		bin = etab_bin_open(xtab, _PATH_ETABBIN);
+	}
+	if (bin != NULL) {
+		while ((xp = etab_bin_next(bin)) != NULL)
+			xtab_read_ent(xp, is_export);
+		etab_bin_close(bin);
+	} else {
+		setexportent(xtab, "r");
+		while ((xp = getexportent(is_export==0, 0)) != NULL)
+			xtab_read_ent(xp, is_export);
+		endexportent();
 	}
-	endexportent();
 	xfunlock(lockid);
 
 	return 0;
@@ -88,6 +105,297 @@ xtab_export_read(void)
 	return xtab_read(_PATH_ETAB, _PATH_ETABLCK, 1);
 }
 
+/**
+ * xtab_export_read_entries - load etab entries that were read elsewhere
+ * @next: returns each entry in etab order, then NULL
+ * @src: passed to @next
+ *
+ * As xtab_export_read(), but etab itself is not opened.
+ */
+int
+xtab_export_read_entries(exportent_iter next, void *src)
+{
+	struct exportent	*xp;
+
+	v4root_needed = 1;
+	while ((xp = next(src)) != NULL)
+		xtab_read_ent(xp, 1);
+	return 0;
+}
+
+/*
+ * One etab line, as seen by xtab_export_reload().  r_node indexes it
+ * by the export it ended up in, which doubles as the "still in etab"
+ * mark for that export.
+ */
+struct xtab_reload_ent {
+	struct hash_node	r_node;
+	struct exportent	r_ent;
+	nfs_export *		r_exp;
+	unsigned int		r_pos;
+	int			r_checked;
+};
+
+struct xtab_run_ent {
+	nfs_export *		u_exp;
+	unsigned int		u_pos;
+	unsigned int		u_idx;
+};
+
+static unsigned int
+xtab_exp_hash(const nfs_export *exp)
+{
+	return hash_bytes(&exp, sizeof(exp));
+}
+
+static struct xtab_reload_ent *
+xtab_reload_find(const struct hash_table *seen, const nfs_export *exp)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(seen, xtab_exp_hash(exp)); n;
+	     n = hash_lookup_next(n)) {
+		struct xtab_reload_ent *r;
+
+		r = hash_entry(n, struct xtab_reload_ent, r_node);
+		if (r->r_exp == exp)
+			return r;
+	}
+	return NULL;
+}
+
+static int
+xtab_run_cmp(const void *a, const void *b)
+{
+	const struct xtab_run_ent *u = a, *v = b;
+
+	if (u->u_pos != v->u_pos)
+		return u->u_pos < v->u_pos ? -1 : 1;
+	return u->u_idx < v->u_idx ? -1 : u->u_idx > v->u_idx;
+}
+
+/*
+ * Exports of one path are searched in order, and the first one that
+ * matches a client wins.  New entries are appended to their path's
+ * run, and etab may list old ones in a new order, so put each run
+ * back into etab order.  Exports that are not in etab (pseudo roots)
+ * go after the others.
+ */
+static unsigned int
+xtab_reload_sort(struct xtab_reload_ent *ents, unsigned int count,
+		 const struct hash_table *seen)
+{
+	struct xtab_run_ent *run = NULL;
+	nfs_export **exps = NULL;
+	unsigned int size = 0, sorted = 0, i;
+
+	for (i = 0; i < count; i++) {
+		nfs_export *exp = ents[i].r_exp, *p;
+		unsigned int n = 0, j, last = 0;
+		int inorder = 1;
+
+		if (exp == NULL || ents[i].r_checked)
+			continue;
+
+		for (p = export_first_by_path(exp->m_client->m_type,
+					      exp->m_export.e_path);
+		     p; p = export_next_by_path(p)) {
+			struct xtab_reload_ent *r = xtab_reload_find(seen, p);
+
+			if (n == size) {
+				size = size ? size << 1 : 16;
+				run = xrealloc(run, size * sizeof(*run));
+			}
+			run[n].u_exp = p;
+			run[n].u_idx = n;
+			run[n].u_pos = r ? r->r_pos : count;
+			if (r)
+				r->r_checked = 1;
+			if (run[n].u_pos < last)
+				inorder = 0;
+			last = run[n].u_pos;
+			n++;
+		}
+		if (inorder)
+			continue;
+
+		qsort(run, n, sizeof(*run), xtab_run_cmp);
+		exps = xrealloc(exps, size * sizeof(*exps));
+		for (j = 0; j < n; j++)
+			exps[j] = run[j].u_exp;
+		export_reorder(exps, n);
+		sorted++;
+	}
+	free(exps);
+	free(run);
+	return sorted;
+}
+
+static unsigned int
+xtab_reload_collect(exportent_iter next, void *src,
+		    struct xtab_reload_ent **entsp)
+{
+	struct xtab_reload_ent	*ents = NULL;
+	unsigned int		count = 0, size = 0;
+	struct exportent	*xp;
+	int			needed = 1;
+
+	while ((xp = next(src)) != NULL) {
+		struct xtab_reload_ent *r;
+
+		if (count == size) {
+			size = size ? size << 1 : 64;
+			ents = xrealloc(ents, size * sizeof(*ents));
+		}
+		r = &ents[count];
+		dupexportent(&r->r_ent, xp);
+		r->r_ent.e_hostname = xstrdup(xp->e_hostname);
+		r->r_exp = NULL;
+		r->r_pos = count++;
+		r->r_checked = 0;
+		if ((xp->e_flags & NFSEXP_FSID) && xp->e_fsid == 0)
+			needed = 0;
+	}
+	v4root_needed = needed;
+	*entsp = ents;
+	return count;
+}
+
+static struct exportent *
+xtab_etab_next(void *UNUSED(src))
+{
+	return getexportent(0, 0);
+}
+
+static int
+xtab_reload_merge(struct xtab_reload_ent *ents, unsigned int count,
+		  export_change_cb notify, void *data)
+{
+	struct hash_table	seen = HASH_TABLE_INIT;
+	unsigned int		added = 0, changed = 0, removed = 0, sorted, i;
+	nfs_export		*exp, *next;
+
+	for (i = 0; i < count; i++) {
+		struct xtab_reload_ent *r = &ents[i];
+
+		exp = export_lookup(r->r_ent.e_hostname, r->r_ent.e_path, 1);
+		if (exp && xtab_reload_find(&seen, exp))
+			/* duplicate entry: the first one wins */
+			continue;
+		if (exp && (exp->m_export.e_flags & NFSEXP_V4ROOT)) {
+			notify(exp, 0, data);
+			export_remove(exp);
+			removed++;
+			exp = NULL;
+		}
+		if (exp == NULL) {
+			exp = export_create(&r->r_ent, 1);
+			if (exp == NULL)
+				continue;
+			exp->m_xtabent = 1;
+			exp->m_mayexport = 1;
+			notify(exp, 1, data);
+			added++;
+		} else if (!exportent_equal(&exp->m_export, &r->r_ent)) {
+			notify(exp, 0, data);
+			export_update(exp, &r->r_ent);
+			exp->m_xtabent = 1;
+			exp->m_mayexport = 1;
+			notify(exp, 1, data);
+			changed++;
+		}
+		r->r_exp = exp;
+		hash_insert(&seen, &r->r_node, xtab_exp_hash(exp));
+	}
+
+	for (i = 0; i < MCL_MAXTYPES; i++) {
+		for (exp = exportlist[i].p_head; exp; exp = next) {
+			next = exp->m_next;
+			if (exp->m_export.e_flags & NFSEXP_V4ROOT)
+				continue;
+			if (xtab_reload_find(&seen, exp))
+				continue;
+			notify(exp, 0, data);
+			export_remove(exp);
+			removed++;
+		}
+	}
+
+	sorted = xtab_reload_sort(ents, count, &seen);
+
+	hash_clear(&seen);
+	for (i = 0; i < count; i++)
+		exportent_release(&ents[i].r_ent);
+	free(ents);
+
+	xlog(D_GENERAL, "etab reload: %u entries, %u added, %u changed, "
+		"%u removed, %u reordered", count, added, changed, removed,
+		sorted);
+	return added + changed + removed + sorted;
+}
+
+/**
+ * xtab_export_reload - bring the export table up to date with etab
+ * @notify: called for each export that is added, changed or removed
+ * @data: passed to @notify
+ *
+ * Unlike export_freeall() followed by xtab_export_read(), exports
+ * whose etab entry is unchanged are left alone.  An export whose
+ * options changed is updated in place.  @notify is called with
+ * @added clear before an export is changed or removed, and with
+ * @added set after an export is added or changed.  Pseudo root
+ * exports are left alone, unless etab now has a real export of the
+ * same path for the same client, in which case they are removed.
+ * Any other export not in etab is removed.  Clients are kept even if
+ * they lose their last export; see client_prune().
+ *
+ * Returns the number of exports added, changed or removed, or -1 if
+ * etab could not be read.
+ */
+int
+xtab_export_reload(export_change_cb notify, void *data)
+{
+	struct xtab_reload_ent	*ents;
+	unsigned int		count;
+	void			*bin;
+	int			lockid;
+
+	if ((lockid = xflock(_PATH_ETABLCK, "r")) < 0)
+		return -1;
+	bin = etab_bin_open(_PATH_ETAB, _PATH_ETABBIN);
+	if (bin != NULL) {
+		count = xtab_reload_collect(etab_bin_next, bin, &ents);
+		etab_bin_close(bin);
+	} else {
+		setexportent(_PATH_ETAB, "r");
+		count = xtab_reload_collect(xtab_etab_next, NULL, &ents);
+		endexportent();
+	}
+	xfunlock(lockid);
+
+	return xtab_reload_merge(ents, count, notify, data);
+}
+
+/**
+ * xtab_export_reload_entries - merge etab entries that were read elsewhere
+ * @next: returns each entry in etab order, then NULL
+ * @src: passed to @next
+ * @notify: called for each export that is added, changed or removed
+ * @data: passed to @notify
+ *
+ * As xtab_export_reload(), but etab itself is not opened.
+ */
+int
+xtab_export_reload_entries(exportent_iter next, void *src,
+			   export_change_cb notify, void *data)
+{
+	struct xtab_reload_ent	*ents;
+	unsigned int		count;
+
+	count = xtab_reload_collect(next, src, &ents);
+	return xtab_reload_merge(ents, count, notify, data);
+}
+
 /*
  * mountd now keeps an open fd for the etab at all times to make sure that the
  * inode number changes when the xtab_export_write is done. If you change the
@@ -124,6 +432,10 @@ xtab_write(char *xtab, char *xtabtmp, char *lockfn, int is_export)
 
 	cond_rename(xtabtmp, xtab);
 
+	/* So readers of etab needn't parse it */
+	if (is_export)
+		etab_bin_compile(xtab, _PATH_ETABBIN);
+
 	xfunlock(lockid);
 
 	return 1;
@@ -14,6 +14,7 @@
 
 #include "sockaddr.h"
 #include "nfslib.h"
+#include "hashtable.h"
 
 enum {
 	MCL_FQDN = 0,
@@ -37,8 +38,13 @@ enum {
 #define EXP_LOCKFILE "/var/lib/nfs/export-lock"
 #endif
 
+struct client_addr;
+
 typedef struct mclient {
 	struct mclient *	m_next;
+	struct hash_node	m_hnode;	/* name index */
+	struct client_addr *	m_addrkeys;	/* address index, MCL_FQDN */
+	unsigned int		m_seq;		/* order added to clientlist */
 	char *			m_hostname;
 	int			m_type;
 	int			m_naddr;
@@ -94,27 +100,31 @@ set_addrlist(nfs_client *clp, const int i, const struct sockaddr *sap)
 
 typedef struct mexport {
 	struct mexport *	m_next;
+	struct mexport **	m_pprev;	/* what points to this one */
+	struct hash_node	m_hnode;	/* exp_hash_table.p_index */
+	struct hash_node	m_cnode;	/* exp_hash_table.p_clients */
 	struct mclient *	m_client;
 	struct exportent	m_export;
 	int			m_exported;	/* known to knfsd. -1 means not sure */
 	int			m_xtabent  : 1,	/* xtab entry exists */
 				m_mayexport: 1,	/* derived from xtabbed */
-				m_changed  : 1, /* options (may) have changed */
-				m_warned   : 1; /* warned about multiple exports
-						 * matching one client */
+				m_changed  : 1; /* options (may) have changed */
+	int			m_warned;	/* warned about multiple exports
+						 * matching one client; set
+						 * atomically by mountd */
 } nfs_export;
 
-#define HASH_TABLE_SIZE 1021
 #define DEFAULT_TTL	(30 * 60)
 
-typedef struct _exp_hash_entry {
-	nfs_export * p_first;
-  	nfs_export * p_last;
-} exp_hash_entry;
-
+/*
+ * Exports of one client type.  p_head lists them with entries for the
+ * same path kept together; p_index finds them by e_path, and
+ * p_clients by m_client and e_path together.
+ */
 typedef struct _exp_hash_table {
-	nfs_export * p_head;
-	exp_hash_entry entries[HASH_TABLE_SIZE];
+	nfs_export *		p_head;
+	struct hash_table	p_index;
+	struct hash_table	p_clients;
 } exp_hash_table;
 
 extern exp_hash_table exportlist[MCL_MAXTYPES];
@@ -122,15 +132,28 @@ extern exp_hash_table exportlist[MCL_MAXTYPES];
 extern nfs_client *		clientlist[MCL_MAXTYPES];
 
 nfs_client *			client_lookup(char *hname, int canonical);
+void				client_prefetch_start(unsigned int nthreads);
+void				client_prefetch(char *hname);
+void				client_prefetch_stop(void);
 nfs_client *			client_dup(const nfs_client *clp,
 						const struct addrinfo *ai);
 int				client_gettype(char *hname);
 int				client_check(const nfs_client *clp,
 						const struct addrinfo *ai);
+void				client_check_prepare(const struct addrinfo *ai,
+						char **netgroups, int count);
+void				client_check_forget(void);
 void				client_release(nfs_client *);
 void				client_freeall(void);
+void				client_prune(void);
 char *				client_compose(const struct addrinfo *ai);
+nfs_client **			client_match_list(const struct addrinfo *ai,
+						unsigned int *count);
 struct addrinfo *		client_resolve(const struct sockaddr *sap);
+typedef void			(*host_addrinfo_cb)(struct addrinfo *ai,
+						void *data);
+void				client_netgroup_flush(void);
+void				client_netgroup_ttl(unsigned int seconds);
 int 				client_member(const char *client,
 						const char *name);
 
@@ -138,22 +161,52 @@ int				export_read(char *fname);
 int				export_d_read(const char *dname);
 void				export_reset(nfs_export *);
 nfs_export *			export_lookup(char *hname, char *path, int caconical);
+nfs_export *			export_first_by_path(int type, const char *path);
+nfs_export *			export_next_by_path(const nfs_export *exp);
 nfs_export *			export_find(const struct addrinfo *ai,
 						const char *path);
 nfs_export *			export_allowed(const struct addrinfo *ai,
 						const char *path);
 nfs_export *			export_create(struct exportent *, int canonical);
+nfs_export *			export_create_client(struct exportent *,
+						nfs_client *clp);
 void				exportent_release(struct exportent *);
+void				export_update(nfs_export *exp,
+						struct exportent *xep);
+void				export_reorder(nfs_export **exps,
+						unsigned int count);
+void				export_remove(nfs_export *exp);
 void				export_freeall(void);
 int				export_export(nfs_export *);
 int				export_unexport(nfs_export *);
 
 int				xtab_mount_read(void);
 int				xtab_export_read(void);
+typedef void			(*export_change_cb)(nfs_export *exp,
+						int added, void *data);
+int				xtab_export_reload(export_change_cb notify,
+						void *data);
+typedef struct exportent *	(*exportent_iter)(void *src);
+int				xtab_export_read_entries(exportent_iter next,
+						void *src);
+int				xtab_export_reload_entries(exportent_iter next,
+						void *src,
+						export_change_cb notify,
+						void *data);
 int				xtab_mount_write(void);
 int				xtab_export_write(void);
 void				xtab_append(nfs_export *);
 
+struct stat;
+int				etab_bin_compile(const char *etab,
+						const char *bin);
+int				etab_bin_check(const char *bin,
+						const struct stat *stb);
+void *				etab_bin_open(const char *etab,
+						const char *bin);
+struct exportent *		etab_bin_next(void *src);
+void				etab_bin_close(void *src);
+
 int				secinfo_addflavor(struct flav_info *, struct exportent *);
 
 char *				host_ntop(const struct sockaddr *sap,
@@ -169,6 +222,11 @@ struct addrinfo *		host_reliable_addrinfo(const struct sockaddr *sap);
 __attribute__((__malloc__))
 struct addrinfo *		host_numeric_addrinfo(const struct sockaddr *sap);
 
+unsigned int			host_resolver_start(unsigned int nthreads);
+void				host_reliable_addrinfo_async(
+						const struct sockaddr *sap,
+						host_addrinfo_cb cb, void *data);
+
 int				rmtab_read(void);
 
 struct nfskey *			key_lookup(char *hname);
@@ -0,0 +1,52 @@
+/*
+ * support/include/hashtable.h
+ *
+ * Simple intrusive hash tables for in-core indexes.
+ *
+ * A table does not own its entries.  Callers embed a struct hash_node
+ * in their own records, compute a hash value for the key, and walk
+ * the chain returned by hash_lookup() comparing full keys.  Entries
+ * with equal hash values are kept in insertion order, so the first
+ * match found is always the earliest one added, and the one found by
+ * hash_lookup_last() the latest.
+ */
+
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include <stddef.h>
+
+struct hash_node {
+	struct hash_node *	h_next;
+	unsigned int		h_hash;
+};
+
+struct hash_table {
+	struct hash_node **	h_buckets;
+	unsigned int		h_size;		/* zero, or a power of two */
+	unsigned int		h_count;
+	struct hash_node **	h_tails;	/* last node in each bucket */
+};
+
+#define HASH_TABLE_INIT		{ NULL, 0, 0, NULL }
+
+#define hash_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+unsigned int		hash_bytes(const void *buf, size_t len);
+unsigned int		hash_string(const char *str);
+unsigned int		hash_string_nocase(const char *str);
+
+void			hash_insert(struct hash_table *tbl,
+					struct hash_node *node,
+					unsigned int hash);
+void			hash_remove(struct hash_table *tbl,
+					struct hash_node *node);
+struct hash_node *	hash_lookup(const struct hash_table *tbl,
+					unsigned int hash);
+struct hash_node *	hash_lookup_next(const struct hash_node *node);
+struct hash_node *	hash_lookup_last(const struct hash_table *tbl,
+					unsigned int hash);
+void			hash_clear(struct hash_table *tbl);
+
+#endif /* HASHTABLE_H */
@@ -0,0 +1,63 @@
+/*
+ * support/include/latency.h
+ *
+ * Request counters and latency histograms.
+ *
+ * Counters live in one shared anonymous mapping, so processes forked
+ * after latency_init() add to the same totals, and any of them can
+ * report them.  Until latency_init() is called, recording does
+ * nothing.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum latency_id {
+	/* rpc.mountd kernel cache upcalls */
+	LAT_CACHE_AUTH_UNIX_IP,
+	LAT_CACHE_AUTH_UNIX_GID,
+	LAT_CACHE_NFSD_EXPORT,
+	LAT_CACHE_NFSD_FH,
+	/* MOUNT procedures, indexed by procedure number */
+	LAT_MOUNTPROC_NULL,
+	LAT_MOUNTPROC_MNT,
+	LAT_MOUNTPROC_DUMP,
+	LAT_MOUNTPROC_UMNT,
+	LAT_MOUNTPROC_UMNTALL,
+	LAT_MOUNTPROC_EXPORT,
+	LAT_MOUNTPROC_EXPORTALL,
+	LAT_MOUNTPROC_PATHCONF,
+	/* export table loads */
+	LAT_ETAB_LOAD,
+	LAT_ETAB_MERGE,
+	/* lookups done on behalf of the above */
+	LAT_DNS_REVERSE,
+	LAT_DNS_FORWARD,
+	LAT_NETGROUP_EXPAND,
+	LAT_NETGROUP_INNETGR,
+	LAT_BLKID,
+	LAT_NSS_GROUPS,
+	/* auth.unix.gid answers, from the group list cache or not */
+	LAT_GROUPS_HIT,
+	LAT_GROUPS_MISS,
+	/* kernel caches loaded ahead of demand, per client and in all */
+	LAT_PRESEED_CLIENT,
+	LAT_PRESEED_PASS,
+	LAT_MAX
+};
+
+/*
+ * Bucket 0 counts samples under 1 microsecond, and bucket n those
+ * under 2^n microseconds.  The last bucket takes everything slower.
+ */
+#define LAT_BUCKETS		24
+
+int		latency_init(void);
+uint64_t	latency_start(void);
+void		latency_record(enum latency_id id, uint64_t start);
+void		latency_report(FILE *fp);
+
+#endif /* LATENCY_H */
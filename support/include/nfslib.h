@@ -53,6 +53,9 @@
 #ifndef _PATH_ETABLCK
 #define _PATH_ETABLCK		NFS_STATEDIR "/.etab.lock"
 #endif
+#ifndef _PATH_ETABBIN
+#define _PATH_ETABBIN		NFS_STATEDIR "/etab.bin"
+#endif
 #ifndef _PATH_RMTAB
 #define _PATH_RMTAB		NFS_STATEDIR "/rmtab"
 #endif
@@ -62,6 +65,9 @@
 #ifndef _PATH_RMTABLCK
 #define _PATH_RMTABLCK		NFS_STATEDIR "/.rmtab.lock"
 #endif
+#ifndef _PATH_MOUNTD_STATS
+#define _PATH_MOUNTD_STATS	NFS_STATEDIR "/mountd.stats"
+#endif
 #ifndef _PATH_PROC_EXPORTS
 #define	_PATH_PROC_EXPORTS	"/proc/fs/nfs/exports"
 #define	_PATH_PROC_EXPORTS_ALT	"/proc/fs/nfsd/exports"
@@ -116,6 +122,8 @@ void			endexportent(void);
 struct exportent *	mkexportent(char *hname, char *path, char *opts);
 void			dupexportent(struct exportent *dst,
 					struct exportent *src);
+int			exportent_equal(const struct exportent *a,
+					const struct exportent *b);
 int			updateexportent(struct exportent *eep, char *options);
 
 int			setrmtabent(char *type);
@@ -164,6 +172,19 @@ void qword_adduint(char **bpp, int *lp, unsigned int n);
 void qword_addeol(char **bpp, int *lp);
 int qword_get_uint(char **bpp, unsigned int *anint);
 
+struct cache_io_stats {
+	unsigned long	cs_upcalls;	/* requests read */
+	unsigned long	cs_wakeups;	/* channel drains */
+	unsigned long	cs_replies;	/* replies sent */
+	unsigned long	cs_writes;	/* write(2) calls */
+	unsigned long	cs_errors;	/* failed writes */
+};
+
+int cache_write(int fd, const char *buf, int len);
+int cache_read_upcall(int fd, char *buf, int len);
+void cache_io_count_wakeup(void);
+void cache_io_get_stats(struct cache_io_stats *stats);
+
 void closeall(int min);
 
 int			svctcp_socket (u_long __number, int __reuse);
@@ -55,6 +55,11 @@ void		rpc_dispatch(struct svc_req *rq, SVCXPRT *xprt,
 				void *argp, void *resp);
 int		getservport(u_long number, const char *proto);
 
+int		nfs_svc_epoll_init(void);
+int		nfs_svc_epoll_watch(int fd);
+int		nfs_svc_epoll_wait(int *fds, int nfds, int timeout);
+void		nfs_svc_epoll_getreq(int fd);
+
 extern int	_rpcpmstart;
 extern unsigned int	_rpcprotobits;
 extern int	_rpcsvcdirty;
@@ -11,5 +11,8 @@
 
 extern int v4root_needed;
 extern void v4root_set(void);
+extern void v4root_reset(void);
+extern void v4root_changed(nfs_export *exp);
+extern void v4root_update(void);
 
 #endif /* V4ROOT_H */
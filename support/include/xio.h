@@ -9,8 +9,12 @@
 #include <stdio.h>
 
 typedef struct XFILE {
-	FILE		*x_fp;
+	FILE		*x_fp;		/* NULL when reading */
 	int		x_line;
+	char		*x_buf;		/* contents of a file being read */
+	size_t		x_len;
+	size_t		x_pos;
+	int		x_unget;	/* pushed back character, or EOF */
 } XFILE;
 
 XFILE	*xfopen(char *fname, char *type);
@@ -35,6 +35,8 @@ struct xlog_debugfac {
 	int		df_fac;
 };
 
+struct xlog_msg;
+
 extern int export_errno;
 void			xlog_open(char *progname);
 void			xlog_stderr(int on);
@@ -47,5 +49,7 @@ void			xlog_warn(const char *fmt, ...);
 void			xlog_err(const char *fmt, ...);
 void			xlog_errno(int err, const char *fmt, ...);
 void			xlog_backend(int fac, const char *fmt, va_list args);
+void			xlog_hold(struct xlog_msg **list);
+void			xlog_release(struct xlog_msg **list);
 
 #endif /* XLOG_H */
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 void qword_add(char **bpp, int *lp, char *str)
 {
@@ -198,6 +199,88 @@ int qword_get_uint(char **bpp, unsigned int *anint)
 	return 0;
 }
 
+/*
+ * Cache channel I/O
+ *
+ * A channel hands out one upcall per read(2), and read(2) returns 0
+ * once no more are pending, so a reader can drain every waiting
+ * upcall in one wakeup.  Replies can't be merged: the kernel parses
+ * exactly one reply per write(2), so each one is written as soon as
+ * it has been built.
+ */
+static struct cache_io_stats	cache_stats;
+static pthread_mutex_t		cache_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * cache_write - send a reply down a cache channel
+ * @fd: channel file descriptor
+ * @buf: one complete reply
+ * @len: length of @buf in bytes
+ *
+ * Returns the result of write(2).
+ */
+int
+cache_write(int fd, const char *buf, int len)
+{
+	int ret;
+
+	ret = write(fd, buf, len);
+	pthread_mutex_lock(&cache_stats_lock);
+	cache_stats.cs_replies++;
+	cache_stats.cs_writes++;
+	if (ret != len)
+		cache_stats.cs_errors++;
+	pthread_mutex_unlock(&cache_stats_lock);
+	return ret;
+}
+
+/**
+ * cache_read_upcall - read one pending upcall from a cache channel
+ * @fd: channel file descriptor
+ * @buf: buffer for the request
+ * @len: size of @buf
+ *
+ * Returns the request's length, zero if none is pending, or -1.
+ */
+int
+cache_read_upcall(int fd, char *buf, int len)
+{
+	int ret;
+
+	ret = read(fd, buf, len);
+	if (ret > 0) {
+		pthread_mutex_lock(&cache_stats_lock);
+		cache_stats.cs_upcalls++;
+		pthread_mutex_unlock(&cache_stats_lock);
+	}
+	return ret;
+}
+
+/**
+ * cache_io_count_wakeup - count one drain of a cache channel
+ *
+ */
+void
+cache_io_count_wakeup(void)
+{
+	pthread_mutex_lock(&cache_stats_lock);
+	cache_stats.cs_wakeups++;
+	pthread_mutex_unlock(&cache_stats_lock);
+}
+
+/**
+ * cache_io_get_stats - copy the cache channel I/O counters
+ * @stats: filled in with the counters
+ *
+ */
+void
+cache_io_get_stats(struct cache_io_stats *stats)
+{
+	pthread_mutex_lock(&cache_stats_lock);
+	*stats = cache_stats;
+	pthread_mutex_unlock(&cache_stats_lock);
+}
+
 /* Check if we should use the new caching interface
  * This succeeds iff the "nfsd" filesystem is mounted on
  * /proc/fs/nfs
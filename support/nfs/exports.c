@@ -30,6 +30,7 @@
 #include "xmalloc.h"
 #include "xlog.h"
 #include "xio.h"
+#include "hashtable.h"
 #include "pseudoflavors.h"
 
 #define EXPORT_DEFAULT_FLAGS	\
@@ -54,6 +55,19 @@ static int	has_default_opts, has_default_subtree_opts;
 static int	*squids = NULL, nsquids = 0,
 		*sqgids = NULL, nsqgids = 0;
 
+/*
+ * Large tables export the same few paths to many clients.  Each path
+ * is resolved once per file read rather than once per entry.
+ */
+struct export_rpath {
+	struct hash_node	r_node;
+	struct export_rpath	*r_next;
+	char			*r_path;
+	char			*r_resolved;	/* NULL if realpath failed */
+};
+static struct hash_table	rpath_tbl = HASH_TABLE_INIT;
+static struct export_rpath	*rpath_list;
+
 static int	getexport(char *exp, int len);
 static int	getpath(char *path, int len);
 static int	parseopts(char *cp, struct exportent *ep, int warn, int *had_subtree_opt_ptr);
@@ -62,6 +76,8 @@ static int	parsenum(char **cpp);
 static void	freesquash(void);
 static void	syntaxerr(char *msg);
 static struct flav_info *find_flavor(char *name);
+static const char *export_realpath(const char *path);
+static void	export_realpath_flush(void);
 
 void
 setexportent(char *fname, char *type)
@@ -108,7 +124,7 @@ getexportent(int fromkernel, int fromexports)
 {
 	static struct exportent	ee, def_ee;
 	char		exp[512], *hostname;
-	char		rpath[MAXPATHLEN+1];
+	const char	*rpath;
 	char		*opt, *sp;
 	int		ok;
 
@@ -183,8 +199,7 @@ getexportent(int fromkernel, int fromexports)
 		return NULL;
 
 	/* resolve symlinks */
-	if (realpath(ee.e_path, rpath) != NULL) {
-		rpath[sizeof (rpath) - 1] = '\0';
+	if ((rpath = export_realpath(ee.e_path)) != NULL) {
 		strncpy(ee.e_path, rpath, sizeof (ee.e_path) - 1);
 		ee.e_path[sizeof (ee.e_path) - 1] = '\0';
 	}
@@ -333,6 +348,48 @@ endexportent(void)
 		free(efname);
 	efname = NULL;
 	freesquash();
+	export_realpath_flush();
+}
+
+static const char *
+export_realpath(const char *path)
+{
+	unsigned int hash = hash_string(path);
+	char rpath[MAXPATHLEN+1];
+	struct export_rpath *r;
+	struct hash_node *n;
+
+	for (n = hash_lookup(&rpath_tbl, hash); n; n = hash_lookup_next(n)) {
+		r = hash_entry(n, struct export_rpath, r_node);
+		if (strcmp(r->r_path, path) == 0)
+			return r->r_resolved;
+	}
+
+	r = xmalloc(sizeof(*r));
+	r->r_path = xstrdup(path);
+	r->r_resolved = NULL;
+	if (realpath(path, rpath) != NULL) {
+		rpath[sizeof (rpath) - 1] = '\0';
+		r->r_resolved = xstrdup(rpath);
+	}
+	hash_insert(&rpath_tbl, &r->r_node, hash);
+	r->r_next = rpath_list;
+	rpath_list = r;
+	return r->r_resolved;
+}
+
+static void
+export_realpath_flush(void)
+{
+	struct export_rpath *r;
+
+	while ((r = rpath_list) != NULL) {
+		rpath_list = r->r_next;
+		free(r->r_path);
+		free(r->r_resolved);
+		free(r);
+	}
+	hash_clear(&rpath_tbl);
 }
 
 void
@@ -358,6 +415,61 @@ dupexportent(struct exportent *dst, struct exportent *src)
 	dst->e_hostname = NULL;
 }
 
+static int
+optstr_equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/**
+ * exportent_equal - compare two export entries
+ * @a: first entry
+ * @b: second entry
+ *
+ * Returns 1 if @a and @b name the same client and path with the same
+ * options, otherwise zero.  Client names are compared without regard
+ * to case, as client_lookup() does.
+ */
+int
+exportent_equal(const struct exportent *a, const struct exportent *b)
+{
+	const struct sec_entry *p, *q;
+
+	if (a->e_hostname == NULL || b->e_hostname == NULL) {
+		if (a->e_hostname != b->e_hostname)
+			return 0;
+	} else if (strcasecmp(a->e_hostname, b->e_hostname) != 0)
+		return 0;
+	if (strcmp(a->e_path, b->e_path) != 0)
+		return 0;
+	if (a->e_flags != b->e_flags ||
+	    a->e_anonuid != b->e_anonuid ||
+	    a->e_anongid != b->e_anongid ||
+	    a->e_fsid != b->e_fsid ||
+	    a->e_fslocmethod != b->e_fslocmethod ||
+	    a->e_ttl != b->e_ttl)
+		return 0;
+	if (a->e_nsquids != b->e_nsquids || a->e_nsqgids != b->e_nsqgids)
+		return 0;
+	if (a->e_nsquids && memcmp(a->e_squids, b->e_squids,
+				   a->e_nsquids * sizeof(int)) != 0)
+		return 0;
+	if (a->e_nsqgids && memcmp(a->e_sqgids, b->e_sqgids,
+				   a->e_nsqgids * sizeof(int)) != 0)
+		return 0;
+	if (!optstr_equal(a->e_mountpoint, b->e_mountpoint) ||
+	    !optstr_equal(a->e_fslocdata, b->e_fslocdata) ||
+	    !optstr_equal(a->e_uuid, b->e_uuid))
+		return 0;
+
+	for (p = a->e_secinfo, q = b->e_secinfo; p->flav && q->flav; p++, q++)
+		if (p->flav != q->flav || p->flags != q->flags)
+			return 0;
+	return p->flav == q->flav;
+}
+
 struct exportent *
 mkexportent(char *hname, char *path, char *options)
 {
@@ -485,6 +597,56 @@ static void clearflags(int mask, unsigned int active, struct exportent *ep)
 	}
 }
 
+/*
+ * Options that only set or clear a flag.  These are matched where they
+ * lie in the option list, without being copied out first.
+ */
+static const struct export_flagopt {
+	const char	*name;
+	int		flag;
+	int		set;
+} export_flagopts[] = {
+	{ "ro",			NFSEXP_READONLY,	1 },
+	{ "rw",			NFSEXP_READONLY,	0 },
+	{ "secure",		NFSEXP_INSECURE_PORT,	0 },
+	{ "insecure",		NFSEXP_INSECURE_PORT,	1 },
+	{ "sync",		NFSEXP_ASYNC,		0 },
+	{ "async",		NFSEXP_ASYNC,		1 },
+	{ "nordirplus",		NFSEXP_NOREADDIRPLUS,	1 },
+	{ "nohide",		NFSEXP_NOHIDE,		1 },
+	{ "hide",		NFSEXP_NOHIDE,		0 },
+	{ "crossmnt",		NFSEXP_CROSSMOUNT,	1 },
+	{ "nocrossmnt",		NFSEXP_CROSSMOUNT,	0 },
+	{ "wdelay",		NFSEXP_GATHERED_WRITES,	1 },
+	{ "no_wdelay",		NFSEXP_GATHERED_WRITES,	0 },
+	{ "root_squash",	NFSEXP_ROOTSQUASH,	1 },
+	{ "no_root_squash",	NFSEXP_ROOTSQUASH,	0 },
+	{ "all_squash",		NFSEXP_ALLSQUASH,	1 },
+	{ "no_all_squash",	NFSEXP_ALLSQUASH,	0 },
+	{ "subtree_check",	NFSEXP_NOSUBTREECHECK,	0 },
+	{ "no_subtree_check",	NFSEXP_NOSUBTREECHECK,	1 },
+	{ "auth_nlm",		NFSEXP_NOAUTHNLM,	0 },
+	{ "no_auth_nlm",	NFSEXP_NOAUTHNLM,	1 },
+	{ "secure_locks",	NFSEXP_NOAUTHNLM,	0 },
+	{ "insecure_locks",	NFSEXP_NOAUTHNLM,	1 },
+	{ "acl",		NFSEXP_NOACL,		0 },
+	{ "no_acl",		NFSEXP_NOACL,		1 },
+	{ "pnfs",		NFSEXP_PNFS,		1 },
+	{ "no_pnfs",		NFSEXP_PNFS,		0 },
+	{ NULL,			0,			0 },
+};
+
+static const struct export_flagopt *
+find_flagopt(const char *opt, size_t len)
+{
+	const struct export_flagopt *fo;
+
+	for (fo = export_flagopts; fo->name; fo++)
+		if (strncmp(fo->name, opt, len) == 0 && fo->name[len] == '\0')
+			return fo;
+	return NULL;
+}
+
 /*
  * For those flags which are not allowed to vary by pseudoflavor,
  * ensure that the export flags agree with the flags on each
@@ -520,73 +682,28 @@ parseopts(char *cp, struct exportent *ep, int warn, int *had_subtree_opt_ptr)
 		cp++;
 
 	while (*cp) {
-		char *opt = strdup(cp);
+		const struct export_flagopt *fo;
+		char *opt = NULL;
 		char *optstart = cp;
+		size_t optlen;
 		while (*cp && *cp != ',')
 			cp++;
-		if (*cp) {
-			opt[cp-optstart] = '\0';
+		optlen = cp - optstart;
+		if (*cp)
 			cp++;
-		}
+		fo = find_flagopt(optstart, optlen);
+		if (fo == NULL)
+			opt = strndup(optstart, optlen);
 
 		/* process keyword */
-		if (strcmp(opt, "ro") == 0)
-			setflags(NFSEXP_READONLY, active, ep);
-		else if (strcmp(opt, "rw") == 0)
-			clearflags(NFSEXP_READONLY, active, ep);
-		else if (!strcmp(opt, "secure"))
-			clearflags(NFSEXP_INSECURE_PORT, active, ep);
-		else if (!strcmp(opt, "insecure"))
-			setflags(NFSEXP_INSECURE_PORT, active, ep);
-		else if (!strcmp(opt, "sync"))
-			clearflags(NFSEXP_ASYNC, active, ep);
-		else if (!strcmp(opt, "async"))
-			setflags(NFSEXP_ASYNC, active, ep);
-		else if (!strcmp(opt, "nordirplus"))
-			setflags(NFSEXP_NOREADDIRPLUS, active, ep);
-		else if (!strcmp(opt, "nohide"))
-			setflags(NFSEXP_NOHIDE, active, ep);
-		else if (!strcmp(opt, "hide"))
-			clearflags(NFSEXP_NOHIDE, active, ep);
-		else if (!strcmp(opt, "crossmnt"))
-			setflags(NFSEXP_CROSSMOUNT, active, ep);
-		else if (!strcmp(opt, "nocrossmnt"))
-			clearflags(NFSEXP_CROSSMOUNT, active, ep);
-		else if (!strcmp(opt, "wdelay"))
-			setflags(NFSEXP_GATHERED_WRITES, active, ep);
-		else if (!strcmp(opt, "no_wdelay"))
-			clearflags(NFSEXP_GATHERED_WRITES, active, ep);
-		else if (strcmp(opt, "root_squash") == 0)
-			setflags(NFSEXP_ROOTSQUASH, active, ep);
-		else if (!strcmp(opt, "no_root_squash"))
-			clearflags(NFSEXP_ROOTSQUASH, active, ep);
-		else if (strcmp(opt, "all_squash") == 0)
-			setflags(NFSEXP_ALLSQUASH, active, ep);
-		else if (strcmp(opt, "no_all_squash") == 0)
-			clearflags(NFSEXP_ALLSQUASH, active, ep);
-		else if (strcmp(opt, "subtree_check") == 0) {
-			had_subtree_opt = 1;
-			clearflags(NFSEXP_NOSUBTREECHECK, active, ep);
-		} else if (strcmp(opt, "no_subtree_check") == 0) {
-			had_subtree_opt = 1;
-			setflags(NFSEXP_NOSUBTREECHECK, active, ep);
-		} else if (strcmp(opt, "auth_nlm") == 0)
-			clearflags(NFSEXP_NOAUTHNLM, active, ep);
-		else if (strcmp(opt, "no_auth_nlm") == 0)
-			setflags(NFSEXP_NOAUTHNLM, active, ep);
-		else if (strcmp(opt, "secure_locks") == 0)
-			clearflags(NFSEXP_NOAUTHNLM, active, ep);
-		else if (strcmp(opt, "insecure_locks") == 0)
-			setflags(NFSEXP_NOAUTHNLM, active, ep);
-		else if (strcmp(opt, "acl") == 0)
-			clearflags(NFSEXP_NOACL, active, ep);
-		else if (strcmp(opt, "no_acl") == 0)
-			setflags(NFSEXP_NOACL, active, ep);
-		else if (!strcmp(opt, "pnfs"))
-			setflags(NFSEXP_PNFS, active, ep);
-		else if (!strcmp(opt, "no_pnfs"))
-			clearflags(NFSEXP_PNFS, active, ep);
-		else if (strncmp(opt, "anonuid=", 8) == 0) {
+		if (fo) {
+			if (fo->flag == NFSEXP_NOSUBTREECHECK)
+				had_subtree_opt = 1;
+			if (fo->set)
+				setflags(fo->flag, active, ep);
+			else
+				clearflags(fo->flag, active, ep);
+		} else if (strncmp(opt, "anonuid=", 8) == 0) {
 			char *oe;
 			ep->e_anonuid = strtol(opt+8, &oe, 10);
 			if (opt[8]=='\0' || *oe != '\0') {
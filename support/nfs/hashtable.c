@@ -0,0 +1,256 @@
+/*
+ * support/nfs/hashtable.c
+ *
+ * Simple intrusive hash tables for in-core indexes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "hashtable.h"
+#include "xcommon.h"
+
+#define HASH_MIN_SIZE		64
+
+/*
+ * 32-bit FNV-1a.  Cheap, and unlike the old character sum it spreads
+ * paths that share a long common prefix across the whole table.
+ */
+#define FNV_OFFSET_BASIS	2166136261U
+#define FNV_PRIME		16777619U
+
+/**
+ * hash_bytes - compute a hash value for a buffer
+ * @buf: data to hash
+ * @len: length of @buf in bytes
+ *
+ */
+unsigned int
+hash_bytes(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	unsigned int h = FNV_OFFSET_BASIS;
+
+	while (len--) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/**
+ * hash_string - compute a hash value for a NUL-terminated string
+ * @str: string to hash
+ *
+ */
+unsigned int
+hash_string(const char *str)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	unsigned int h = FNV_OFFSET_BASIS;
+
+	while (*p) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/**
+ * hash_string_nocase - compute a case-insensitive string hash value
+ * @str: string to hash
+ *
+ * Strings that compare equal with strcasecmp(3) hash to the same value.
+ */
+unsigned int
+hash_string_nocase(const char *str)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	unsigned int h = FNV_OFFSET_BASIS;
+
+	while (*p) {
+		h ^= tolower(*p++);
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static void
+hash_grow(struct hash_table *tbl)
+{
+	unsigned int size = tbl->h_size ? tbl->h_size << 1 : HASH_MIN_SIZE;
+	struct hash_node **buckets, **tails;
+	unsigned int i;
+
+	buckets = xmalloc(size * sizeof(*buckets));
+	tails = xmalloc(size * sizeof(*tails));
+	for (i = 0; i < size; i++) {
+		buckets[i] = NULL;
+		tails[i] = NULL;
+	}
+
+	/* Every node in a new bucket comes from the same old bucket,
+	 * so moving them in chain order keeps insertion order intact. */
+	for (i = 0; i < tbl->h_size; i++) {
+		struct hash_node *node, *next;
+
+		for (node = tbl->h_buckets[i]; node; node = next) {
+			unsigned int b = node->h_hash & (size - 1);
+
+			next = node->h_next;
+			node->h_next = NULL;
+			if (tails[b])
+				tails[b]->h_next = node;
+			else
+				buckets[b] = node;
+			tails[b] = node;
+		}
+	}
+
+	free(tbl->h_tails);
+	free(tbl->h_buckets);
+	tbl->h_buckets = buckets;
+	tbl->h_tails = tails;
+	tbl->h_size = size;
+}
+
+/**
+ * hash_insert - add an entry to a hash table
+ * @tbl: target table
+ * @node: hash_node embedded in the new entry
+ * @hash: hash value of the entry's key
+ *
+ * The table grows as needed; allocation failure is fatal.
+ */
+void
+hash_insert(struct hash_table *tbl, struct hash_node *node, unsigned int hash)
+{
+	unsigned int b;
+
+	if (tbl->h_count >= tbl->h_size)
+		hash_grow(tbl);
+
+	b = hash & (tbl->h_size - 1);
+	node->h_hash = hash;
+	node->h_next = NULL;
+	if (tbl->h_tails[b])
+		tbl->h_tails[b]->h_next = node;
+	else
+		tbl->h_buckets[b] = node;
+	tbl->h_tails[b] = node;
+	tbl->h_count++;
+}
+
+/**
+ * hash_remove - remove an entry from a hash table
+ * @tbl: table containing @node
+ * @node: hash_node to unlink
+ *
+ */
+void
+hash_remove(struct hash_table *tbl, struct hash_node *node)
+{
+	struct hash_node **pp, *prev = NULL;
+	unsigned int b;
+
+	if (tbl->h_size == 0)
+		return;
+
+	b = node->h_hash & (tbl->h_size - 1);
+	for (pp = &tbl->h_buckets[b]; *pp; prev = *pp, pp = &(*pp)->h_next) {
+		if (*pp == node) {
+			*pp = node->h_next;
+			if (tbl->h_tails[b] == node)
+				tbl->h_tails[b] = prev;
+			node->h_next = NULL;
+			tbl->h_count--;
+			return;
+		}
+	}
+}
+
+/**
+ * hash_lookup - find the first entry with a given hash value
+ * @tbl: table to search
+ * @hash: hash value of the key being looked up
+ *
+ * Returns NULL if there is no candidate.  Callers must compare the
+ * full key, and use hash_lookup_next() to find further candidates.
+ */
+struct hash_node *
+hash_lookup(const struct hash_table *tbl, unsigned int hash)
+{
+	struct hash_node *node;
+
+	if (tbl->h_size == 0)
+		return NULL;
+
+	node = tbl->h_buckets[hash & (tbl->h_size - 1)];
+	while (node && node->h_hash != hash)
+		node = node->h_next;
+	return node;
+}
+
+/**
+ * hash_lookup_next - find the next entry with the same hash value
+ * @node: entry returned by an earlier hash_lookup{,_next}() call
+ *
+ */
+struct hash_node *
+hash_lookup_next(const struct hash_node *node)
+{
+	unsigned int hash = node->h_hash;
+
+	node = node->h_next;
+	while (node && node->h_hash != hash)
+		node = node->h_next;
+	return (struct hash_node *)node;
+}
+
+/**
+ * hash_lookup_last - find the last entry with a given hash value
+ * @tbl: table to search
+ * @hash: hash value of the key being looked up
+ *
+ * Returns the most recently added candidate, or NULL.  This takes
+ * constant time when that is also the last entry added to its bucket.
+ */
+struct hash_node *
+hash_lookup_last(const struct hash_table *tbl, unsigned int hash)
+{
+	struct hash_node *node, *last = NULL;
+	unsigned int b;
+
+	if (tbl->h_size == 0)
+		return NULL;
+
+	b = hash & (tbl->h_size - 1);
+	node = tbl->h_tails[b];
+	if (node && node->h_hash == hash)
+		return node;
+	for (node = tbl->h_buckets[b]; node; node = node->h_next)
+		if (node->h_hash == hash)
+			last = node;
+	return last;
+}
+
+/**
+ * hash_clear - empty a hash table
+ * @tbl: table to clear
+ *
+ * Entries are not freed; the caller owns them.
+ */
+void
+hash_clear(struct hash_table *tbl)
+{
+	free(tbl->h_buckets);
+	free(tbl->h_tails);
+	tbl->h_buckets = NULL;
+	tbl->h_tails = NULL;
+	tbl->h_size = 0;
+	tbl->h_count = 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * support/nfs/latency.c
+ *
+ * Request counters and latency histograms.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <time.h>
+
+#include "latency.h"
+#include "xlog.h"
+
+struct latency_hist {
+	uint64_t	l_count;
+	uint64_t	l_total;	/* microseconds */
+	uint64_t	l_max;
+	uint64_t	l_buckets[LAT_BUCKETS];
+};
+
+static const char *latency_names[LAT_MAX] = {
+	[LAT_CACHE_AUTH_UNIX_IP]	= "cache.auth.unix.ip",
+	[LAT_CACHE_AUTH_UNIX_GID]	= "cache.auth.unix.gid",
+	[LAT_CACHE_NFSD_EXPORT]		= "cache.nfsd.export",
+	[LAT_CACHE_NFSD_FH]		= "cache.nfsd.fh",
+	[LAT_MOUNTPROC_NULL]		= "mount.null",
+	[LAT_MOUNTPROC_MNT]		= "mount.mnt",
+	[LAT_MOUNTPROC_DUMP]		= "mount.dump",
+	[LAT_MOUNTPROC_UMNT]		= "mount.umnt",
+	[LAT_MOUNTPROC_UMNTALL]		= "mount.umntall",
+	[LAT_MOUNTPROC_EXPORT]		= "mount.export",
+	[LAT_MOUNTPROC_EXPORTALL]	= "mount.exportall",
+	[LAT_MOUNTPROC_PATHCONF]	= "mount.pathconf",
+	[LAT_ETAB_LOAD]			= "etab.load",
+	[LAT_ETAB_MERGE]		= "etab.merge",
+	[LAT_DNS_REVERSE]		= "dns.reverse",
+	[LAT_DNS_FORWARD]		= "dns.forward",
+	[LAT_NETGROUP_EXPAND]		= "netgroup.expand",
+	[LAT_NETGROUP_INNETGR]		= "netgroup.innetgr",
+	[LAT_BLKID]			= "blkid",
+	[LAT_NSS_GROUPS]		= "nss.groups",
+	[LAT_GROUPS_HIT]		= "groups.hit",
+	[LAT_GROUPS_MISS]		= "groups.miss",
+	[LAT_PRESEED_CLIENT]		= "preseed.client",
+	[LAT_PRESEED_PASS]		= "preseed.pass",
+};
+
+static struct latency_hist *latency_table;
+
+/**
+ * latency_init - start collecting counters
+ *
+ * Call before forking processes that should share the counters.
+ * Returns zero on success; otherwise -1, and nothing is collected.
+ */
+int
+latency_init(void)
+{
+	void *p;
+
+	if (latency_table)
+		return 0;
+	p = mmap(NULL, LAT_MAX * sizeof(*latency_table),
+		 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		xlog(L_ERROR, "%s: can't map counters: %m", __func__);
+		return -1;
+	}
+	latency_table = p;
+	return 0;
+}
+
+static uint64_t
+latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * latency_start - note when an operation begins
+ *
+ * Returns a value to pass to latency_record() when it ends.
+ */
+uint64_t
+latency_start(void)
+{
+	if (latency_table == NULL)
+		return 0;
+	return latency_now();
+}
+
+/**
+ * latency_record - count an operation and how long it took
+ * @id: kind of operation
+ * @start: value latency_start() returned when the operation began
+ *
+ */
+void
+latency_record(enum latency_id id, uint64_t start)
+{
+	struct latency_hist *h;
+	uint64_t usec, max;
+	unsigned int b;
+
+	if (latency_table == NULL || start == 0)
+		return;
+
+	usec = (latency_now() - start) / 1000;
+	b = usec ? 64 - __builtin_clzll(usec) : 0;
+	if (b >= LAT_BUCKETS)
+		b = LAT_BUCKETS - 1;
+
+	h = &latency_table[id];
+	__atomic_fetch_add(&h->l_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->l_total, usec, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->l_buckets[b], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->l_max, __ATOMIC_RELAXED);
+	while (usec > max &&
+	       !__atomic_compare_exchange_n(&h->l_max, &max, usec, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Upper bound, in microseconds, of the bucket holding the sample
+ * below which @pct percent of @h's samples fall, or the longest
+ * sample if that is smaller.
+ */
+static uint64_t
+latency_percentile(const struct latency_hist *h, uint64_t count,
+		   unsigned int pct)
+{
+	uint64_t want = (count * pct + 99) / 100, seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < LAT_BUCKETS - 1; b++) {
+		seen += h->l_buckets[b];
+		if (seen >= want)
+			break;
+	}
+	if (b < LAT_BUCKETS - 1 && ((uint64_t)1 << b) < h->l_max)
+		return (uint64_t)1 << b;
+	return h->l_max;
+}
+
+/**
+ * latency_report - write all counters as text
+ * @fp: stream to write to
+ *
+ * Operations that never happened are left out.  The numbers are read
+ * while other processes may still be adding to them, so a line can
+ * be off by the operations that finished meanwhile.
+ */
+void
+latency_report(FILE *fp)
+{
+	struct latency_hist h;
+	unsigned int i, b;
+
+	if (latency_table == NULL)
+		return;
+
+	fprintf(fp, "# name count total_us max_us p50_us p90_us p99_us\n");
+	for (i = 0; i < LAT_MAX; i++) {
+		h = latency_table[i];
+		if (h.l_count == 0)
+			continue;
+		fprintf(fp, "%s %llu %llu %llu %llu %llu %llu\n",
+			latency_names[i],
+			(unsigned long long)h.l_count,
+			(unsigned long long)h.l_total,
+			(unsigned long long)h.l_max,
+			(unsigned long long)latency_percentile(&h, h.l_count, 50),
+			(unsigned long long)latency_percentile(&h, h.l_count, 90),
+			(unsigned long long)latency_percentile(&h, h.l_count, 99));
+	}
+
+	fprintf(fp, "# histograms: samples under 1, 2, 4 ... 2^%d us, "
+		"then the rest\n", LAT_BUCKETS - 2);
+	for (i = 0; i < LAT_MAX; i++) {
+		h = latency_table[i];
+		if (h.l_count == 0)
+			continue;
+		fprintf(fp, "hist %s", latency_names[i]);
+		for (b = 0; b < LAT_BUCKETS; b++)
+			fprintf(fp, " %llu", (unsigned long long)h.l_buckets[b]);
+		fputc('\n', fp);
+	}
+}
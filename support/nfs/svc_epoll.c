@@ -0,0 +1,221 @@
+/*
+ * support/nfs/svc_epoll.c
+ *
+ * epoll-driven replacement for the select(2) based RPC service loops.
+ *
+ * The RPC library tracks its transports in svc_pollfd[], which grows
+ * and shrinks as connections are accepted and torn down inside
+ * svc_getreq_common().  We mirror that set into an epoll instance:
+ * a transport that is closed drops out of epoll by itself, and the
+ * only way a new one appears is through a listener accepting a
+ * connection, so svc_pollfd[] is only rescanned after a listener has
+ * been serviced.  An idle descriptor costs nothing per wakeup, and
+ * descriptors are not limited to FD_SETSIZE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <rpc/rpc.h>
+#include <rpc/svc.h>
+
+#include "rpcmisc.h"
+#include "xlog.h"
+
+#define SVC_EPOLL_XPRT		0x01	/* RPC transport */
+#define SVC_EPOLL_LISTENER	0x02	/* RPC transport accepting connections */
+#define SVC_EPOLL_OTHER		0x04	/* caller's own descriptor */
+#define SVC_EPOLL_SEEN		0x08
+
+#define SVC_EPOLL_MAXEVENTS	64
+
+/*
+ * When the descriptor table is nearly full, accepting a connection
+ * may first close the most idle transport, and the new connection
+ * can then get the same descriptor number.  Only then do we need to
+ * re-add descriptors we believe are already being watched.
+ */
+#define SVC_EPOLL_FD_SLACK	32
+
+static int		svc_epfd = -1;
+static unsigned char *	svc_fdstate;
+static int		svc_fdstate_size;
+static int		svc_nxprt;
+
+static int
+svc_epoll_grow(int fd)
+{
+	unsigned char *new;
+	int size;
+
+	if (fd < svc_fdstate_size)
+		return 0;
+
+	size = svc_fdstate_size ? svc_fdstate_size : 64;
+	while (size <= fd)
+		size <<= 1;
+	new = realloc(svc_fdstate, size);
+	if (new == NULL)
+		return -1;
+	memset(new + svc_fdstate_size, 0, size - svc_fdstate_size);
+	svc_fdstate = new;
+	svc_fdstate_size = size;
+	return 0;
+}
+
+static int
+svc_epoll_add(int fd, unsigned char kind)
+{
+	struct epoll_event ev;
+
+	if (svc_epoll_grow(fd) < 0)
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(svc_epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+		return -1;
+	svc_fdstate[fd] = kind;
+	return 0;
+}
+
+static unsigned char
+svc_epoll_xprt_kind(int fd)
+{
+	socklen_t len = sizeof(int);
+	int val = 0;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val)
+		return SVC_EPOLL_XPRT | SVC_EPOLL_LISTENER;
+	return SVC_EPOLL_XPRT;
+}
+
+/*
+ * Bring the epoll set in line with svc_pollfd[].  With @readd, add
+ * every transport again, in case a descriptor number was reused.
+ */
+static void
+svc_epoll_sync(int readd)
+{
+	int i, fd, n = 0;
+
+	for (i = 0; i < svc_max_pollfd; i++) {
+		fd = svc_pollfd[i].fd;
+		if (fd < 0)
+			continue;
+		if (!readd && fd < svc_fdstate_size &&
+		    (svc_fdstate[fd] & SVC_EPOLL_XPRT)) {
+			svc_fdstate[fd] |= SVC_EPOLL_SEEN;
+			continue;
+		}
+		if (svc_epoll_add(fd, svc_epoll_xprt_kind(fd)) < 0) {
+			xlog(L_ERROR, "%s: can't watch descriptor %d: %m",
+				__func__, fd);
+			continue;
+		}
+		svc_fdstate[fd] |= SVC_EPOLL_SEEN;
+	}
+
+	for (fd = 0; fd < svc_fdstate_size; fd++) {
+		if (!(svc_fdstate[fd] & SVC_EPOLL_XPRT))
+			continue;
+		if (svc_fdstate[fd] & SVC_EPOLL_SEEN) {
+			svc_fdstate[fd] &= ~SVC_EPOLL_SEEN;
+			n++;
+			continue;
+		}
+		(void)epoll_ctl(svc_epfd, EPOLL_CTL_DEL, fd, NULL);
+		svc_fdstate[fd] = 0;
+	}
+	svc_nxprt = n;
+}
+
+/**
+ * nfs_svc_epoll_init - start watching the registered RPC transports
+ *
+ * Returns zero on success; otherwise -1 with errno set.
+ */
+int
+nfs_svc_epoll_init(void)
+{
+	if (svc_epfd < 0) {
+		svc_epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (svc_epfd < 0)
+			return -1;
+	}
+	svc_epoll_sync(0);
+	return 0;
+}
+
+/**
+ * nfs_svc_epoll_watch - add a non-RPC descriptor to the service loop
+ * @fd: descriptor to wait for input on
+ *
+ * nfs_svc_epoll_wait() reports @fd when it is readable; the caller
+ * services it instead of passing it to nfs_svc_epoll_getreq().
+ * Returns zero on success; otherwise -1 with errno set.
+ */
+int
+nfs_svc_epoll_watch(int fd)
+{
+	return svc_epoll_add(fd, SVC_EPOLL_OTHER);
+}
+
+/**
+ * nfs_svc_epoll_wait - wait for input on the service loop's descriptors
+ * @fds: array to fill with readable descriptors
+ * @nfds: size of @fds
+ * @timeout: as for epoll_wait(2), in milliseconds
+ *
+ * Returns the number of readable descriptors, zero on timeout, or -1
+ * with errno set.
+ */
+int
+nfs_svc_epoll_wait(int *fds, int nfds, int timeout)
+{
+	struct epoll_event events[SVC_EPOLL_MAXEVENTS];
+	int i, n;
+
+	if (nfds > SVC_EPOLL_MAXEVENTS)
+		nfds = SVC_EPOLL_MAXEVENTS;
+
+	n = epoll_wait(svc_epfd, events, nfds, timeout);
+	for (i = 0; i < n; i++)
+		fds[i] = events[i].data.fd;
+	return n;
+}
+
+/**
+ * nfs_svc_epoll_getreq - service one readable RPC transport
+ * @fd: descriptor returned by nfs_svc_epoll_wait()
+ *
+ */
+void
+nfs_svc_epoll_getreq(int fd)
+{
+	unsigned char kind = fd < svc_fdstate_size ? svc_fdstate[fd] : 0;
+
+	svc_getreq_common(fd);
+
+	if (kind & SVC_EPOLL_LISTENER)
+		svc_epoll_sync(svc_nxprt + SVC_EPOLL_FD_SLACK >= getdtablesize());
+	else if ((kind & SVC_EPOLL_XPRT) &&
+		 fcntl(fd, F_GETFD) < 0 && errno == EBADF) {
+		/* The connection was torn down; the kernel has
+		 * already dropped it from the epoll set. */
+		svc_fdstate[fd] = 0;
+		svc_nxprt--;
+	}
+}
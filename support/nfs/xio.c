@@ -11,6 +11,7 @@
 #endif
 
 #include <sys/fcntl.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -22,17 +23,77 @@
 #include "xlog.h"
 #include "xio.h"
 
+/*
+ * Files are read whole into memory and parsed from there rather than
+ * one locked getc() at a time.  They are read(2), not mapped: exports
+ * and etab may be truncated in place while being read, and a mapping
+ * would then fault.  The buffer is sized from fstat(2) where that
+ * means anything, so most files take a single read.
+ */
+static int
+xfread(XFILE *xfp, char *fname)
+{
+	struct stat	stb;
+	size_t		size;
+	ssize_t		n;
+	char		*buf;
+	int		fd;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	size = 4096;
+	if (fstat(fd, &stb) == 0 && S_ISREG(stb.st_mode) &&
+	    (size_t)stb.st_size >= size)
+		size = stb.st_size + 1;
+
+	buf = xmalloc(size);
+	xfp->x_len = 0;
+	while ((n = read(fd, buf + xfp->x_len, size - xfp->x_len)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		xfp->x_len += n;
+		if (xfp->x_len == size) {
+			size <<= 1;
+			buf = xrealloc(buf, size);
+		}
+	}
+	close(fd);
+	if (n < 0) {
+		free(buf);
+		return -1;
+	}
+	xfp->x_buf = buf;
+	return 0;
+}
+
 XFILE *
 xfopen(char *fname, char *type)
 {
 	XFILE	*xfp;
-	FILE	*fp;
+	FILE	*fp = NULL;
 
-	if (!(fp = fopen(fname, type)))
-		return NULL;
 	xfp = (XFILE *) xmalloc(sizeof(*xfp));
-	xfp->x_fp = fp;
+	memset(xfp, 0, sizeof(*xfp));
 	xfp->x_line = 1;
+	xfp->x_unget = EOF;
+
+	if (strcmp(type, "r") == 0) {
+		if (xfread(xfp, fname) < 0) {
+			xfree(xfp);
+			return NULL;
+		}
+		return xfp;
+	}
+
+	if (!(fp = fopen(fname, type))) {
+		xfree(xfp);
+		return NULL;
+	}
+	xfp->x_fp = fp;
 
 	return xfp;
 }
@@ -40,10 +101,49 @@ xfopen(char *fname, char *type)
 void
 xfclose(XFILE *xfp)
 {
-	fclose(xfp->x_fp);
+	if (xfp->x_fp)
+		fclose(xfp->x_fp);
+	else
+		free(xfp->x_buf);
 	xfree(xfp);
 }
 
+static inline int
+xfgetc(XFILE *xfp)
+{
+	int	c;
+
+	if (xfp->x_unget != EOF) {
+		c = xfp->x_unget;
+		xfp->x_unget = EOF;
+		return c;
+	}
+	if (xfp->x_pos >= xfp->x_len)
+		return EOF;
+	return (unsigned char)xfp->x_buf[xfp->x_pos++];
+}
+
+/*
+ * The next character, left unread.  xgetc() looks ahead with this
+ * rather than xfungetc(), as its caller may push back the character
+ * it returns, and there is room for only one.
+ */
+static inline int
+xfpeek(const XFILE *xfp)
+{
+	if (xfp->x_unget != EOF)
+		return xfp->x_unget;
+	if (xfp->x_pos >= xfp->x_len)
+		return EOF;
+	return (unsigned char)xfp->x_buf[xfp->x_pos];
+}
+
+static inline void
+xfungetc(int c, XFILE *xfp)
+{
+	xfp->x_unget = c;
+}
+
 int
 xflock(char *fname, char *type)
 {
@@ -78,6 +178,28 @@ xfunlock(int fd)
 }
 
 #define isoctal(x) (isdigit(x) && ((x)<'8'))
+
+static inline int
+xgetc_fast(XFILE *xfp)
+{
+	int	c = xfgetc(xfp);
+
+	if (c == EOF)
+		return c;
+	if (c == '\\') {
+		if (xfpeek(xfp) != '\n')
+			return '\\';
+		xfgetc(xfp);
+		xfp->x_line++;
+		while ((c = xfpeek(xfp)) == ' ' || c == '\t')
+			xfgetc(xfp);
+		return ' ';
+	}
+	if (c == '\n')
+		xfp->x_line++;
+	return c;
+}
+
 int
 xgettok(XFILE *xfp, char sepa, char *tok, int len)
 {
@@ -85,8 +207,26 @@ xgettok(XFILE *xfp, char sepa, char *tok, int len)
 	int	c = 0;
 	int 	quoted=0;
 
-	while (i < len && (c = xgetc(xfp)) != EOF &&
-	       (quoted || (c != sepa && !isspace(c)))) {
+	for (;;) {
+		/* Copy plain characters in bulk.  Not right after a
+		 * backslash, which may start an octal escape. */
+		if (!quoted && xfp->x_unget == EOF &&
+		    !(i >= 1 && tok[i-1] == '\\') &&
+		    !(i >= 2 && tok[i-2] == '\\') &&
+		    !(i >= 3 && tok[i-3] == '\\')) {
+			const char *p = xfp->x_buf + xfp->x_pos;
+			const char *end = xfp->x_buf + xfp->x_len;
+
+			while (i < len && p < end && *p != sepa &&
+			       *p != '"' && *p != '\\' &&
+			       !isspace((unsigned char)*p))
+				tok[i++] = *p++;
+			xfp->x_pos = p - xfp->x_buf;
+		}
+
+		if (!(i < len && (c = xgetc_fast(xfp)) != EOF &&
+		      (quoted || (c != sepa && !isspace(c)))))
+			break;
 		if (c == '"') {
 			quoted = !quoted;
 			continue;
@@ -116,23 +256,7 @@ xgettok(XFILE *xfp, char sepa, char *tok, int len)
 int
 xgetc(XFILE *xfp)
 {
-	int	c = getc(xfp->x_fp);
-
-	if (c == EOF)
-		return c;
-	if (c == '\\') {
-		if ((c = getc(xfp->x_fp)) != '\n') {
-			ungetc(c, xfp->x_fp);
-			return '\\';
-		}
-		xfp->x_line++;
-		while ((c = getc(xfp->x_fp)) == ' ' || c == '\t');
-		ungetc(c, xfp->x_fp);
-		return ' ';
-	}
-	if (c == '\n')
-		xfp->x_line++;
-	return c;
+	return xgetc_fast(xfp);
 }
 
 void
@@ -141,7 +265,7 @@ xungetc(int c, XFILE *xfp)
 	if (c == EOF)
 		return;
 
-	ungetc(c, xfp->x_fp);
+	xfungetc(c, xfp);
 	if (c == '\n')
 		xfp->x_line--;
 }
@@ -165,6 +289,6 @@ xskipcomment(XFILE *xfp)
 {
 	int	c;
 
-	while ((c = getc(xfp->x_fp)) != EOF && c != '\n');
+	while ((c = xfgetc(xfp)) != EOF && c != '\n');
 	return c;
 }
@@ -41,6 +41,18 @@ static int  log_pid = -1;		/* PID of this program		*/
 
 int export_errno = 0;
 
+/*
+ * Messages held back by xlog_hold().  A caller that does its work
+ * out of order, such as parsing ahead, can still log in order.
+ */
+struct xlog_msg {
+	struct xlog_msg *	m_next;
+	int			m_kind;
+	char			m_text[];
+};
+
+static __thread struct xlog_msg	**xlog_held;
+
 static void	xlog_toggle(int sig);
 static struct xlog_debugfac	debugnames[] = {
 	{ "general",	D_GENERAL, },
@@ -132,6 +144,75 @@ xlog_enabled(int fac)
 }
 
 
+/**
+ * xlog_hold - hold back this thread's messages
+ * @list: where to keep them, or NULL to log them again
+ *
+ * Messages are appended to @list until the next call, and written
+ * by xlog_release().  L_FATAL messages are never held.
+ */
+void
+xlog_hold(struct xlog_msg **list)
+{
+	while (list != NULL && *list != NULL)
+		list = &(*list)->m_next;
+	xlog_held = list;
+}
+
+static void
+xlog_replay(int kind, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	xlog_backend(kind, fmt, args);
+	va_end(args);
+}
+
+/**
+ * xlog_release - write and free messages held by xlog_hold()
+ * @list: messages to write
+ *
+ */
+void
+xlog_release(struct xlog_msg **list)
+{
+	struct xlog_msg *m;
+
+	while ((m = *list) != NULL) {
+		*list = m->m_next;
+		xlog_replay(m->m_kind, "%s", m->m_text);
+		free(m);
+	}
+}
+
+static int
+xlog_keep(int kind, const char *fmt, va_list args)
+{
+	struct xlog_msg *m;
+	va_list args2;
+	char *text;
+	int len;
+
+	va_copy(args2, args);
+	len = vasprintf(&text, fmt, args2);
+	va_end(args2);
+	if (len < 0)
+		return 0;
+	m = malloc(sizeof(*m) + len + 1);
+	if (m == NULL) {
+		free(text);
+		return 0;
+	}
+	m->m_next = NULL;
+	m->m_kind = kind;
+	memcpy(m->m_text, text, len + 1);
+	free(text);
+	*xlog_held = m;
+	xlog_held = &m->m_next;
+	return 1;
+}
+
 /* Write something to the system logfile and/or stderr */
 void
 xlog_backend(int kind, const char *fmt, va_list args)
@@ -141,6 +222,10 @@ xlog_backend(int kind, const char *fmt, va_list args)
 	if (!(kind & (L_ALL)) && !(logging && (kind & logmask)))
 		return;
 
+	/* If it can't be kept, log it now */
+	if (xlog_held != NULL && kind != L_FATAL && xlog_keep(kind, fmt, args))
+		return;
+
 	if (log_stderr)
 		va_copy(args2, args);
 
@@ -168,14 +253,14 @@ xlog_backend(int kind, const char *fmt, va_list args)
 	if (log_stderr) {
 #ifdef VERBOSE_PRINTF
 		time_t		now;
-		struct tm	*tm;
+		struct tm	tm;
 
 		time(&now);
-		tm = localtime(&now);
+		localtime_r(&now, &tm);
 		fprintf(stderr, "%s[%d] %04d-%02d-%02d %02d:%02d:%02d ",
 				log_name, log_pid,
-				tm->tm_year+1900, tm->tm_mon + 1, tm->tm_mday,
-				tm->tm_hour, tm->tm_min, tm->tm_sec);
+				tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
+				tm.tm_hour, tm.tm_min, tm.tm_sec);
 #else
 		fprintf(stderr, "%s: ", log_name);
 #endif
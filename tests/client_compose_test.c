@@ -0,0 +1,198 @@
+/*
+ * client_compose_test.c -- check client_compose() against clientlist[]
+ *
+ * Fills clientlist[] with addresses, subnets and wildcards, then checks
+ * that, for many addresses, client_compose() returns the same string
+ * the old walk over clientlist[] built: the names of every client that
+ * client_check() accepts, sorted.  More clients are then added, so the
+ * compiled matcher has to be rebuilt, and the check is repeated.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfslib.h"
+#include "exportfs.h"
+#include "xlog.h"
+
+#define PROBES		2000
+
+static int
+name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* What the old client_compose() returned */
+static char *
+walk_compose(const struct addrinfo *ai)
+{
+	char *names[1024], *res;
+	unsigned int n = 0, i;
+	size_t len = 1;
+	nfs_client *clp;
+	int type;
+
+	for (type = 0; type < MCL_MAXTYPES; type++)
+		for (clp = clientlist[type]; clp; clp = clp->m_next)
+			if (client_check(clp, ai) && n < 1024) {
+				names[n++] = clp->m_hostname;
+				len += strlen(clp->m_hostname) + 1;
+			}
+	if (n == 0)
+		return NULL;
+	qsort(names, n, sizeof(names[0]), name_cmp);
+	res = malloc(len);
+	if (res == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	res[0] = '\0';
+	for (i = 0; i < n; i++) {
+		if (i)
+			strcat(res, ",");
+		strcat(res, names[i]);
+	}
+	return res;
+}
+
+static void
+add_client(const char *fmt, unsigned int a, unsigned int b, unsigned int c)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), fmt, a, b, c);
+	if (client_lookup(name, 0) == NULL) {
+		fprintf(stderr, "can't add client %s\n", name);
+		exit(1);
+	}
+}
+
+static void
+add_clients(unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int a = random() % 4, b = random() % 4;
+		unsigned int c = random() % 16;
+
+		switch (random() % 8) {
+		case 0:
+		case 1:
+			add_client("10.%u.%u.%u", a, b, c);
+			break;
+		case 2:
+			add_client("2001:db8::%x:%x", a, c, 0);
+			break;
+		case 3:
+			add_client("10.%u.%u.0/24", a, b, 0);
+			break;
+		case 4:
+			add_client("10.%u.%u.%u/30", a, b, c & ~3);
+			break;
+		case 5:
+			add_client("10.%u.*.%u", a, c, 0);
+			break;
+		case 6:
+			add_client("10.%u.%u.?", a, b, 0);
+			break;
+		default:
+			add_client("2001:db8::%x:0/112", a, 0, 0);
+			break;
+		}
+	}
+}
+
+static int
+probe(unsigned int count)
+{
+	unsigned int i, matched = 0;
+	int bad = 0;
+
+	for (i = 0; i < count; i++) {
+		struct addrinfo *pai, *ai;
+		char addr[64], *got, *want;
+		unsigned int a = random() % 5, b = random() % 5;
+		unsigned int c = random() % 20;
+
+		if (random() % 4 == 0)
+			snprintf(addr, sizeof(addr), "2001:db8::%x:%x", a, c);
+		else
+			snprintf(addr, sizeof(addr), "10.%u.%u.%u", a, b, c);
+		pai = host_pton(addr);
+		if (pai == NULL) {
+			fprintf(stderr, "can't convert %s\n", addr);
+			exit(1);
+		}
+		ai = host_numeric_addrinfo(pai->ai_addr);
+		freeaddrinfo(pai);
+		if (ai == NULL) {
+			fprintf(stderr, "can't make addrinfo for %s\n", addr);
+			exit(1);
+		}
+
+		got = client_compose(ai);
+		want = walk_compose(ai);
+		if (want)
+			matched++;
+		if ((got == NULL) != (want == NULL) ||
+		    (got && strcmp(got, want) != 0)) {
+			fprintf(stderr, "%s: client_compose gave \"%s\", "
+				"expected \"%s\"\n", addr,
+				got ? got : "", want ? want : "");
+			bad++;
+		}
+		free(got);
+		free(want);
+		freeaddrinfo(ai);
+	}
+	if (matched == 0) {
+		fprintf(stderr, "no address matched any client\n");
+		bad++;
+	}
+	return bad;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	xlog_open("client_compose_test");
+	xlog_syslog(0);
+	xlog_stderr(1);
+	srandom(1);
+
+	add_clients(100);
+	if (probe(PROBES))
+		ret = 1;
+
+	/* New clients, including ones that match everything */
+	add_clients(100);
+	add_client("10.0.0.0/8", 0, 0, 0);
+	add_client("*", 0, 0, 0);
+	add_client("gss/krb5", 0, 0, 0);
+	if (probe(PROBES))
+		ret = 1;
+
+	client_freeall();
+	return ret;
+}
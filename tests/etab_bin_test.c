@@ -0,0 +1,164 @@
+/*
+ * etab_bin_test.c -- check that a compiled etab reads back as etab does
+ *
+ * Writes an etab using a wide range of options, compiles it with
+ * etab_bin_compile(), and checks that etab_bin_next() returns, entry
+ * for entry, what getexportent() parses from the text.  Then checks
+ * that a compiled file which no longer matches its etab is refused.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nfslib.h"
+#include "exportfs.h"
+#include "xlog.h"
+
+static const char *etab_lines[] = {
+	"/export\t*(rw,sync,wdelay,hide,nocrossmnt,secure,root_squash,"
+		"no_all_squash,no_subtree_check,secure_locks,acl,no_pnfs,"
+		"anonuid=65534,anongid=65534,sec=sys,rw,secure,root_squash,"
+		"no_all_squash)",
+	"/export\t10.0.0.0/8(ro,async,no_root_squash,subtree_check,"
+		"anonuid=99,anongid=100,sec=krb5:krb5i:krb5p,ro)",
+	"/export/with\\040space\t192.168.1.2(rw,sync,crossmnt,"
+		"no_subtree_check,fsid=17,mountpoint)",
+	"/export/mp\t*.example.com(rw,sync,no_subtree_check,"
+		"mountpoint=/export,fsid=root)",
+	"/export/uuid\t@trusted(ro,sync,no_subtree_check,"
+		"fsid=01234567-89ab-cdef-0123-456789abcdef)",
+	"/export/refer\tgss/krb5(rw,sync,no_subtree_check,"
+		"refer=/a@server1+/b@server2)",
+	"/export/squash\t10.1.2.0/24(rw,sync,all_squash,no_subtree_check,"
+		"squash_uids=0-15,squash_gids=5,sec=sys,rw,sec=krb5,ro)",
+	"/export/insecure\t[0-9]*.lab(rw,insecure,no_subtree_check,"
+		"replicas=/r@server3,nordirplus,no_wdelay,nohide,"
+		"insecure_locks,no_acl,pnfs)",
+	"/\t2001:db8::/32(ro,fsid=0,no_subtree_check,sec=sys:krb5)",
+};
+
+static void
+write_etab(const char *fname, unsigned int copies)
+{
+	unsigned int i, j;
+	FILE *fp;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		perror(fname);
+		exit(1);
+	}
+	for (j = 0; j < copies; j++)
+		for (i = 0; i < sizeof(etab_lines) / sizeof(etab_lines[0]);
+		     i++)
+			fprintf(fp, "%s\n", etab_lines[i]);
+	fclose(fp);
+}
+
+/* Returns the number of entries that differ, or -1 */
+static int
+compare(const char *etab, const char *bin, unsigned int *count)
+{
+	struct exportent *xp, *bp;
+	int bad = 0;
+	void *src;
+
+	src = etab_bin_open(etab, bin);
+	if (src == NULL) {
+		fprintf(stderr, "can't open %s\n", bin);
+		return -1;
+	}
+	*count = 0;
+	setexportent((char *)etab, "r");
+	for (;;) {
+		xp = getexportent(0, 0);
+		bp = etab_bin_next(src);
+		if (xp == NULL || bp == NULL)
+			break;
+		if (!exportent_equal(xp, bp)) {
+			fprintf(stderr, "entry %u differs: %s %s\n",
+				*count, xp->e_hostname, xp->e_path);
+			bad++;
+		}
+		(*count)++;
+	}
+	if (xp != NULL || bp != NULL) {
+		fprintf(stderr, "%s has %s entries than %s\n", bin,
+			xp ? "fewer" : "more", etab);
+		bad++;
+	}
+	endexportent();
+	etab_bin_close(src);
+	return bad;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/etab_bin_test.XXXXXX";
+	char etab[64], bin[64];
+	unsigned int count, lines;
+	void *src;
+	int ret = 0;
+
+	xlog_open("etab_bin_test");
+	xlog_syslog(0);
+	xlog_stderr(1);
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(etab, sizeof(etab), "%s/etab", dir);
+	snprintf(bin, sizeof(bin), "%s/etab.bin", dir);
+	lines = sizeof(etab_lines) / sizeof(etab_lines[0]);
+
+	/* Enough copies that the string table has to grow */
+	write_etab(etab, 200);
+	if (etab_bin_compile(etab, bin) < 0) {
+		fprintf(stderr, "can't compile %s\n", etab);
+		ret = 1;
+	} else if (compare(etab, bin, &count) != 0)
+		ret = 1;
+	else if (count != 200 * lines) {
+		fprintf(stderr, "read %u entries, expected %u\n",
+			count, 200 * lines);
+		ret = 1;
+	}
+
+	/* A rewritten etab makes the compiled copy stale */
+	write_etab(etab, 1);
+	src = etab_bin_open(etab, bin);
+	if (src != NULL) {
+		fprintf(stderr, "stale %s was accepted\n", bin);
+		etab_bin_close(src);
+		ret = 1;
+	}
+	if (etab_bin_compile(etab, bin) < 0 ||
+	    compare(etab, bin, &count) != 0 || count != lines) {
+		fprintf(stderr, "recompiling %s failed\n", etab);
+		ret = 1;
+	}
+
+	unlink(bin);
+	unlink(etab);
+	rmdir(dir);
+	return ret;
+}
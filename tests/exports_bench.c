@@ -0,0 +1,279 @@
+/*
+ * exports_bench.c -- time parsing of large exports and etab files
+ *
+ * Writes a synthetic exports file, and the etab that exportfs would
+ * make of it, then reports how long getexportent() takes to read each
+ * and how long it takes to load each, and the compiled etab, into the
+ * export table.  Without -n, this is done for 10k, 100k and 1M entries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "nfslib.h"
+#include "exportfs.h"
+#include "xlog.h"
+
+#define BENCH_PATHS	1000
+
+static const char *bench_opts[] = {
+	"rw,sync,no_subtree_check",
+	"ro,async,no_root_squash,no_subtree_check,anonuid=99,anongid=99",
+	"rw,sync,crossmnt,no_subtree_check,sec=krb5:krb5i:krb5p",
+	"rw,sync,no_subtree_check,fsid=%u,mountpoint",
+	"ro,insecure,all_squash,subtree_check,sec=sys,rw,sec=krb5,ro",
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+write_exports(const char *fname, const char *dir, unsigned int count)
+{
+	unsigned int i;
+	FILE *fp;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		perror(fname);
+		exit(1);
+	}
+	fprintf(fp, "# synthetic exports: %u entries\n", count);
+	for (i = 0; i < count; i++) {
+		char opts[128];
+
+		snprintf(opts, sizeof(opts),
+			 bench_opts[i % (sizeof(bench_opts) /
+					 sizeof(bench_opts[0]))], i + 1);
+		switch (i % 4) {
+		case 0:
+			fprintf(fp, "%s/d%u\t10.%u.%u.0/24(%s)\n", dir,
+				i % BENCH_PATHS, (i >> 16) & 255,
+				(i >> 8) & 255, opts);
+			break;
+		case 1:
+			fprintf(fp, "%s/d%u\t@netgroup%u(%s)\n", dir,
+				i % BENCH_PATHS, i, opts);
+			break;
+		case 2:
+			fprintf(fp, "\"%s/d%u\" *.dom%u.example(%s)\n", dir,
+				i % BENCH_PATHS, i, opts);
+			break;
+		default:
+			/* Addresses, so loading needs no DNS */
+			fprintf(fp, "%s/d%u \\\n\t192.%u.%u.%u(%s)\n", dir,
+				i % BENCH_PATHS, (i >> 16) & 255,
+				(i >> 8) & 255, i & 255, opts);
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+/* Parse @fname @rounds times; returns entries read per round */
+static unsigned int
+parse(char *fname, int fromexports, unsigned int rounds, double *secs)
+{
+	unsigned int n = 0, r;
+	double start = now();
+
+	for (r = 0; r < rounds; r++) {
+		n = 0;
+		setexportent(fname, "r");
+		while (getexportent(0, fromexports) != NULL)
+			n++;
+		endexportent();
+	}
+	*secs = (now() - start) / rounds;
+	return n;
+}
+
+static struct exportent *
+etab_next(void *UNUSED(src))
+{
+	return getexportent(0, 0);
+}
+
+/*
+ * Load @fname into the export table, or the compiled @bin if it is
+ * set; returns the number of exports.
+ */
+static unsigned int
+load(char *fname, char *bin, int fromexports, double *secs)
+{
+	unsigned int n = 0, i;
+	nfs_export *exp;
+	double start = now();
+	void *src;
+
+	if (fromexports)
+		export_read(fname);
+	else if (bin) {
+		src = etab_bin_open(fname, bin);
+		if (src == NULL) {
+			fprintf(stderr, "can't open %s\n", bin);
+			exit(1);
+		}
+		xtab_export_read_entries(etab_bin_next, src);
+		etab_bin_close(src);
+	} else {
+		setexportent(fname, "r");
+		xtab_export_read_entries(etab_next, NULL);
+		endexportent();
+	}
+	*secs = now() - start;
+
+	for (i = 0; i < MCL_MAXTYPES; i++)
+		for (exp = exportlist[i].p_head; exp; exp = exp->m_next)
+			n++;
+	export_freeall();
+	return n;
+}
+
+static void
+convert(char *from, char *to)
+{
+	struct exportent *ents = NULL;
+	struct exportent *xp;
+	unsigned int n = 0, size = 0, i;
+
+	setexportent(from, "r");
+	while ((xp = getexportent(0, 1)) != NULL) {
+		if (n == size) {
+			size = size ? size << 1 : 1024;
+			ents = realloc(ents, size * sizeof(*ents));
+			if (ents == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		dupexportent(&ents[n], xp);
+		ents[n++].e_hostname = strdup(xp->e_hostname);
+	}
+	endexportent();
+
+	setexportent(to, "w");
+	for (i = 0; i < n; i++) {
+		putexportent(&ents[i]);
+		exportent_release(&ents[i]);
+	}
+	endexportent();
+	free(ents);
+}
+
+static void
+bench(const char *dir, unsigned int count, unsigned int rounds)
+{
+	char exports[64], etab[64], bin[64];
+	unsigned int n;
+	double secs;
+
+	snprintf(exports, sizeof(exports), "%s/exports", dir);
+	snprintf(etab, sizeof(etab), "%s/etab", dir);
+	snprintf(bin, sizeof(bin), "%s/etab.bin", dir);
+
+	write_exports(exports, dir, count);
+	convert(exports, etab);
+	if (etab_bin_compile(etab, bin) < 0) {
+		fprintf(stderr, "can't compile %s\n", etab);
+		exit(1);
+	}
+
+	printf("%u entries:\n", count);
+	n = parse(exports, 1, rounds, &secs);
+	printf("  parse exports: %u entries in %.3fs (%.0f entries/s)\n",
+		n, secs, n / secs);
+	n = parse(etab, 0, rounds, &secs);
+	printf("  parse etab:    %u entries in %.3fs (%.0f entries/s)\n",
+		n, secs, n / secs);
+	n = load(exports, NULL, 1, &secs);
+	printf("  load exports:  %u exports in %.3fs (%.0f exports/s)\n",
+		n, secs, n / secs);
+	n = load(etab, NULL, 0, &secs);
+	printf("  load etab:     %u exports in %.3fs (%.0f exports/s)\n",
+		n, secs, n / secs);
+	n = load(etab, bin, 0, &secs);
+	printf("  load etab.bin: %u exports in %.3fs (%.0f exports/s)\n",
+		n, secs, n / secs);
+
+	unlink(exports);
+	unlink(etab);
+	unlink(bin);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned int sizes[] = { 10000, 100000, 1000000 };
+	char dir[] = "/tmp/exports_bench.XXXXXX";
+	char path[64];
+	unsigned int count = 0, rounds = 3, i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n entries] [-r rounds]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (rounds == 0)
+		rounds = 1;
+
+	xlog_open("exports_bench");
+	xlog_syslog(0);
+	xlog_stderr(1);
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (i = 0; i < BENCH_PATHS; i++) {
+		snprintf(path, sizeof(path), "%s/d%u", dir, i);
+		mkdir(path, 0755);
+	}
+	if (count)
+		bench(dir, count, rounds);
+	else
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			bench(dir, sizes[i], rounds);
+
+	for (i = 0; i < BENCH_PATHS; i++) {
+		snprintf(path, sizeof(path), "%s/d%u", dir, i);
+		rmdir(path);
+	}
+	rmdir(dir);
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * xgettok_test.c -- check how xgettok() splits exports file tokens
+ *
+ * Each case is written to a file, which is read back with xfopen() the
+ * way getexportent() reads exports and etab: skip blanks, take a token,
+ * repeat.  The tokens, and the value xgettok() returns at the end, must
+ * be the ones listed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xio.h"
+#include "xlog.h"
+
+#define MAX_TOKENS	8
+
+struct tok_case {
+	const char *	t_input;
+	char		t_sepa;
+	int		t_len;		/* size of the token buffer */
+	const char *	t_tokens[MAX_TOKENS];
+	int		t_last;		/* what ends the sequence */
+};
+
+static const struct tok_case cases[] = {
+	{ "/export/home\t10.0.0.0/8(rw)\n", 0, 64,
+	  { "/export/home", "10.0.0.0/8(rw)" }, 0 },
+	{ "\"/export/with space\" host\n", 0, 64,
+	  { "/export/with space", "host" }, 0 },
+	{ "a\"b c\"d e", 0, 64,
+	  { "ab cd", "e" }, 0 },
+	{ "/mnt/a\\040b /mnt/\\011tab", 0, 64,
+	  { "/mnt/a b", "/mnt/\ttab" }, 0 },
+	{ "\\101\\102C x\\134y", 0, 64,
+	  { "ABC", "x\\y" }, 0 },
+	{ "x\\\\040 z", 0, 64,
+	  { "x\\ ", "z" }, 0 },
+	{ "a\\9b a\\400 a\\04", 0, 64,
+	  { "a\\9b", "a\\400", "a\\04" }, 0 },
+	{ "trailing\\040", 0, 64,
+	  { "trailing " }, 0 },
+	{ "\"\" after", 0, 64,
+	  { NULL }, 0 },
+	{ "short toolongtoken", 0, 8,
+	  { "short" }, -1 },
+	{ "exact78 x", 0, 8,
+	  { "exact78", "x" }, 0 },
+	{ "key=value=end", '=', 64,
+	  { "key", "value" }, -1 },
+	{ "\"a=b\"=c=", '=', 64,
+	  { "a=b", "c" }, 0 },
+};
+
+static int
+run_case(const char *fname, const struct tok_case *tc, unsigned int n)
+{
+	char tok[64];
+	unsigned int i;
+	XFILE *xfp;
+	FILE *fp;
+	int ret = 0, r;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		perror(fname);
+		exit(1);
+	}
+	fputs(tc->t_input, fp);
+	fclose(fp);
+
+	xfp = xfopen((char *)fname, "r");
+	if (xfp == NULL) {
+		fprintf(stderr, "can't open %s\n", fname);
+		exit(1);
+	}
+	for (i = 0; ; i++) {
+		xskip(xfp, " \t\n");
+		r = xgettok(xfp, tc->t_sepa, tok, tc->t_len);
+		if (r != 1)
+			break;
+		if (i >= MAX_TOKENS || tc->t_tokens[i] == NULL) {
+			fprintf(stderr, "case %u: unexpected token \"%s\"\n",
+				n, tok);
+			ret = 1;
+			break;
+		}
+		if (strcmp(tok, tc->t_tokens[i]) != 0) {
+			fprintf(stderr, "case %u: token %u is \"%s\", "
+				"expected \"%s\"\n", n, i, tok,
+				tc->t_tokens[i]);
+			ret = 1;
+			break;
+		}
+	}
+	if (ret == 0 && i < MAX_TOKENS && tc->t_tokens[i] != NULL) {
+		fprintf(stderr, "case %u: missing token \"%s\"\n",
+			n, tc->t_tokens[i]);
+		ret = 1;
+	}
+	if (ret == 0 && r != tc->t_last) {
+		fprintf(stderr, "case %u: xgettok returned %d, expected %d\n",
+			n, r, tc->t_last);
+		ret = 1;
+	}
+	xfclose(xfp);
+	return ret;
+}
+
+int
+main(void)
+{
+	char fname[] = "/tmp/xgettok_test.XXXXXX";
+	unsigned int i;
+	int fd, ret = 0;
+
+	xlog_open("xgettok_test");
+	xlog_syslog(0);
+	xlog_stderr(1);
+
+	fd = mkstemp(fname);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		ret |= run_case(fname, &cases[i], i);
+	unlink(fname);
+	return ret;
+}
@@ -0,0 +1,315 @@
+/*
+ * xtab_reload_test.c -- check that merging etab changes matches a reload
+ *
+ * Writes a series of etabs, each a random edit of the one before:
+ * entries are dropped, added, given new options and moved.  After
+ * loading the first and merging each of the others in turn with
+ * xtab_export_reload_entries(), the export table must hold what a
+ * full load of the last etab gives.  The exports of one path must be
+ * in the same order, as the first one that matches a client wins;
+ * runs of different paths may be ordered differently.  Merging the
+ * same etab again must change nothing.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nfslib.h"
+#include "exportfs.h"
+#include "v4root.h"
+#include "xlog.h"
+
+#define ROUNDS		12
+#define MAX_LINES	400
+#define TEST_PATHS	12
+
+static const char *test_clients[] = {
+	"*", "10.0.0.0/8", "10.1.0.0/16", "10.1.2.0/24", "10.1.2.3",
+	"10.1.2.4", "192.168.0.1", "2001:db8::1", "2001:db8::/64",
+	"*.example.com", "host?.lab", "gss/krb5",
+};
+
+static const char *test_opts[] = {
+	"rw,sync,no_subtree_check",
+	"ro,sync,no_subtree_check",
+	"rw,async,no_root_squash,no_subtree_check",
+	"ro,sync,all_squash,anonuid=99,anongid=99,no_subtree_check",
+	"rw,sync,crossmnt,no_subtree_check,sec=krb5:krb5i,rw",
+	"rw,sync,no_subtree_check,fsid=%u",
+};
+
+struct etab_line {
+	unsigned int	l_path;
+	unsigned int	l_client;
+	unsigned int	l_opts;
+};
+
+static struct etab_line	lines[MAX_LINES];
+static unsigned int	nlines;
+
+/* One export, as it was found in the export table */
+struct snap_ent {
+	int			s_type;
+	unsigned int		s_pos;
+	int			s_xtabent;
+	struct exportent	s_ent;
+};
+
+static void
+random_line(struct etab_line *l)
+{
+	l->l_path = random() % TEST_PATHS;
+	l->l_client = random() % (sizeof(test_clients) /
+				  sizeof(test_clients[0]));
+	l->l_opts = random() % (sizeof(test_opts) / sizeof(test_opts[0]));
+}
+
+static void
+edit_lines(void)
+{
+	unsigned int i, j, n;
+	struct etab_line t;
+
+	for (i = 0; i < nlines; ) {
+		switch (random() % 10) {
+		case 0:			/* drop */
+			memmove(&lines[i], &lines[i + 1],
+				(nlines - i - 1) * sizeof(lines[0]));
+			nlines--;
+			continue;
+		case 1:			/* new options */
+			lines[i].l_opts = random() % (sizeof(test_opts) /
+						      sizeof(test_opts[0]));
+			break;
+		case 2:			/* move */
+			j = random() % nlines;
+			t = lines[i];
+			lines[i] = lines[j];
+			lines[j] = t;
+			break;
+		}
+		i++;
+	}
+	n = random() % 20;
+	for (i = 0; i < n && nlines < MAX_LINES; i++)
+		random_line(&lines[nlines++]);
+}
+
+static void
+write_etab(const char *fname, int pseudo_root)
+{
+	unsigned int i;
+	char opts[128];
+	FILE *fp;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		perror(fname);
+		exit(1);
+	}
+	if (pseudo_root)
+		fprintf(fp, "/\t*(ro,fsid=0,no_subtree_check)\n");
+	for (i = 0; i < nlines; i++) {
+		snprintf(opts, sizeof(opts), test_opts[lines[i].l_opts],
+			 lines[i].l_path + 1);
+		fprintf(fp, "/export/d%u\t%s(%s)\n", lines[i].l_path,
+			test_clients[lines[i].l_client], opts);
+	}
+	fclose(fp);
+}
+
+static struct exportent *
+etab_next(void *UNUSED(src))
+{
+	return getexportent(0, 0);
+}
+
+static void
+count_change(nfs_export *UNUSED(exp), int UNUSED(added), void *data)
+{
+	(*(unsigned int *)data)++;
+}
+
+static void
+load(const char *etab)
+{
+	setexportent((char *)etab, "r");
+	xtab_export_read_entries(etab_next, NULL);
+	endexportent();
+}
+
+static int
+merge(const char *etab, unsigned int *changes)
+{
+	int ret;
+
+	*changes = 0;
+	setexportent((char *)etab, "r");
+	ret = xtab_export_reload_entries(etab_next, NULL, count_change,
+					 changes);
+	endexportent();
+	return ret;
+}
+
+static int
+snap_cmp(const void *a, const void *b)
+{
+	const struct snap_ent *s = a, *t = b;
+	int r;
+
+	if (s->s_type != t->s_type)
+		return s->s_type < t->s_type ? -1 : 1;
+	r = strcmp(s->s_ent.e_path, t->s_ent.e_path);
+	if (r)
+		return r;
+	return s->s_pos < t->s_pos ? -1 : s->s_pos > t->s_pos;
+}
+
+/* Copy the export table, grouped by type and path, then free it */
+static struct snap_ent *
+snapshot(unsigned int *count)
+{
+	struct snap_ent *snap = NULL;
+	unsigned int n = 0, size = 0;
+	nfs_export *exp;
+	int i;
+
+	for (i = 0; i < MCL_MAXTYPES; i++)
+		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
+			if (n == size) {
+				size = size ? size << 1 : 64;
+				snap = realloc(snap, size * sizeof(*snap));
+				if (snap == NULL) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			snap[n].s_type = i;
+			snap[n].s_pos = n;
+			snap[n].s_xtabent = exp->m_xtabent;
+			dupexportent(&snap[n].s_ent, &exp->m_export);
+			snap[n].s_ent.e_hostname =
+				strdup(exp->m_client->m_hostname);
+			n++;
+		}
+	export_freeall();
+
+	qsort(snap, n, sizeof(*snap), snap_cmp);
+	*count = n;
+	return snap;
+}
+
+static void
+snapshot_free(struct snap_ent *snap, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		exportent_release(&snap[i].s_ent);
+	free(snap);
+}
+
+static int
+compare(unsigned int round, struct snap_ent *merged, unsigned int nmerged,
+	struct snap_ent *full, unsigned int nfull)
+{
+	unsigned int i;
+
+	if (nmerged != nfull) {
+		fprintf(stderr, "round %u: merge left %u exports, "
+			"a full load %u\n", round, nmerged, nfull);
+		return 1;
+	}
+	for (i = 0; i < nfull; i++) {
+		struct snap_ent *m = &merged[i], *f = &full[i];
+
+		if (m->s_type != f->s_type ||
+		    m->s_xtabent != f->s_xtabent ||
+		    !exportent_equal(&m->s_ent, &f->s_ent)) {
+			fprintf(stderr, "round %u: merge has %s:%s where "
+				"a full load has %s:%s\n", round,
+				m->s_ent.e_hostname, m->s_ent.e_path,
+				f->s_ent.e_hostname, f->s_ent.e_path);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/xtab_reload_test.XXXXXX";
+	char etab[ROUNDS][64];
+	struct snap_ent *merged, *full;
+	unsigned int nmerged, nfull, changes, r, k;
+	int merged_v4root, ret = 0;
+
+	xlog_open("xtab_reload_test");
+	xlog_syslog(0);
+	xlog_stderr(1);
+	srandom(1);
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (nlines = 0; nlines < 150; nlines++)
+		random_line(&lines[nlines]);
+	for (r = 0; r < ROUNDS; r++) {
+		snprintf(etab[r], sizeof(etab[r]), "%s/etab.%u", dir, r);
+		if (r)
+			edit_lines();
+		write_etab(etab[r], r % 3 == 1);
+	}
+
+	for (r = 1; r < ROUNDS; r++) {
+		load(etab[0]);
+		for (k = 1; k <= r; k++)
+			if (merge(etab[k], &changes) < 0) {
+				fprintf(stderr, "can't merge %s\n", etab[k]);
+				ret = 1;
+			}
+		if (merge(etab[r], &changes) != 0 || changes != 0) {
+			fprintf(stderr, "round %u: merging %s again made "
+				"%u changes\n", r, etab[r], changes);
+			ret = 1;
+		}
+		merged_v4root = v4root_needed;
+		merged = snapshot(&nmerged);
+
+		load(etab[r]);
+		if (merged_v4root != v4root_needed) {
+			fprintf(stderr, "round %u: merge left v4root_needed "
+				"%d, a full load %d\n", r, merged_v4root,
+				v4root_needed);
+			ret = 1;
+		}
+		full = snapshot(&nfull);
+
+		ret |= compare(r, merged, nmerged, full, nfull);
+		snapshot_free(merged, nmerged);
+		snapshot_free(full, nfull);
+	}
+
+	for (r = 0; r < ROUNDS; r++)
+		unlink(etab[r]);
+	rmdir(dir);
+	return ret;
+}
@@ -49,6 +49,9 @@ static int	matchhostname(const char *hostname1, const char *hostname2);
 static void grab_lockfile(void);
 static void release_lockfile(void);
 
+/* Host names in the exports files looked up at once */
+#define RESOLVER_THREADS	32
+
 static const char *lockfile = EXP_LOCKFILE;
 static int _lockfd = -1;
 
@@ -183,11 +186,13 @@ main(int argc, char **argv)
 	atexit(release_lockfile);
 
 	if (f_export && ! f_ignore) {
+		client_prefetch_start(RESOLVER_THREADS);
 		if (! (export_read(_PATH_EXPORTS) +
 		       export_d_read(_PATH_EXPORTS_D))) {
 			if (f_verbose)
 				xlog(L_WARNING, "No file systems exported!");
 		}
+		client_prefetch_stop();
 	}
 	if (f_export) {
 		if (f_all)
@@ -507,13 +512,22 @@ unexportfs(char *arg, int verbose)
 		xlog(L_ERROR, "Invalid export syntax: %s", arg);
 }
 
+/* nfsd.export channel, kept open across test_export() calls */
+static int export_channel = -1;
+
 static int can_test(void)
 {
+	static int tested, result;
 	char buf[1024] = { 0 };
 	int fd;
 	int n;
 	size_t bufsiz = sizeof(buf);
 
+	/* The test client only has to be set up once per run */
+	if (tested)
+		return result;
+	tested = 1;
+
 	fd = open("/proc/net/rpc/auth.unix.ip/channel", O_WRONLY);
 	if (fd < 0)
 		return 0;
@@ -529,15 +543,15 @@ static int can_test(void)
 	else
 		snprintf(buf, bufsiz-1, "nfsd 0.0.0.0 %d -test-client-\n", INT_MAX);
 
-	n = write(fd, buf, strlen(buf));
+	n = cache_write(fd, buf, strlen(buf));
 	close(fd);
 	if (n < 0)
 		return 0;
 
-	fd = open("/proc/net/rpc/nfsd.export/channel", O_WRONLY);
-	if (fd < 0)
+	export_channel = open("/proc/net/rpc/nfsd.export/channel", O_WRONLY);
+	if (export_channel < 0)
 		return 0;
-	close(fd);
+	result = 1;
 	return 1;
 }
 
@@ -547,7 +561,7 @@ static int test_export(char *path, int with_fsid)
 	char buf[NFS_MAXPATHLEN+1+64] = { 0 };
 	char *bp = buf;
 	int len = sizeof(buf);
-	int fd, n;
+	int n;
 
 	n = snprintf(buf, len, "-test-client- ");
 	bp += n;
@@ -556,11 +570,7 @@ static int test_export(char *path, int with_fsid)
 	if (len < 1)
 		return 0;
 	snprintf(bp, len, " 3 %d 65534 65534 0\n", with_fsid ? NFSEXP_FSID : 0);
-	fd = open("/proc/net/rpc/nfsd.export/channel", O_WRONLY);
-	if (fd < 0)
-		return 0;
-	n = write(fd, buf, strlen(buf));
-	close(fd);
+	n = cache_write(export_channel, buf, strlen(buf));
 	if (n < 0)
 		return 0;
 	return 1;
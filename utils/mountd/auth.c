@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "sockaddr.h"
 #include "misc.h"
@@ -24,6 +25,7 @@
 #include "exportfs.h"
 #include "mountd.h"
 #include "v4root.h"
+#include "latency.h"
 
 enum auth_error
 {
@@ -42,6 +44,25 @@ static nfs_client my_client;
 extern int new_cache;
 extern int use_ipaddr;
 
+/*
+ * The in-core export and client tables are rebuilt in place when etab
+ * changes.  Anything that looks at them holds export_lock for reading;
+ * auth_reload() takes it for writing, so readers only ever see a
+ * complete table.  The lock prefers writers, so a steady stream of
+ * upcalls can't hold off a reload; in return, no thread may wait for
+ * another thread's work while it holds the lock.
+ */
+#ifdef PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+static pthread_rwlock_t	export_lock =
+			PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+#else
+static pthread_rwlock_t	export_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+static pthread_mutex_t	reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int	export_lock_depth;
+/* Bumped by auth_reload() whenever the table changes */
+static unsigned int	export_gen;
+
 void
 auth_init(void)
 {
@@ -77,15 +98,161 @@ check_useipaddr(void)
 		cache_flush(1);
 }
 
+/**
+ * auth_read_lock - keep the export table from changing
+ *
+ * Calls nest.  auth_reload() does nothing while the calling thread
+ * holds the lock, so reload first and then lock.
+ */
+void
+auth_read_lock(void)
+{
+	if (export_lock_depth++ == 0)
+		pthread_rwlock_rdlock(&export_lock);
+}
+
+/**
+ * auth_read_unlock - release a hold taken by auth_read_lock()
+ *
+ */
+void
+auth_read_unlock(void)
+{
+	if (--export_lock_depth == 0) {
+		pthread_rwlock_unlock(&export_lock);
+		client_check_forget();
+	}
+}
+
+/**
+ * auth_read_suspend - let go of the export table for a while
+ *
+ * For a thread about to wait for something, such as a DNS lookup,
+ * that other threads may need the table to finish.  Nothing found
+ * in the table before may be used after auth_read_resume().  Returns
+ * what auth_read_resume() needs to take the table back.
+ */
+int
+auth_read_suspend(void)
+{
+	int depth = export_lock_depth;
+
+	if (depth) {
+		export_lock_depth = 0;
+		pthread_rwlock_unlock(&export_lock);
+	}
+	return depth;
+}
+
+/**
+ * auth_read_resume - take back a hold dropped by auth_read_suspend()
+ * @depth: auth_read_suspend()'s return value
+ *
+ */
+void
+auth_read_resume(int depth)
+{
+	if (depth) {
+		pthread_rwlock_rdlock(&export_lock);
+		export_lock_depth = depth;
+	}
+}
+
+/**
+ * auth_prepare - look up what matching a host will need
+ * @ai: addrinfo of the host
+ *
+ * Matching against wildcard and netgroup clients asks DNS, NIS or
+ * LDAP for aliases and netgroup members.  Those lookups are done
+ * here with the table let go, and client_check() uses their results
+ * until this thread lets go of the table for good.
+ */
+void
+auth_prepare(const struct addrinfo *ai)
+{
+	nfs_client *clp;
+	char **names;
+	int depth, i, n = 0;
+
+	if (!clientlist[MCL_WILDCARD] && !clientlist[MCL_NETGROUP])
+		return;
+
+	for (clp = clientlist[MCL_NETGROUP]; clp; clp = clp->m_next)
+		n++;
+	names = calloc(n + 1, sizeof(*names));
+	if (names == NULL)
+		return;
+	for (i = 0, clp = clientlist[MCL_NETGROUP]; clp; clp = clp->m_next)
+		if ((names[i] = strdup(clp->m_hostname)) != NULL)
+			i++;
+
+	depth = auth_read_suspend();
+	client_check_prepare(ai, names, i);
+	auth_read_resume(depth);
+
+	while (i-- > 0)
+		free(names[i]);
+	free(names);
+}
+
+/**
+ * auth_resolve - client_resolve() for a thread holding the export table
+ * @sap: pointer to socket address to resolve
+ *
+ * The table is let go while DNS is asked, so a slow or shared lookup
+ * holds up neither a reload nor the resolver threads that need the
+ * table to answer their own upcalls.  The lookups needed to match
+ * the result are done then too; see auth_prepare().  Returns an
+ * addrinfo structure to be freed with freeaddrinfo(3), or NULL.
+ */
+struct addrinfo *
+auth_resolve(const struct sockaddr *sap)
+{
+	struct addrinfo *ai = NULL;
+	int depth;
+
+	if (clientlist[MCL_WILDCARD] || clientlist[MCL_NETGROUP]) {
+		depth = auth_read_suspend();
+		ai = host_reliable_addrinfo(sap);
+		auth_read_resume(depth);
+	}
+	if (ai == NULL)
+		ai = host_numeric_addrinfo(sap);
+	if (ai != NULL)
+		auth_prepare(ai);
+	return ai;
+}
+
+static void
+auth_export_changed(nfs_export *exp, int added, void *UNUSED(data))
+{
+	if (!added)
+		cache_forget_export(exp);
+	v4root_changed(exp);
+}
+
+/*
+ * Once the table is loaded, a new etab is merged into it: exports
+ * whose entry is unchanged, and anything derived from them, are kept.
+ * The returned counter changes only when the table does.
+ */
 unsigned int
 auth_reload()
 {
 	struct stat		stb;
 	static ino_t		last_inode;
 	static int		last_fd = -1;
-	static unsigned int	counter;
-	int			fd;
+	unsigned int		ret;
+	uint64_t		start;
+	void			*shared;
+	int			fd, changes;
+
+	/* The table can't change under a reader; it will be
+	 * reloaded by the next request. */
+	if (export_lock_depth)
+		return __atomic_load_n(&export_gen, __ATOMIC_ACQUIRE);
 
+	pthread_mutex_lock(&reload_lock);
 	if ((fd = open(_PATH_ETAB, O_RDONLY)) < 0) {
 		xlog(L_FATAL, "couldn't open %s", _PATH_ETAB);
 	} else if (fstat(fd, &stb) < 0) {
@@ -96,7 +263,9 @@ auth_reload()
 		 * number hasn't changed since then.
 		 */
 		close(fd);
-		return counter;
+		ret = __atomic_load_n(&export_gen, __ATOMIC_ACQUIRE);
+		pthread_mutex_unlock(&reload_lock);
+		return ret;
 	} else {
 		/* Need to process entries from the etab file.  Close
 		 * the file descriptor from the previous open (last_fd),
@@ -110,15 +279,49 @@ auth_reload()
 		last_inode = stb.st_ino;
 	}
 
-	export_freeall();
+	/* A compiled etab is mapped by each worker.  Otherwise
+	 * another worker may already have parsed this etab; if not,
+	 * parse it for them.  Readers carry on meanwhile. */
+	start = latency_start();
+	shared = NULL;
+	if (!etab_bin_check(_PATH_ETABBIN, &stb))
+		shared = etab_share_get(&stb);
+
+	pthread_rwlock_wrlock(&export_lock);
+	if (export_gen == 0 || !new_cache) {
+		cache_forget_exports();
+		export_freeall();
+		if (shared)
+			xtab_export_read_entries(etab_share_next, shared);
+		else
+			xtab_export_read();
+		v4root_set();
+		latency_record(LAT_ETAB_LOAD, start);
+	} else {
+		v4root_reset();
+		if (shared)
+			changes = xtab_export_reload_entries(etab_share_next,
+					shared, auth_export_changed, NULL);
+		else
+			changes = xtab_export_reload(auth_export_changed,
+					NULL);
+		v4root_update();
+		latency_record(LAT_ETAB_MERGE, start);
+		if (changes <= 0)
+			goto out;
+		client_prune();
+	}
+	client_netgroup_flush();
 	memset(&my_client, 0, sizeof(my_client));
-	xtab_export_read();
 	check_useipaddr();
-	v4root_set();
-
-	++counter;
-
-	return counter;
+	__atomic_store_n(&export_gen, export_gen + 1, __ATOMIC_RELEASE);
+out:
+	ret = export_gen;
+	pthread_rwlock_unlock(&export_lock);
+	etab_share_put(shared);
+	pthread_mutex_unlock(&reload_lock);
+
+	return ret;
 }
 
 static char *get_client_ipaddr_name(const struct sockaddr *caller)
@@ -186,9 +389,8 @@ auth_authenticate_newcache(const struct sockaddr *caller,
 
 	exp = NULL;
 	for (i = 0; !exp && i < MCL_MAXTYPES; i++)
-		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
-			if (strcmp(path, exp->m_export.e_path))
-				continue;
+		for (exp = export_first_by_path(i, path); exp;
+		     exp = export_next_by_path(exp)) {
 			if (!client_matches(exp, my_client.m_hostname, ai))
 				continue;
 			if (exp->m_export.e_flags & NFSEXP_V4ROOT)
@@ -253,7 +455,7 @@ auth_authenticate(const char *what, const struct sockaddr *caller,
 	epath[sizeof (epath) - 1] = '\0';
 	auth_fixpath(epath); /* strip duplicate '/' etc */
 
-	ai = client_resolve(caller);
+	ai = auth_resolve(caller);
 	if (ai == NULL)
 		return exp;
 
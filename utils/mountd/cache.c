@@ -12,9 +12,9 @@
 #endif
 
 #include <sys/types.h>
-#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
+#include <sys/poll.h>
 #include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -25,13 +25,18 @@
 #include <pwd.h>
 #include <grp.h>
 #include <mntent.h>
+#include <pthread.h>
+#include <signal.h>
 #include "misc.h"
 #include "nfslib.h"
+#include "rpcmisc.h"
 #include "exportfs.h"
 #include "mountd.h"
 #include "fsloc.h"
 #include "pseudoflavors.h"
 #include "xcommon.h"
+#include "hashtable.h"
+#include "latency.h"
 
 #ifdef USE_BLKID
 #include "blkid/blkid.h"
@@ -40,8 +45,8 @@
 /*
  * Invoked by RPC service loop
  */
-void	cache_set_fds(fd_set *fdset);
-int	cache_process_req(fd_set *readfds);
+void	cache_watch_fds(void);
+int	cache_process_req(int fd);
 
 enum nfsd_fsid {
 	FSID_DEV = 0,
@@ -64,11 +69,62 @@ enum nfsd_fsid {
  */
 static int cache_export_ent(char *buf, int buflen, char *domain, struct exportent *exp, char *path);
 
-#define INITIAL_MANAGED_GROUPS 100
 
 extern int use_ipaddr;
 
-static void auth_unix_ip(int f)
+static void auth_unix_ip_reply(int f, char *ipaddr, char *client)
+{
+	char buf[RPC_CHAN_BUF_SIZE], *bp = buf;
+	int blen = sizeof(buf);
+
+	qword_add(&bp, &blen, "nfsd");
+	qword_add(&bp, &blen, ipaddr);
+	qword_adduint(&bp, &blen, time(0) + DEFAULT_TTL);
+	if (use_ipaddr) {
+		memmove(ipaddr + 1, ipaddr, strlen(ipaddr) + 1);
+		ipaddr[0] = '$';
+		qword_add(&bp, &blen, ipaddr);
+	} else if (client)
+		qword_add(&bp, &blen, *client?client:"DEFAULT");
+	qword_addeol(&bp, &blen);
+	if (blen <= 0 || cache_write(f, buf, bp - buf) != bp - buf)
+		xlog(L_ERROR, "auth_unix_ip: error writing reply");
+
+	xlog(D_CALL, "auth_unix_ip: client %p '%s'", client, client?client: "DEFAULT");
+}
+
+/* An auth.unix.ip upcall waiting for its address to be resolved */
+struct ip_upcall {
+	int			u_fd;
+	char			u_ipaddr[INET6_ADDRSTRLEN + 1];
+	struct sockaddr_storage	u_addr;
+};
+
+static void auth_unix_ip_resolved(struct addrinfo *ai, void *data)
+{
+	struct ip_upcall *up = data;
+	char *client = NULL;
+
+	/* This may run on a resolver thread.  It must not reload: a
+	 * reload waits for every reader, and a reader may be waiting
+	 * for this thread's next lookup.  A newer etab is picked up
+	 * by the next upcall. */
+	auth_read_lock();
+	if (ai == NULL)
+		ai = host_numeric_addrinfo((struct sockaddr *)&up->u_addr);
+	if (ai) {
+		auth_prepare(ai);
+		client = client_compose(ai);
+		freeaddrinfo(ai);
+	}
+	auth_unix_ip_reply(up->u_fd, up->u_ipaddr, client);
+	auth_read_unlock();
+
+	free(client);
+	free(up);
+}
+
+static void auth_unix_ip(int f, char *buf, int UNUSED(blen))
 {
 	/* requests are
 	 *  class IP-ADDR
@@ -79,14 +135,10 @@ static void auth_unix_ip(int f)
 	 */
 	char class[20];
 	char ipaddr[INET6_ADDRSTRLEN + 1];
-	char *client = NULL;
+	struct ip_upcall *up;
 	struct addrinfo *tmp = NULL;
-	char buf[RPC_CHAN_BUF_SIZE], *bp;
-	int blen;
-
-	blen = read(f, buf, sizeof(buf));
-	if (blen <= 0 || buf[blen-1] != '\n') return;
-	buf[blen-1] = 0;
+	int depth;
+	char *bp;
 
 	xlog(D_CALL, "auth_unix_ip: inbuf '%s'", buf);
 
@@ -105,38 +157,62 @@ static void auth_unix_ip(int f)
 
 	auth_reload();
 
-	/* addr is a valid, interesting address, find the domain name... */
-	if (!use_ipaddr) {
-		struct addrinfo *ai = NULL;
+	/* addr is a valid, interesting address, find the domain name.
+	 * A slow reverse lookup must not hold up other upcalls, so the
+	 * reply may be written later, once the lookup completes. */
+	up = NULL;
+	if (!use_ipaddr)
+		up = malloc(sizeof(*up));
+	if (up) {
+		up->u_fd = f;
+		strcpy(up->u_ipaddr, ipaddr);
+		memcpy(&up->u_addr, tmp->ai_addr, tmp->ai_addrlen);
+		if (clientlist[MCL_WILDCARD] || clientlist[MCL_NETGROUP]) {
+			/* A cached or in-place lookup answers before
+			 * this returns, and takes the table itself */
+			depth = auth_read_suspend();
+			host_reliable_addrinfo_async(tmp->ai_addr,
+					auth_unix_ip_resolved, up);
+			auth_read_resume(depth);
+		} else
+			auth_unix_ip_resolved(NULL, up);
+	} else
+		auth_unix_ip_reply(f, ipaddr, NULL);
 
-		ai = client_resolve(tmp->ai_addr);
-		if (ai) {
-			client = client_compose(ai);
-			freeaddrinfo(ai);
-		}
-	}
-	bp = buf; blen = sizeof(buf);
-	qword_add(&bp, &blen, "nfsd");
-	qword_add(&bp, &blen, ipaddr);
-	qword_adduint(&bp, &blen, time(0) + DEFAULT_TTL);
-	if (use_ipaddr) {
-		memmove(ipaddr + 1, ipaddr, strlen(ipaddr) + 1);
-		ipaddr[0] = '$';
-		qword_add(&bp, &blen, ipaddr);
-	} else if (client)
-		qword_add(&bp, &blen, *client?client:"DEFAULT");
-	qword_addeol(&bp, &blen);
-	if (blen <= 0 || write(f, buf, bp - buf) != bp - buf)
-		xlog(L_ERROR, "auth_unix_ip: error writing reply");
+	freeaddrinfo(tmp);
+}
 
-	xlog(D_CALL, "auth_unix_ip: client %p '%s'", client, client?client: "DEFAULT");
+static void auth_unix_gid_reply(uid_t uid, const gid_t *groups, int ngroups,
+				time_t fetched, void *data)
+{
+	int f = (int)(intptr_t)data;
+	char *buf, *bp;
+	int blen, i;
 
-	free(client);
-	freeaddrinfo(tmp);
+	buf = malloc(RPC_CHAN_BUF_SIZE);
+	if (buf == NULL)
+		return;
+	/* Longer lists are cut short rather than not answered at
+	 * all; gid_cache_lookup() has warned about them */
+	if (ngroups > AUTH_UNIX_GID_MAX)
+		ngroups = AUTH_UNIX_GID_MAX;
 
+	bp = buf; blen = RPC_CHAN_BUF_SIZE;
+	qword_adduint(&bp, &blen, uid);
+	qword_adduint(&bp, &blen, fetched + DEFAULT_TTL);
+	if (ngroups >= 0) {
+		qword_adduint(&bp, &blen, ngroups);
+		for (i=0; i<ngroups; i++)
+			qword_adduint(&bp, &blen, groups[i]);
+	} else
+		qword_adduint(&bp, &blen, 0);
+	qword_addeol(&bp, &blen);
+	if (blen <= 0 || cache_write(f, buf, bp - buf) != bp - buf)
+		xlog(L_ERROR, "auth_unix_gid: error writing reply");
+	free(buf);
 }
 
-static void auth_unix_gid(int f)
+static void auth_unix_gid(int f, char *buf, int UNUSED(blen))
 {
 	/* Request are
 	 *  uid
@@ -144,94 +220,50 @@ static void auth_unix_gid(int f)
 	 *  uid expiry count list of group ids
 	 */
 	uid_t uid;
-	struct passwd *pw;
-	static gid_t *groups = NULL;
-	static int groups_len = 0;
-	gid_t *more_groups;
-	int ngroups;
-	int rv, i;
-	char buf[RPC_CHAN_BUF_SIZE], *bp;
-	int blen;
-
-	if (groups_len == 0) {
-		groups = malloc(sizeof(gid_t) * INITIAL_MANAGED_GROUPS);
-		if (!groups)
-			return;
-
-		groups_len = INITIAL_MANAGED_GROUPS;
-	}
-
-	ngroups = groups_len;
-
-	blen = read(f, buf, sizeof(buf));
-	if (blen <= 0 || buf[blen-1] != '\n') return;
-	buf[blen-1] = 0;
+	char *bp;
 
 	bp = buf;
 	if (qword_get_uint(&bp, &uid) != 0)
 		return;
 
-	pw = getpwuid(uid);
-	if (!pw)
-		rv = -1;
-	else {
-		rv = getgrouplist(pw->pw_name, pw->pw_gid, groups, &ngroups);
-		if (rv == -1 && ngroups >= groups_len) {
-			more_groups = realloc(groups, sizeof(gid_t)*ngroups);
-			if (!more_groups)
-				rv = -1;
-			else {
-				groups = more_groups;
-				groups_len = ngroups;
-				rv = getgrouplist(pw->pw_name, pw->pw_gid,
-						  groups, &ngroups);
-			}
-		}
-	}
-
-	bp = buf; blen = sizeof(buf);
-	qword_adduint(&bp, &blen, uid);
-	qword_adduint(&bp, &blen, time(0) + DEFAULT_TTL);
-	if (rv >= 0) {
-		qword_adduint(&bp, &blen, ngroups);
-		for (i=0; i<ngroups; i++)
-			qword_adduint(&bp, &blen, groups[i]);
-	} else
-		qword_adduint(&bp, &blen, 0);
-	qword_addeol(&bp, &blen);
-	if (blen <= 0 || write(f, buf, bp - buf) != bp - buf)
-		xlog(L_ERROR, "auth_unix_gid: error writing reply");
+	/* The reply may be written later, from a lookup thread */
+	gid_cache_lookup(uid, auth_unix_gid_reply, (void *)(intptr_t)f);
 }
 
 #if USE_BLKID
-static const char *get_uuid_blkdev(char *path)
+static pthread_mutex_t blkid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *get_uuid_blkdev(dev_t devno, char *buf, size_t buflen)
 {
 	/* We set *safe if we know that we need the
 	 * fsid from statfs too.
 	 */
 	static blkid_cache cache = NULL;
-	struct stat stb;
 	char *devname;
 	blkid_tag_iterate iter;
 	blkid_dev dev;
 	const char *type;
 	const char *val, *uuid = NULL;
+	uint64_t start;
+
+	start = latency_start();
 
+	/* The blkid cache is not thread safe, and the tag values
+	 * live in it, so copy the uuid out before letting go. */
+	pthread_mutex_lock(&blkid_lock);
 	if (cache == NULL)
 		blkid_get_cache(&cache, NULL);
 
-	if (stat(path, &stb) != 0)
-		return NULL;
-	devname = blkid_devno_to_devname(stb.st_dev);
+	devname = blkid_devno_to_devname(devno);
 	if (!devname)
-		return NULL;
+		goto out;
 	dev = blkid_get_dev(cache, devname, BLKID_DEV_NORMAL);
 	free(devname);
 	if (!dev)
-		return NULL;
+		goto out;
 	iter = blkid_tag_iterate_begin(dev);
 	if (!iter)
-		return NULL;
+		goto out;
 	while (blkid_tag_next(iter, &type, &val) == 0) {
 		if (strcmp(type, "UUID") == 0)
 			uuid = val;
@@ -241,11 +273,23 @@ static const char *get_uuid_blkdev(char *path)
 			break;
 		}
 	}
+	if (uuid) {
+		strncpy(buf, uuid, buflen - 1);
+		buf[buflen - 1] = '\0';
+		uuid = buf;
+	}
 	blkid_tag_iterate_end(iter);
+out:
+	pthread_mutex_unlock(&blkid_lock);
+	latency_record(LAT_BLKID, start);
 	return uuid;
 }
 #else
-#define get_uuid_blkdev(path) (NULL)
+static const char *get_uuid_blkdev(dev_t UNUSED(devno), char *UNUSED(buf),
+				   size_t UNUSED(buflen))
+{
+	return NULL;
+}
 #endif
 
 static int get_uuid(const char *val, size_t uuidlen, char *u)
@@ -299,6 +343,169 @@ static const long int nonblkid_filesystems[] = {
     0        /* last */
 };
 
+static int mountinfo_fd = -1;
+static unsigned int mount_gen;
+static pthread_mutex_t mount_gen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns a number that changes whenever the mount table does.
+ * Reading the table isn't needed: poll(2) on mountinfo reports
+ * POLLPRI once for each change made since the last poll.
+ */
+static unsigned int mount_table_gen(void)
+{
+	struct pollfd pfd;
+	unsigned int gen;
+
+	pthread_mutex_lock(&mount_gen_lock);
+	if (mountinfo_fd < 0) {
+		mountinfo_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+		if (mountinfo_fd < 0)
+			mount_gen++;	/* can't tell, so trust nothing */
+	} else {
+		pfd.fd = mountinfo_fd;
+		pfd.events = POLLPRI;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) > 0 &&
+		    (pfd.revents & (POLLPRI | POLLERR)))
+			mount_gen++;
+	}
+	gen = mount_gen;
+	pthread_mutex_unlock(&mount_gen_lock);
+	return gen;
+}
+
+/*
+ * What statfs64 and blkid say about each mounted filesystem, keyed
+ * by device number.  Probing can be slow, and can wake up disks that
+ * have spun down, so each filesystem is probed once while it stays
+ * mounted.  Everything is forgotten whenever the mount table changes,
+ * as a device number may then name a different filesystem.
+ */
+struct fs_ident {
+	struct hash_node	i_node;
+	struct fs_ident *	i_next;
+	dev_t			i_dev;
+	int			i_blkid_probed;
+	char			i_blkid[64];	/* empty if none */
+	char			i_fsid[17];	/* empty if none */
+};
+
+static struct hash_table fs_ident_cache = HASH_TABLE_INIT;
+static struct fs_ident *fs_ident_list;
+static unsigned int fs_ident_gen;
+static pthread_mutex_t fs_ident_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fsid_keys_stale;
+
+static unsigned int fs_ident_hash(dev_t dev)
+{
+	return hash_bytes(&dev, sizeof(dev));
+}
+
+static struct fs_ident *fs_ident_find(dev_t dev)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&fs_ident_cache, fs_ident_hash(dev)); n;
+	     n = hash_lookup_next(n)) {
+		struct fs_ident *id = hash_entry(n, struct fs_ident, i_node);
+
+		if (id->i_dev == dev)
+			return id;
+	}
+	return NULL;
+}
+
+/*
+ * Forget every filesystem if the mount table has changed.  The fsid
+ * index is rebuilt too, as export roots may now be on other
+ * filesystems.
+ */
+static void fs_ident_check(void)
+{
+	unsigned int gen = mount_table_gen();
+	struct fs_ident *id;
+
+	pthread_mutex_lock(&fs_ident_lock);
+	if (gen != fs_ident_gen) {
+		while ((id = fs_ident_list) != NULL) {
+			fs_ident_list = id->i_next;
+			free(id);
+		}
+		hash_clear(&fs_ident_cache);
+		fs_ident_gen = gen;
+		__atomic_store_n(&fsid_keys_stale, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&fs_ident_lock);
+}
+
+static int fs_ident_probe_blkid(long f_type)
+{
+	const long int *bad;
+
+	for (bad = nonblkid_filesystems; *bad; bad++)
+		if (*bad == f_type)
+			return 0;
+	return 1;
+}
+
+/*
+ * Fill in @ident for the filesystem with device number @dev that is
+ * mounted at or above @path.  Without @want_blkid, libblkid is left
+ * alone.  Returns zero, or -1 if statfs64 fails.
+ */
+static int fs_ident_get(char *path, dev_t dev, int want_blkid,
+			struct fs_ident *ident)
+{
+	struct fs_ident *id;
+	struct statfs64 st;
+	const char *val;
+
+	fs_ident_check();
+
+	pthread_mutex_lock(&fs_ident_lock);
+	id = fs_ident_find(dev);
+	if (id && (id->i_blkid_probed || !want_blkid)) {
+		*ident = *id;
+		pthread_mutex_unlock(&fs_ident_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&fs_ident_lock);
+
+	/* Probe without the lock; another thread may race us to it */
+	memset(ident, 0, sizeof(*ident));
+	ident->i_dev = dev;
+	if (statfs64(path, &st) != 0)
+		return -1;
+	if (st.f_fsid.__val[0] || st.f_fsid.__val[1])
+		snprintf(ident->i_fsid, sizeof(ident->i_fsid), "%08x%08x",
+			 st.f_fsid.__val[0], st.f_fsid.__val[1]);
+	if (want_blkid) {
+		ident->i_blkid_probed = 1;
+		if (fs_ident_probe_blkid(st.f_type)) {
+			val = get_uuid_blkdev(dev, ident->i_blkid,
+					      sizeof(ident->i_blkid));
+			if (val == NULL)
+				ident->i_blkid[0] = '\0';
+		}
+	}
+
+	pthread_mutex_lock(&fs_ident_lock);
+	id = fs_ident_find(dev);
+	if (id == NULL) {
+		id = xmalloc(sizeof(*id));
+		*id = *ident;
+		id->i_next = fs_ident_list;
+		fs_ident_list = id;
+		hash_insert(&fs_ident_cache, &id->i_node, fs_ident_hash(dev));
+	} else if (!id->i_blkid_probed && ident->i_blkid_probed) {
+		id->i_blkid_probed = 1;
+		strcpy(id->i_blkid, ident->i_blkid);
+	}
+	pthread_mutex_unlock(&fs_ident_lock);
+	return 0;
+}
+
 static int uuid_by_path(char *path, int type, size_t uuidlen, char *uuid)
 {
 	/* get a uuid for the filesystem found at 'path'.
@@ -328,34 +535,25 @@ static int uuid_by_path(char *path, int type, size_t uuidlen, char *uuid)
 	 * a uuid for filesystems where the statfs64 uuid is better.
 	 *
 	 */
-	struct statfs64 st;
-	char fsid_val[17];
+	struct fs_ident ident;
+	struct stat stb;
 	const char *blkid_val = NULL;
+	const char *fsid_val = NULL;
 	const char *val;
-	int rc;
 
-	rc = statfs64(path, &st);
-
-	if (type == 0 && rc == 0) {
-		const long int *bad;
-		for (bad = nonblkid_filesystems; *bad; bad++) {
-			if (*bad == st.f_type)
-				break;
-		}
-		if (*bad == 0)
-			blkid_val = get_uuid_blkdev(path);
-	}
+	if (stat(path, &stb) != 0)
+		return 0;
+	if (fs_ident_get(path, stb.st_dev, type == 0, &ident) != 0)
+		return 0;
 
-	if (rc == 0 &&
-	    (st.f_fsid.__val[0] || st.f_fsid.__val[1]))
-		snprintf(fsid_val, 17, "%08x%08x",
-			 st.f_fsid.__val[0], st.f_fsid.__val[1]);
-	else
-		fsid_val[0] = 0;
+	if (type == 0 && ident.i_blkid[0])
+		blkid_val = ident.i_blkid;
+	if (ident.i_fsid[0])
+		fsid_val = ident.i_fsid;
 
 	if (blkid_val && (type--) == 0)
 		val = blkid_val;
-	else if (fsid_val[0] && (type--) == 0)
+	else if (fsid_val && (type--) == 0)
 		val = fsid_val;
 	else
 		return 0;
@@ -364,29 +562,176 @@ static int uuid_by_path(char *path, int type, size_t uuidlen, char *uuid)
 	return 1;
 }
 
-/* Iterate through /etc/mtab, finding mountpoints
- * at or below a given path
+/*
+ * The mount table, sorted by mount point so that the mounts below a
+ * given directory are next to each other.  It is read again only
+ * after the mount table changes.
  */
-static char *next_mnt(void **v, char *p)
+struct mnt_ent {
+	char *		m_dir;
+	unsigned int	m_seq;		/* position in /etc/mtab */
+};
+
+struct mnt_iter {
+	char **		i_dirs;
+	unsigned int	i_count;
+	unsigned int	i_next;
+};
+
+static struct mnt_ent *mnt_table;
+static unsigned int mnt_count;
+static unsigned int mnt_table_gen;
+static int mnt_table_valid;
+static pthread_mutex_t mnt_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int mnt_ent_cmp_dir(const void *a, const void *b)
 {
-	FILE *f;
+	const struct mnt_ent *ma = a, *mb = b;
+	int c = strcmp(ma->m_dir, mb->m_dir);
+
+	if (c)
+		return c;
+	return ma->m_seq < mb->m_seq ? -1 : ma->m_seq > mb->m_seq;
+}
+
+static int mnt_ent_cmp_seq(const void *a, const void *b)
+{
+	const struct mnt_ent *ma = a, *mb = b;
+
+	return ma->m_seq < mb->m_seq ? -1 : ma->m_seq > mb->m_seq;
+}
+
+/* Called with mnt_table_lock held */
+static void mnt_table_refresh(void)
+{
+	unsigned int gen = mount_table_gen();
+	unsigned int size = 0;
 	struct mntent *me;
+	FILE *f;
+
+	if (mnt_table_valid && gen == mnt_table_gen)
+		return;
+
+	while (mnt_count)
+		free(mnt_table[--mnt_count].m_dir);
+	free(mnt_table);
+	mnt_table = NULL;
+	mnt_table_valid = 0;
+
+	f = setmntent("/etc/mtab", "r");
+	if (f == NULL)
+		return;
+	while ((me = getmntent(f)) != NULL) {
+		if (mnt_count == size) {
+			size = size ? size << 1 : 64;
+			mnt_table = xrealloc(mnt_table,
+					size * sizeof(*mnt_table));
+		}
+		mnt_table[mnt_count].m_dir = xstrdup(me->mnt_dir);
+		mnt_table[mnt_count].m_seq = mnt_count;
+		mnt_count++;
+	}
+	endmntent(f);
+
+	qsort(mnt_table, mnt_count, sizeof(*mnt_table), mnt_ent_cmp_dir);
+	mnt_table_gen = gen;
+	mnt_table_valid = 1;
+}
+
+/* Index of the first mount point not sorting before @key */
+static unsigned int mnt_table_lower_bound(const char *key)
+{
+	unsigned int lo = 0, hi = mnt_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(mnt_table[mid].m_dir, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Copy out the mount points strictly below @p, in /etc/mtab order.
+ * For "/", that is every mount point.
+ */
+static struct mnt_iter *mnt_iter_start(char *p)
+{
 	size_t l = strlen(p);
-	if (*v == NULL) {
-		f = setmntent("/etc/mtab", "r");
-		*v = f;
-	} else
-		f = *v;
-	while ((me = getmntent(f)) != NULL && l > 1 &&
-	       (strncmp(me->mnt_dir, p, l) != 0 ||
-		me->mnt_dir[l] != '/'))
-		;
-	if (me == NULL) {
-		endmntent(f);
+	struct mnt_ent *found;
+	struct mnt_iter *it;
+	unsigned int first, last, i;
+	char *key;
+
+	pthread_mutex_lock(&mnt_table_lock);
+	mnt_table_refresh();
+	if (l > 1) {
+		key = xmalloc(l + 2);
+		memcpy(key, p, l);
+		key[l] = '/';
+		key[l + 1] = '\0';
+		first = mnt_table_lower_bound(key);
+		for (last = first; last < mnt_count; last++)
+			if (strncmp(mnt_table[last].m_dir, key, l + 1) != 0)
+				break;
+		free(key);
+	} else {
+		first = 0;
+		last = mnt_count;
+	}
+	if (first == last) {
+		pthread_mutex_unlock(&mnt_table_lock);
+		return NULL;
+	}
+
+	found = xmalloc((last - first) * sizeof(*found));
+	memcpy(found, mnt_table + first, (last - first) * sizeof(*found));
+	it = xmalloc(sizeof(*it));
+	it->i_count = last - first;
+	it->i_next = 0;
+	it->i_dirs = xmalloc(it->i_count * sizeof(*it->i_dirs));
+	qsort(found, it->i_count, sizeof(*found), mnt_ent_cmp_seq);
+	for (i = 0; i < it->i_count; i++)
+		it->i_dirs[i] = xstrdup(found[i].m_dir);
+	pthread_mutex_unlock(&mnt_table_lock);
+	free(found);
+	return it;
+}
+
+static void mnt_iter_end(void *v)
+{
+	struct mnt_iter *it = v;
+	unsigned int i;
+
+	if (it == NULL)
+		return;
+	for (i = 0; i < it->i_count; i++)
+		free(it->i_dirs[i]);
+	free(it->i_dirs);
+	free(it);
+}
+
+/* Iterate through the mount table, finding mountpoints
+ * below a given path
+ */
+static char *next_mnt(void **v, char *p)
+{
+	struct mnt_iter *it = *v;
+
+	if (it == NULL) {
+		it = mnt_iter_start(p);
+		if (it == NULL)
+			return NULL;
+		*v = it;
+	}
+	if (it->i_next == it->i_count) {
+		mnt_iter_end(it);
 		*v = NULL;
 		return NULL;
 	}
-	return me->mnt_dir;
+	return it->i_dirs[it->i_next++];
 }
 
 /* same_path() check is two paths refer to the same directory.
@@ -398,7 +743,8 @@ static char *next_mnt(void **v, char *p)
  * we ask the kernel if they are the same thing.
  * By preference we use name_to_handle_at(), as the mntid it returns
  * will distinguish between bind-mount points.  If that isn't available
- * we fall back on lstat, which is usually good enough.
+ * we fall back on lstat, which is usually good enough.  Either way the
+ * answers are cached, see path_ident_get().
  */
 static inline int count_slashes(char *p)
 {
@@ -409,10 +755,208 @@ static inline int count_slashes(char *p)
 	return cnt;
 }
 
+/*
+ * What name_to_handle_at() or lstat() said about a path.  The same
+ * export paths are compared over and over, so results, including
+ * failures, are kept until the mount table or the export table
+ * changes.  An upcall trusts an entry that was checked since the
+ * upcall began; otherwise lstat() tells whether the path still names
+ * the same inode, so a directory renamed away and replaced, or a
+ * missing path since created, is probed again.  Each path costs at
+ * most one lstat() per upcall however often it is compared.
+ */
+#define PATH_IDENT_MAX		4096
+#define PATH_IDENT_HANDLE	1
+#define PATH_IDENT_STAT		2
+
+struct path_ident {
+	struct hash_node	p_node;
+	struct path_ident *	p_next;
+	char *			p_path;
+	int			p_kind;		/* zero if the lookup failed */
+	int			p_mnt;
+	int			p_handle_type;
+	unsigned int		p_handle_bytes;
+	unsigned char		p_handle[128];
+	dev_t			p_dev;
+	ino_t			p_ino;
+	struct timespec		p_ctime;
+	unsigned long		p_checked;	/* path_ident_clock then */
+};
+
+static struct hash_table path_ident_cache = HASH_TABLE_INIT;
+static struct path_ident *path_ident_list;
+static unsigned int path_ident_gen;
+static int path_no_handles;
+static pthread_mutex_t path_ident_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Ticks once per upcall; an upcall's epoch is its tick, or zero */
+static unsigned long path_ident_clock;
+static __thread unsigned long path_ident_epoch;
+
+/* Called with path_ident_lock held */
+static void path_ident_flush(void)
+{
+	struct path_ident *pi;
+
+	while ((pi = path_ident_list) != NULL) {
+		path_ident_list = pi->p_next;
+		free(pi->p_path);
+		free(pi);
+	}
+	hash_clear(&path_ident_cache);
+}
+
+/*
+ * Start an upcall: forget all paths if the mount table has changed,
+ * and have entries checked before now checked again.
+ */
+static void path_ident_begin(void)
+{
+	unsigned int gen = mount_table_gen();
+
+	pthread_mutex_lock(&path_ident_lock);
+	if (gen != path_ident_gen) {
+		path_ident_flush();
+		path_ident_gen = gen;
+	}
+	pthread_mutex_unlock(&path_ident_lock);
+	path_ident_epoch = __atomic_add_fetch(&path_ident_clock, 1,
+					      __ATOMIC_RELAXED);
+}
+
+/* Outside an upcall, every entry is checked before it is used */
+static void path_ident_end(void)
+{
+	path_ident_epoch = 0;
+}
+
+/* Called with path_ident_lock held */
+static struct path_ident *path_ident_find(const char *path, unsigned int hash)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&path_ident_cache, hash); n;
+	     n = hash_lookup_next(n)) {
+		struct path_ident *pi =
+			hash_entry(n, struct path_ident, p_node);
+
+		if (strcmp(pi->p_path, path) == 0)
+			return pi;
+	}
+	return NULL;
+}
+
+static void path_ident_probe(const char *path, const struct stat *stb,
+			     struct path_ident *pi)
+{
+	pi->p_kind = 0;
+	pi->p_dev = stb->st_dev;
+	pi->p_ino = stb->st_ino;
+	pi->p_ctime = stb->st_ctim;
+#if HAVE_NAME_TO_HANDLE_AT
+	if (!path_no_handles) {
+		struct {
+			struct file_handle fh;
+			unsigned char handle[128];
+		} fh;
+
+		fh.fh.handle_bytes = sizeof(fh.handle);
+		if (name_to_handle_at(AT_FDCWD, path, &fh.fh,
+				      &pi->p_mnt, 0) == 0) {
+			pi->p_kind = PATH_IDENT_HANDLE;
+			pi->p_handle_type = fh.fh.handle_type;
+			pi->p_handle_bytes = fh.fh.handle_bytes;
+			memcpy(pi->p_handle, fh.handle, fh.fh.handle_bytes);
+			return;
+		}
+		if (errno != ENOSYS)
+			return;
+		path_no_handles = 1;
+	}
+#endif
+	/* This is nearly good enough.  However if a directory is
+	 * bind-mounted in two places and both are exported, it
+	 * could give a false positive
+	 */
+	pi->p_kind = PATH_IDENT_STAT;
+}
+
+/* Called with path_ident_lock held */
+static void path_ident_store(const char *path, unsigned int hash,
+			     const struct path_ident *ident)
+{
+	struct path_ident *pi;
+
+	if (path_ident_cache.h_count >= PATH_IDENT_MAX)
+		path_ident_flush();
+	pi = path_ident_find(path, hash);
+	if (pi == NULL) {
+		pi = xmalloc(sizeof(*pi));
+		pi->p_path = xstrdup(path);
+		pi->p_next = path_ident_list;
+		path_ident_list = pi;
+		hash_insert(&path_ident_cache, &pi->p_node, hash);
+	}
+	/* Refresh an entry whose path now names something else */
+	pi->p_kind = ident->p_kind;
+	pi->p_mnt = ident->p_mnt;
+	pi->p_handle_type = ident->p_handle_type;
+	pi->p_handle_bytes = ident->p_handle_bytes;
+	memcpy(pi->p_handle, ident->p_handle, ident->p_handle_bytes);
+	pi->p_dev = ident->p_dev;
+	pi->p_ino = ident->p_ino;
+	pi->p_ctime = ident->p_ctime;
+	pi->p_checked = __atomic_load_n(&path_ident_clock, __ATOMIC_RELAXED);
+}
+
+static void path_ident_get(const char *path, struct path_ident *ident)
+{
+	unsigned int hash = hash_string(path);
+	struct path_ident *pi;
+	struct stat stb;
+	int no_handles;
+
+	pthread_mutex_lock(&path_ident_lock);
+	pi = path_ident_find(path, hash);
+	if (pi != NULL && path_ident_epoch &&
+	    pi->p_checked >= path_ident_epoch) {
+		*ident = *pi;
+		pthread_mutex_unlock(&path_ident_lock);
+		return;
+	}
+	pthread_mutex_unlock(&path_ident_lock);
+
+	memset(ident, 0, sizeof(*ident));
+	no_handles = path_no_handles;
+	if (lstat(path, &stb) == 0) {
+		pthread_mutex_lock(&path_ident_lock);
+		pi = path_ident_find(path, hash);
+		if (pi != NULL && pi->p_kind &&
+		    pi->p_dev == stb.st_dev && pi->p_ino == stb.st_ino &&
+		    pi->p_ctime.tv_sec == stb.st_ctim.tv_sec &&
+		    pi->p_ctime.tv_nsec == stb.st_ctim.tv_nsec) {
+			pi->p_checked = __atomic_load_n(&path_ident_clock,
+							__ATOMIC_RELAXED);
+			*ident = *pi;
+			pthread_mutex_unlock(&path_ident_lock);
+			return;
+		}
+		pthread_mutex_unlock(&path_ident_lock);
+		path_ident_probe(path, &stb, ident);
+	}
+
+	pthread_mutex_lock(&path_ident_lock);
+	/* Handles and lstat results can't be compared */
+	if (path_no_handles != no_handles)
+		path_ident_flush();
+	path_ident_store(path, hash, ident);
+	pthread_mutex_unlock(&path_ident_lock);
+}
+
 static int same_path(char *child, char *parent, int len)
 {
-	static char p[PATH_MAX];
-	struct stat sc, sp;
+	char p[PATH_MAX];
+	struct path_ident ic, ip;
 
 	if (len <= 0)
 		len = strlen(child);
@@ -425,48 +969,21 @@ static int same_path(char *child, char *parent, int len)
 	if (count_slashes(p) != count_slashes(parent))
 		return 0;
 
-#if HAVE_NAME_TO_HANDLE_AT
-	struct {
-		struct file_handle fh;
-		unsigned char handle[128];
-	} fchild, fparent;
-	int mnt_child, mnt_parent;
-
-	fchild.fh.handle_bytes = 128;
-	fparent.fh.handle_bytes = 128;
-	if (name_to_handle_at(AT_FDCWD, p, &fchild.fh, &mnt_child, 0) != 0) {
-		if (errno == ENOSYS)
-			goto fallback;
+	path_ident_get(p, &ic);
+	if (!ic.p_kind)
 		return 0;
-	}
-	if (name_to_handle_at(AT_FDCWD, parent, &fparent.fh, &mnt_parent, 0) != 0)
+	path_ident_get(parent, &ip);
+	if (ip.p_kind != ic.p_kind)
 		return 0;
 
-	if (mnt_child != mnt_parent ||
-	    fchild.fh.handle_bytes != fparent.fh.handle_bytes ||
-	    fchild.fh.handle_type != fparent.fh.handle_type ||
-	    memcmp(fchild.handle, fparent.handle,
-		   fchild.fh.handle_bytes) != 0)
-		return 0;
+	if (ic.p_kind == PATH_IDENT_HANDLE)
+		return ic.p_mnt == ip.p_mnt &&
+		       ic.p_handle_bytes == ip.p_handle_bytes &&
+		       ic.p_handle_type == ip.p_handle_type &&
+		       memcmp(ic.p_handle, ip.p_handle,
+			      ic.p_handle_bytes) == 0;
 
-	return 1;
-fallback:
-#endif
-
-	/* This is nearly good enough.  However if a directory is
-	 * bind-mounted in two places and both are exported, it
-	 * could give a false positive
-	 */
-	if (lstat(p, &sc) != 0)
-		return 0;
-	if (lstat(parent, &sp) != 0)
-		return 0;
-	if (sc.st_dev != sp.st_dev)
-		return 0;
-	if (sc.st_ino != sp.st_ino)
-		return 0;
-
-	return 1;
+	return ic.p_dev == ip.p_dev && ic.p_ino == ip.p_ino;
 }
 
 static int is_subdirectory(char *child, char *parent)
@@ -644,33 +1161,448 @@ static bool match_fsid(struct parsed_fsid *parsed, nfs_export *exp, char *path)
 			if (memcmp(u, parsed->fhuuid, parsed->uuidlen) == 0)
 				return true;
 		}
-		else
-			for (type = 0;
-			     uuid_by_path(path, type, parsed->uuidlen, u);
-			     type++)
-				if (memcmp(u, parsed->fhuuid, parsed->uuidlen) == 0)
-					return true;
+		else
+			for (type = 0;
+			     uuid_by_path(path, type, parsed->uuidlen, u);
+			     type++)
+				if (memcmp(u, parsed->fhuuid, parsed->uuidlen) == 0)
+					return true;
+	}
+	/* Well, unreachable, actually: */
+	return false;
+}
+
+static struct addrinfo *lookup_client_addr(char *dom)
+{
+	struct addrinfo *ret;
+	struct addrinfo *tmp;
+
+	dom++; /* skip initial "$" */
+
+	tmp = host_pton(dom);
+	if (tmp == NULL)
+		return NULL;
+	ret = auth_resolve(tmp->ai_addr);
+	freeaddrinfo(tmp);
+	return ret;
+}
+
+/*
+ * Index of exports by the identifiers that can appear in a filehandle.
+ *
+ * Resolving an fsid used to stat, statfs and probe blkid for every
+ * export on every nfsd.fh upcall.  Instead, compute each export's
+ * fsid number, device/inode pair and uuids once and hash them.  The
+ * index is rebuilt in export list order whenever the table changes,
+ * but each export's identifiers are kept until auth_reload() changes
+ * or removes that export, so only those are looked up again.  A
+ * lookup still runs every candidate through match_fsid(), so a stale
+ * entry can only cost a fallback to the full scan, never a wrong
+ * answer.
+ */
+enum fsid_class {
+	FSIDX_NUM,		/* fsid= number */
+	FSIDX_DEV,		/* major, minor, inode */
+	FSIDX_UUID,		/* uuid of 4, 8 or 16 bytes */
+};
+
+struct fsid_key {
+	int		k_class;
+	unsigned int	k_len;
+	unsigned char	k_data[16];
+};
+
+struct fsid_ent {
+	struct hash_node	f_node;
+	struct fsid_ent *	f_next;
+	nfs_export *		f_exp;
+	struct fsid_key		f_key;
+};
+
+/* The identifiers of one export, in the order they were found */
+struct fsid_keys {
+	struct hash_node	k_node;
+	nfs_export *		k_exp;
+	unsigned int		k_count;
+	unsigned int		k_size;
+	struct fsid_key *	k_keys;
+};
+
+/*
+ * One built index.  Lookups walk it holding only the export table
+ * read lock, so an index that a mount table change retires is freed
+ * by whoever drops the last reference to it, never in place.
+ */
+struct fsid_index {
+	struct hash_table	x_table;
+	struct fsid_ent *	x_entries;
+	unsigned int		x_gen;
+	int			x_refs;		/* under fsid_index_lock */
+};
+
+static struct fsid_index *fsid_index;		/* current, or NULL */
+static struct hash_table fsid_keys_cache = HASH_TABLE_INIT;
+static struct fsid_keys *fsid_keys_building;
+static pthread_mutex_t fsid_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int fsid_key_hash(const struct fsid_key *key)
+{
+	return hash_bytes(key, offsetof(struct fsid_key, k_data) + key->k_len);
+}
+
+static void fsid_key_set(struct fsid_key *key, int class,
+			 const void *data, unsigned int len)
+{
+	memset(key, 0, sizeof(*key));
+	key->k_class = class;
+	key->k_len = len;
+	memcpy(key->k_data, data, len);
+}
+
+static void fsid_key_dev(struct fsid_key *key, unsigned int major,
+			 unsigned int minor, uint64_t inode)
+{
+	unsigned char data[16];
+
+	memcpy(data, &major, 4);
+	memcpy(data + 4, &minor, 4);
+	memcpy(data + 8, &inode, 8);
+	fsid_key_set(key, FSIDX_DEV, data, sizeof(data));
+}
+
+static unsigned int fsid_keys_hash(const nfs_export *exp)
+{
+	return hash_bytes(&exp, sizeof(exp));
+}
+
+static struct fsid_keys *fsid_keys_find(const nfs_export *exp)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&fsid_keys_cache, fsid_keys_hash(exp)); n;
+	     n = hash_lookup_next(n)) {
+		struct fsid_keys *fk = hash_entry(n, struct fsid_keys, k_node);
+
+		if (fk->k_exp == exp)
+			return fk;
+	}
+	return NULL;
+}
+
+static void fsid_keys_free(struct fsid_keys *fk)
+{
+	hash_remove(&fsid_keys_cache, &fk->k_node);
+	free(fk->k_keys);
+	free(fk);
+}
+
+static void fsid_index_add(struct fsid_index *ix, nfs_export *exp,
+			   const struct fsid_key *key)
+{
+	struct fsid_keys *fk = fsid_keys_building;
+	struct fsid_ent *fe;
+	struct hash_node *n;
+	unsigned int hash = fsid_key_hash(key);
+
+	if (fk) {
+		if (fk->k_count == fk->k_size) {
+			fk->k_size = fk->k_size ? fk->k_size << 1 : 4;
+			fk->k_keys = xrealloc(fk->k_keys,
+					fk->k_size * sizeof(*fk->k_keys));
+		}
+		fk->k_keys[fk->k_count++] = *key;
+	}
+
+	/* An export may yield the same uuid from more than one source */
+	for (n = hash_lookup(&ix->x_table, hash); n; n = hash_lookup_next(n)) {
+		fe = hash_entry(n, struct fsid_ent, f_node);
+		if (fe->f_exp == exp && memcmp(&fe->f_key, key, sizeof(*key)) == 0)
+			return;
+	}
+
+	fe = xmalloc(sizeof(*fe));
+	fe->f_exp = exp;
+	fe->f_key = *key;
+	fe->f_next = ix->x_entries;
+	ix->x_entries = fe;
+	hash_insert(&ix->x_table, &fe->f_node, hash);
+}
+
+/* Called with fsid_index_lock held */
+static void fsid_index_drop(struct fsid_index *ix)
+{
+	struct fsid_ent *fe;
+
+	if (--ix->x_refs > 0)
+		return;
+	while ((fe = ix->x_entries) != NULL) {
+		ix->x_entries = fe->f_next;
+		free(fe);
+	}
+	hash_clear(&ix->x_table);
+	free(ix);
+}
+
+/* Called with fsid_index_lock held */
+static void fsid_index_retire(void)
+{
+	if (fsid_index) {
+		fsid_index_drop(fsid_index);
+		fsid_index = NULL;
+	}
+}
+
+static void fsid_index_put(struct fsid_index *ix)
+{
+	if (ix == NULL)
+		return;
+	pthread_mutex_lock(&fsid_index_lock);
+	fsid_index_drop(ix);
+	pthread_mutex_unlock(&fsid_index_lock);
+}
+
+static void fsid_index_probe_export(struct fsid_index *ix, nfs_export *exp)
+{
+	static const size_t uuidlens[] = { 4, 8, 16 };
+	struct exportent *ep = &exp->m_export;
+	struct fsid_key key;
+	struct stat stb;
+	char u[16];
+	size_t i;
+	int type;
+
+	if (ep->e_flags & NFSEXP_FSID) {
+		fsid_key_set(&key, FSIDX_NUM, &ep->e_fsid, sizeof(ep->e_fsid));
+		fsid_index_add(ix, exp, &key);
+	}
+
+	if (stat(ep->e_path, &stb) != 0)
+		return;
+	if (!S_ISDIR(stb.st_mode) && !S_ISREG(stb.st_mode))
+		return;
+
+	fsid_key_dev(&key, major(stb.st_dev), minor(stb.st_dev), stb.st_ino);
+	fsid_index_add(ix, exp, &key);
+
+	for (i = 0; i < sizeof(uuidlens) / sizeof(uuidlens[0]); i++) {
+		if (ep->e_uuid) {
+			get_uuid(ep->e_uuid, uuidlens[i], u);
+			fsid_key_set(&key, FSIDX_UUID, u, uuidlens[i]);
+			fsid_index_add(ix, exp, &key);
+			continue;
+		}
+		for (type = 0; uuid_by_path(ep->e_path, type, uuidlens[i], u);
+		     type++) {
+			fsid_key_set(&key, FSIDX_UUID, u, uuidlens[i]);
+			fsid_index_add(ix, exp, &key);
+		}
+	}
+}
+
+static void fsid_index_add_export(struct fsid_index *ix, nfs_export *exp)
+{
+	struct fsid_keys *fk = fsid_keys_find(exp);
+	unsigned int i;
+
+	if (fk) {
+		for (i = 0; i < fk->k_count; i++)
+			fsid_index_add(ix, exp, &fk->k_keys[i]);
+		return;
+	}
+
+	fk = xmalloc(sizeof(*fk));
+	fk->k_exp = exp;
+	fk->k_count = 0;
+	fk->k_size = 0;
+	fk->k_keys = NULL;
+	fsid_keys_building = fk;
+	fsid_index_probe_export(ix, exp);
+	fsid_keys_building = NULL;
+	hash_insert(&fsid_keys_cache, &fk->k_node, fsid_keys_hash(exp));
+}
+
+/**
+ * cache_forget_export - drop what is known about an export's identity
+ * @exp: export about to be changed or removed
+ *
+ * Called with the export table write lock held.
+ */
+void cache_forget_export(nfs_export *exp)
+{
+	struct fsid_keys *fk;
+
+	pthread_mutex_lock(&fsid_index_lock);
+	fk = fsid_keys_find(exp);
+	if (fk)
+		fsid_keys_free(fk);
+	fsid_index_retire();
+	pthread_mutex_unlock(&fsid_index_lock);
+
+	pthread_mutex_lock(&path_ident_lock);
+	path_ident_flush();
+	pthread_mutex_unlock(&path_ident_lock);
+}
+
+/* Called with fsid_index_lock held */
+static void fsid_keys_forget_all(void)
+{
+	struct fsid_keys *fk;
+	nfs_export *exp;
+	int i;
+
+	for (i = 0; i < MCL_MAXTYPES; i++)
+		for (exp = exportlist[i].p_head; exp; exp = exp->m_next)
+			if ((fk = fsid_keys_find(exp)) != NULL)
+				fsid_keys_free(fk);
+	fsid_index_retire();
+}
+
+/**
+ * cache_forget_exports - drop what is known about every export
+ *
+ * Called with the export table write lock held, before the whole
+ * table is freed.
+ */
+void cache_forget_exports(void)
+{
+	pthread_mutex_lock(&fsid_index_lock);
+	fsid_keys_forget_all();
+	pthread_mutex_unlock(&fsid_index_lock);
+
+	pthread_mutex_lock(&path_ident_lock);
+	path_ident_flush();
+	pthread_mutex_unlock(&path_ident_lock);
+}
+
+/*
+ * Return a reference to the index for export table generation @gen,
+ * building it if needed.  Callers hold the export table read lock,
+ * so every caller that gets here at the same time sees the same
+ * generation, but other threads may still be walking an index that
+ * a mount table change has just retired.  Drop the reference with
+ * fsid_index_put().
+ */
+static struct fsid_index *fsid_index_get(unsigned int gen)
+{
+	struct fsid_index *ix;
+	nfs_export *exp;
+	int i;
+
+	pthread_mutex_lock(&fsid_index_lock);
+	if (__atomic_exchange_n(&fsid_keys_stale, 0, __ATOMIC_RELAXED))
+		fsid_keys_forget_all();
+	if (fsid_index && fsid_index->x_gen != gen)
+		fsid_index_retire();
+
+	if (fsid_index == NULL) {
+		ix = xmalloc(sizeof(*ix));
+		memset(ix, 0, sizeof(*ix));
+		for (i = 0; i < MCL_MAXTYPES; i++)
+			for (exp = exportlist[i].p_head; exp; exp = exp->m_next)
+				fsid_index_add_export(ix, exp);
+		ix->x_gen = gen;
+		ix->x_refs = 1;
+		fsid_index = ix;
+		xlog(D_GENERAL, "fsid index: %u entries", ix->x_table.h_count);
+	}
+	ix = fsid_index;
+	ix->x_refs++;
+	pthread_mutex_unlock(&fsid_index_lock);
+	return ix;
+}
+
+static int fsid_key_from_parsed(const struct parsed_fsid *parsed,
+				struct fsid_key *key)
+{
+	switch (parsed->fsidtype) {
+	case FSID_NUM:
+		fsid_key_set(key, FSIDX_NUM, &parsed->fsidnum,
+			     sizeof(parsed->fsidnum));
+		return 0;
+	case FSID_DEV:
+	case FSID_MAJOR_MINOR:
+	case FSID_ENCODE_DEV:
+		fsid_key_dev(key, parsed->major, parsed->minor, parsed->inode);
+		return 0;
+	case FSID_UUID4_INUM:
+	case FSID_UUID8:
+	case FSID_UUID16:
+	case FSID_UUID16_INUM:
+		fsid_key_set(key, FSIDX_UUID, parsed->fhuuid, parsed->uuidlen);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Fold one matching export into the nfsd_fh() result.  Returns
+ * false if memory ran out.
+ */
+static bool nfsd_fh_choose(nfs_export *exp, char *path, char *dom,
+			   struct exportent **found, char **found_path)
+{
+	if (!*found || subexport(&exp->m_export, *found)) {
+		*found = &exp->m_export;
+		free(*found_path);
+		*found_path = strdup(path);
+		if (*found_path == NULL)
+			return false;
+	} else if (strcmp((*found)->e_path, exp->m_export.e_path) != 0
+		   && !subexport(*found, &exp->m_export))
+	{
+		xlog(L_WARNING, "%s and %s have same filehandle for %s, using first",
+		     *found_path, path, dom);
+	} else {
+		/* same path, if one is V4ROOT, choose the other */
+		if ((*found)->e_flags & NFSEXP_V4ROOT) {
+			*found = &exp->m_export;
+			free(*found_path);
+			*found_path = strdup(path);
+			if (*found_path == NULL)
+				return false;
+		}
 	}
-	/* Well, unreachable, actually: */
-	return false;
+	return true;
 }
 
-static struct addrinfo *lookup_client_addr(char *dom)
+/*
+ * Look the fsid up in the index.  Only export roots are indexed;
+ * crossmount submounts are left to the full scan.
+ */
+static bool nfsd_fh_lookup_index(const struct fsid_index *ix,
+				 struct parsed_fsid *parsed, char *dom,
+				 struct addrinfo *ai, struct exportent **found,
+				 char **found_path)
 {
-	struct addrinfo *ret;
-	struct addrinfo *tmp;
+	struct fsid_key key;
+	struct hash_node *n;
 
-	dom++; /* skip initial "$" */
+	if (fsid_key_from_parsed(parsed, &key) != 0)
+		return true;
 
-	tmp = host_pton(dom);
-	if (tmp == NULL)
-		return NULL;
-	ret = client_resolve(tmp->ai_addr);
-	freeaddrinfo(tmp);
-	return ret;
+	for (n = hash_lookup(&ix->x_table, fsid_key_hash(&key)); n;
+	     n = hash_lookup_next(n)) {
+		struct fsid_ent *fe = hash_entry(n, struct fsid_ent, f_node);
+		nfs_export *exp = fe->f_exp;
+
+		if (memcmp(&fe->f_key, &key, sizeof(key)) != 0)
+			continue;
+		if (!is_ipaddr_client(dom)
+				&& !namelist_client_matches(exp, dom))
+			continue;
+		if (!match_fsid(parsed, exp, exp->m_export.e_path))
+			continue;
+		if (is_ipaddr_client(dom)
+				&& !ipaddr_client_matches(exp, ai))
+			continue;
+		if (!nfsd_fh_choose(exp, exp->m_export.e_path, dom,
+				    found, found_path))
+			return false;
+	}
+	return true;
 }
 
-static void nfsd_fh(int f)
+static void nfsd_fh(int f, char *buf, int blen)
 {
 	/* request are:
 	 *  domain fsidtype fsid
@@ -684,16 +1616,15 @@ static void nfsd_fh(int f)
 	struct parsed_fsid parsed;
 	struct exportent *found = NULL;
 	struct addrinfo *ai = NULL;
+	struct fsid_index *ix = NULL;
 	char *found_path = NULL;
 	nfs_export *exp;
+	nfs_export *prev = NULL;
+	void *mnt = NULL;
+	unsigned int gen;
 	int i;
 	int dev_missing = 0;
-	char buf[RPC_CHAN_BUF_SIZE], *bp;
-	int blen;
-
-	blen = read(f, buf, sizeof(buf));
-	if (blen <= 0 || buf[blen-1] != '\n') return;
-	buf[blen-1] = 0;
+	char *bp;
 
 	xlog(D_CALL, "nfsd_fh: inbuf '%s'", buf);
 
@@ -713,14 +1644,30 @@ static void nfsd_fh(int f)
 	if (parse_fsid(fsidtype, fsidlen, fsid, &parsed))
 		goto out;
 
-	auth_reload();
-
 	if (is_ipaddr_client(dom)) {
 		ai = lookup_client_addr(dom);
 		if (!ai)
 			goto out;
 	}
 
+	/* After the lookup, which may have let go of the table */
+	gen = auth_reload();
+
+	/* Try the fsid index first.  If it has nothing better than a
+	 * V4ROOT pseudo-export, the answer may be a crossmount submount
+	 * or an export whose identity changed since the index was
+	 * built, so fall back to looking at everything.
+	 */
+	fs_ident_check();
+	ix = fsid_index_get(gen);
+	if (!nfsd_fh_lookup_index(ix, &parsed, dom, ai, &found, &found_path))
+		goto out;
+	if (found && !(found->e_flags & NFSEXP_V4ROOT))
+		goto found;
+	found = NULL;
+	free(found_path);
+	found_path = NULL;
+
 	/* Now determine export point for this fsid/domain */
 	for (i=0 ; i < MCL_MAXTYPES; i++) {
 		nfs_export *next_exp;
@@ -728,9 +1675,6 @@ static void nfsd_fh(int f)
 			char *path;
 
 			if (exp->m_export.e_flags & NFSEXP_CROSSMOUNT) {
-				static nfs_export *prev = NULL;
-				static void *mnt = NULL;
-				
 				if (prev == exp) {
 					/* try a submount */
 					path = next_mnt(&mnt, exp->m_export.e_path);
@@ -765,29 +1709,11 @@ static void nfsd_fh(int f)
 			if (is_ipaddr_client(dom)
 					&& !ipaddr_client_matches(exp, ai))
 				continue;
-			if (!found || subexport(&exp->m_export, found)) {
-				found = &exp->m_export;
-				free(found_path);
-				found_path = strdup(path);
-				if (found_path == NULL)
-					goto out;
-			} else if (strcmp(found->e_path, exp->m_export.e_path) != 0
-				   && !subexport(found, &exp->m_export))
-			{
-				xlog(L_WARNING, "%s and %s have same filehandle for %s, using first",
-				     found_path, path, dom);
-			} else {
-				/* same path, if one is V4ROOT, choose the other */
-				if (found->e_flags & NFSEXP_V4ROOT) {
-					found = &exp->m_export;
-					free(found_path);
-					found_path = strdup(path);
-					if (found_path == NULL)
-						goto out;
-				}
-			}
+			if (!nfsd_fh_choose(exp, path, dom, &found, &found_path))
+				goto out;
 		}
 	}
+found:
 	if (found && 
 	    found->e_mountpoint &&
 	    !is_mountpoint(found->e_mountpoint[0]?
@@ -809,10 +1735,10 @@ static void nfsd_fh(int f)
 	}
 
 	if (found)
-		if (cache_export_ent(buf, sizeof(buf), dom, found, found_path) < 0)
+		if (cache_export_ent(buf, RPC_CHAN_BUF_SIZE, dom, found, found_path) < 0)
 			found = 0;
 
-	bp = buf; blen = sizeof(buf);
+	bp = buf; blen = RPC_CHAN_BUF_SIZE;
 	qword_add(&bp, &blen, dom);
 	qword_addint(&bp, &blen, fsidtype);
 	qword_addhex(&bp, &blen, fsid, fsidlen);
@@ -828,9 +1754,11 @@ static void nfsd_fh(int f)
 	if (found)
 		qword_add(&bp, &blen, found_path);
 	qword_addeol(&bp, &blen);
-	if (blen <= 0 || write(f, buf, bp - buf) != bp - buf)
+	if (blen <= 0 || cache_write(f, buf, bp - buf) != bp - buf)
 		xlog(L_ERROR, "nfsd_fh: error writing reply");
 out:
+	fsid_index_put(ix);
+	mnt_iter_end(mnt);
 	if (found_path)
 		free(found_path);
 	freeaddrinfo(ai);
@@ -920,10 +1848,101 @@ static int dump_to_cache(int f, char *buf, int buflen, char *domain,
 		qword_adduint(&bp, &blen, now + ttl);
 	qword_addeol(&bp, &blen);
 	if (blen <= 0) return -1;
-	if (write(f, buf, bp - buf) != bp - buf) return -1;
+	if (cache_write(f, buf, bp - buf) != bp - buf) return -1;
 	return 0;
 }
 
+/*
+ * Fold one export matching @path into the lookup_export() result.
+ */
+static void lookup_export_choose(nfs_export *exp, int type, char *dom,
+				 char *path, nfs_export **found, int *found_type)
+{
+	if (!*found) {
+		*found = exp;
+		*found_type = type;
+		return;
+	}
+	/* Always prefer non-V4ROOT exports */
+	if (exp->m_export.e_flags & NFSEXP_V4ROOT)
+		return;
+	if ((*found)->m_export.e_flags & NFSEXP_V4ROOT) {
+		*found = exp;
+		*found_type = type;
+		return;
+	}
+
+	/* If one is a CROSSMOUNT, then prefer the longest path */
+	if ((((*found)->m_export.e_flags & NFSEXP_CROSSMOUNT) ||
+	     (exp->m_export.e_flags & NFSEXP_CROSSMOUNT)) &&
+	    strlen((*found)->m_export.e_path) !=
+	    strlen(exp->m_export.e_path)) {
+
+		if (strlen(exp->m_export.e_path) >
+		    strlen((*found)->m_export.e_path)) {
+			*found = exp;
+			*found_type = type;
+		}
+		return;
+
+	} else if (*found_type == type) {
+		/* Upcall threads may get here at once under the read lock */
+		int unwarned = 0;
+
+		if (__atomic_compare_exchange_n(&(*found)->m_warned, &unwarned,
+						1, false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			xlog(L_WARNING, "%s exported to both %s and %s, "
+			     "arbitrarily choosing options from first",
+			     path, (*found)->m_client->m_hostname,
+			     exp->m_client->m_hostname, dom);
+	}
+}
+
+/*
+ * Look up @path and each of its parents in the path index.  Only
+ * exports whose path is spelled exactly like @path, or like one of
+ * its parents, are found this way; lookup_export() falls back to
+ * same_path() on every export unless this finds a real export of
+ * @path itself.
+ */
+static nfs_export *
+lookup_export_indexed(char *dom, char *path, struct addrinfo *ai)
+{
+	char prefix[PATH_MAX];
+	nfs_export *exp;
+	nfs_export *found = NULL;
+	int found_type = 0;
+	char *slash;
+	int i;
+
+	if (strlen(path) >= sizeof(prefix))
+		return NULL;
+
+	for (i=0 ; i < MCL_MAXTYPES; i++) {
+		for (exp = export_first_by_path(i, path); exp;
+		     exp = export_next_by_path(exp))
+			if (client_matches(exp, dom, ai))
+				lookup_export_choose(exp, i, dom, path,
+						     &found, &found_type);
+
+		strcpy(prefix, path);
+		while ((slash = strrchr(prefix, '/')) != NULL &&
+		       prefix[1] != '\0') {
+			if (slash == prefix)
+				slash++;
+			*slash = '\0';
+			for (exp = export_first_by_path(i, prefix); exp;
+			     exp = export_next_by_path(exp))
+				if ((exp->m_export.e_flags & NFSEXP_CROSSMOUNT)
+				    && client_matches(exp, dom, ai))
+					lookup_export_choose(exp, i, dom, path,
+							     &found, &found_type);
+		}
+	}
+	return found;
+}
+
 static nfs_export *
 lookup_export(char *dom, char *path, struct addrinfo *ai)
 {
@@ -932,44 +1951,23 @@ lookup_export(char *dom, char *path, struct addrinfo *ai)
 	int found_type = 0;
 	int i;
 
+	/* Only a real export of exactly this path is final.  A V4ROOT
+	 * pseudo-export or a crossmount parent may yet lose to an
+	 * export of the same directory spelled some other way, which
+	 * only same_path() can find.
+	 */
+	found = lookup_export_indexed(dom, path, ai);
+	if (found && !(found->m_export.e_flags & NFSEXP_V4ROOT) &&
+	    strcmp(found->m_export.e_path, path) == 0)
+		return found;
+	found = NULL;
+
 	for (i=0 ; i < MCL_MAXTYPES; i++) {
 		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
 			if (!export_matches(exp, dom, path, ai))
 				continue;
-			if (!found) {
-				found = exp;
-				found_type = i;
-				continue;
-			}
-			/* Always prefer non-V4ROOT exports */
-			if (exp->m_export.e_flags & NFSEXP_V4ROOT)
-				continue;
-			if (found->m_export.e_flags & NFSEXP_V4ROOT) {
-				found = exp;
-				found_type = i;
-				continue;
-			}
-
-			/* If one is a CROSSMOUNT, then prefer the longest path */
-			if (((found->m_export.e_flags & NFSEXP_CROSSMOUNT) ||
-			     (exp->m_export.e_flags & NFSEXP_CROSSMOUNT)) &&
-			    strlen(found->m_export.e_path) !=
-			    strlen(exp->m_export.e_path)) {
-
-				if (strlen(exp->m_export.e_path) >
-				    strlen(found->m_export.e_path)) {
-					found = exp;
-					found_type = i;
-				}
-				continue;
-
-			} else if (found_type == i && found->m_warned == 0) {
-				xlog(L_WARNING, "%s exported to both %s and %s, "
-				     "arbitrarily choosing options from first",
-				     path, found->m_client->m_hostname, exp->m_client->m_hostname,
-				     dom);
-				found->m_warned = 1;
-			}
+			lookup_export_choose(exp, i, dom, path,
+					     &found, &found_type);
 		}
 	}
 	return found;
@@ -1122,7 +2120,7 @@ out_false:
 static struct exportent *create_junction_exportent(struct exportent *parent,
 		const char *junction, const char *fslocdata, int ttl)
 {
-	static struct exportent *eep;
+	struct exportent *eep;
 
 	eep = (struct exportent *)malloc(sizeof(*eep));
 	if (eep == NULL)
@@ -1162,7 +2160,7 @@ static struct exportent *locations_to_export(struct jp_ops *ops,
 		nfs_fsloc_set_t locations, const char *junction,
 		struct exportent *parent)
 {
-	static char fslocdata[BUFSIZ];
+	char fslocdata[BUFSIZ];
 	int ttl;
 
 	fslocdata[0] = '\0';
@@ -1291,7 +2289,7 @@ static void lookup_nonexport(int f, char *buf, int buflen, char *dom, char *path
 }
 #endif	/* !HAVE_NFS_PLUGIN_H */
 
-static void nfsd_export(int f)
+static void nfsd_export(int f, char *buf, int blen)
 {
 	/* requests are:
 	 *  domain path
@@ -1302,12 +2300,7 @@ static void nfsd_export(int f)
 	char *dom, *path;
 	nfs_export *found = NULL;
 	struct addrinfo *ai = NULL;
-	char buf[RPC_CHAN_BUF_SIZE], *bp;
-	int blen;
-
-	blen = read(f, buf, sizeof(buf));
-	if (blen <= 0 || buf[blen-1] != '\n') return;
-	buf[blen-1] = 0;
+	char *bp;
 
 	xlog(D_CALL, "nfsd_export: inbuf '%s'", buf);
 
@@ -1347,17 +2340,17 @@ static void nfsd_export(int f)
 			 * And filehandle for this mountpoint from an earlier
 			 * mount will block in nfsd.fh lookup.
 			 */
-			dump_to_cache(f, buf, sizeof(buf), dom, path,
+			dump_to_cache(f, buf, RPC_CHAN_BUF_SIZE, dom, path,
 				      NULL, 60);
-		else if (dump_to_cache(f, buf, sizeof(buf), dom, path,
+		else if (dump_to_cache(f, buf, RPC_CHAN_BUF_SIZE, dom, path,
 					 &found->m_export, 0) < 0) {
 			xlog(L_WARNING,
 			     "Cannot export %s, possibly unsupported filesystem"
 			     " or fsid= required", path);
-			dump_to_cache(f, buf, sizeof(buf), dom, path, NULL, 0);
+			dump_to_cache(f, buf, RPC_CHAN_BUF_SIZE, dom, path, NULL, 0);
 		}
 	} else
-		lookup_nonexport(f, buf, sizeof(buf), dom, path, ai);
+		lookup_nonexport(f, buf, RPC_CHAN_BUF_SIZE, dom, path, ai);
 
  out:
 	xlog(D_CALL, "nfsd_export: found %p path %s", found, path ? path : NULL);
@@ -1369,18 +2362,107 @@ static void nfsd_export(int f)
 
 struct {
 	char *cache_name;
-	void (*cache_handle)(int f);
+	void (*cache_handle)(int f, char *buf, int blen);
 	int f;
+	enum latency_id cache_stat;
 } cachelist[] = {
-	{ "auth.unix.ip", auth_unix_ip, -1 },
-	{ "auth.unix.gid", auth_unix_gid, -1 },
-	{ "nfsd.export", nfsd_export, -1 },
-	{ "nfsd.fh", nfsd_fh, -1 },
-	{ NULL, NULL, -1 }
+	{ "auth.unix.ip", auth_unix_ip, -1, LAT_CACHE_AUTH_UNIX_IP },
+	{ "auth.unix.gid", auth_unix_gid, -1, LAT_CACHE_AUTH_UNIX_GID },
+	{ "nfsd.export", nfsd_export, -1, LAT_CACHE_NFSD_EXPORT },
+	{ "nfsd.fh", nfsd_fh, -1, LAT_CACHE_NFSD_FH },
+	{ NULL, NULL, -1, LAT_MAX }
 };
 
 extern int manage_gids;
 
+/*
+ * One upcall read from a channel.  The kernel hands out a whole
+ * request per read(2) and takes a whole reply per write(2), so
+ * requests can be answered in any order, from any thread.
+ */
+struct cache_req {
+	struct cache_req *	r_next;
+	int			r_fd;
+	void			(*r_handle)(int f, char *buf, int blen);
+	enum latency_id		r_stat;
+	uint64_t		r_start;	/* when it was read */
+	int			r_len;
+	char			r_buf[RPC_CHAN_BUF_SIZE];
+};
+
+static struct cache_req	*cache_queue;
+static struct cache_req	**cache_queue_tail = &cache_queue;
+static pthread_mutex_t	cache_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	cache_queue_cond = PTHREAD_COND_INITIALIZER;
+static int		cache_nthreads;
+
+static void cache_handle_req(struct cache_req *req)
+{
+	/* Pick up a new etab first: auth_reload() can't
+	 * swap the table while we hold it */
+	auth_reload();
+	path_ident_begin();
+	auth_read_lock();
+	req->r_handle(req->r_fd, req->r_buf, req->r_len);
+	auth_read_unlock();
+	path_ident_end();
+	latency_record(req->r_stat, req->r_start);
+	free(req);
+}
+
+static void *cache_thread(void *UNUSED(arg))
+{
+	struct cache_req *req;
+
+	for (;;) {
+		pthread_mutex_lock(&cache_queue_lock);
+		while (cache_queue == NULL)
+			pthread_cond_wait(&cache_queue_cond, &cache_queue_lock);
+		/* One at a time, so no reply waits for another upcall */
+		req = cache_queue;
+		cache_queue = req->r_next;
+		if (cache_queue == NULL)
+			cache_queue_tail = &cache_queue;
+		pthread_mutex_unlock(&cache_queue_lock);
+
+		cache_handle_req(req);
+	}
+	return NULL;
+}
+
+/**
+ * cache_start_threads - hand kernel cache upcalls to a pool of threads
+ * @nthreads: number of threads to start
+ *
+ * Without a pool, upcalls are handled one at a time in the service
+ * loop, and a slow DNS or netgroup lookup holds up every channel and
+ * every MOUNT request.  Must be called after any fork().
+ */
+void cache_start_threads(int nthreads)
+{
+	sigset_t set, oldset;
+	pthread_t tid;
+	int i;
+
+	/* Signals are for the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tid, NULL, cache_thread, NULL) != 0) {
+			xlog(L_ERROR, "cache_start_threads: "
+			     "cannot create thread: %m");
+			break;
+		}
+		pthread_detach(tid);
+		cache_nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (cache_nthreads)
+		xlog(L_NOTICE, "handling cache upcalls with %d threads",
+		     cache_nthreads);
+}
+
 /**
  * cache_open - prepare communications channels with kernel RPC caches
  *
@@ -1398,35 +2480,96 @@ void cache_open(void)
 }
 
 /**
- * cache_set_fds - prepare cache file descriptors for one iteration of the service loop
- * @fdset: pointer to fd_set to prepare
+ * cache_watch_fds - add the cache file descriptors to the service loop
+ *
  */
-void cache_set_fds(fd_set *fdset)
+void cache_watch_fds(void)
 {
 	int i;
 	for (i=0; cachelist[i].cache_name; i++) {
-		if (cachelist[i].f >= 0)
-			FD_SET(cachelist[i].f, fdset);
+		if (cachelist[i].f >= 0 &&
+		    nfs_svc_epoll_watch(cachelist[i].f) < 0)
+			xlog(L_ERROR, "can't watch %s channel: %m",
+				cachelist[i].cache_name);
+	}
+}
+
+/* Upcalls taken from a channel per wakeup */
+#define CACHE_DRAIN_MAX		64
+
+static void cache_read_req(int i)
+{
+	struct cache_req *req, *reqs = NULL, **tail = &reqs;
+	int blen, n;
+
+	/* Take everything that is waiting, so a burst of upcalls
+	 * costs one trip through the service loop */
+	for (n = 0; n < CACHE_DRAIN_MAX; n++) {
+		req = malloc(sizeof(*req));
+		if (req == NULL) {
+			/* Leave it to be read on the next pass */
+			xlog(L_ERROR, "cache_read_req: no memory");
+			break;
+		}
+
+		blen = cache_read_upcall(cachelist[i].f, req->r_buf,
+					 sizeof(req->r_buf));
+		if (blen <= 0) {
+			free(req);
+			break;
+		}
+		if (req->r_buf[blen-1] != '\n') {
+			free(req);
+			continue;
+		}
+		req->r_buf[blen-1] = 0;
+		req->r_len = blen;
+		req->r_fd = cachelist[i].f;
+		req->r_handle = cachelist[i].cache_handle;
+		req->r_stat = cachelist[i].cache_stat;
+		req->r_start = latency_start();
+		req->r_next = NULL;
+		*tail = req;
+		tail = &req->r_next;
+	}
+	cache_io_count_wakeup();
+	xlog(D_CALL, "cache_read_req: %d %s upcalls", n,
+	     cachelist[i].cache_name);
+
+	if (reqs == NULL)
+		return;
+
+	if (cache_nthreads == 0) {
+		for (; reqs; reqs = req) {
+			req = reqs->r_next;
+			cache_handle_req(reqs);
+		}
+		return;
 	}
+
+	pthread_mutex_lock(&cache_queue_lock);
+	*cache_queue_tail = reqs;
+	cache_queue_tail = tail;
+	pthread_cond_broadcast(&cache_queue_cond);
+	pthread_mutex_unlock(&cache_queue_lock);
 }
 
 /**
- * cache_process_req - process any active cache file descriptors during service loop iteration
- * @fdset: pointer to fd_set to examine for activity
+ * cache_process_req - process a readable descriptor if it is a cache channel
+ * @fd: descriptor reported ready by the service loop
+ *
+ * Returns 1 if @fd was a cache channel, otherwise zero.
  */
-int cache_process_req(fd_set *readfds) 
+int cache_process_req(int fd)
 {
 	int i;
-	int cnt = 0;
 	for (i=0; cachelist[i].cache_name; i++) {
-		if (cachelist[i].f >= 0 &&
-		    FD_ISSET(cachelist[i].f, readfds)) {
-			cnt++;
-			cachelist[i].cache_handle(cachelist[i].f);
-			FD_CLR(cachelist[i].f, readfds);
+		if (cachelist[i].f >= 0 && cachelist[i].f == fd) {
+			cache_read_req(i);
+			return 1;
 		}
 	}
-	return cnt;
+	return 0;
 }
 
 
@@ -1436,11 +2579,40 @@ int cache_process_req(fd_set *readfds)
  * % echo $domain $path $[now+DEFAULT_TTL] $options $anonuid $anongid $fsid > /proc/net/rpc/nfsd.export/channel
  */
 
+/*
+ * Find a descriptor to write to channel @name.  The upcall loop's own
+ * is used if it has one open; otherwise the channel is opened, and
+ * cache_channel_put() closes it again.
+ */
+static int cache_channel_get(const char *name)
+{
+	char path[100];
+	int i;
+
+	for (i=0; cachelist[i].cache_name; i++)
+		if (cachelist[i].f >= 0 &&
+		    strcmp(cachelist[i].cache_name, name) == 0)
+			return cachelist[i].f;
+
+	sprintf(path, "/proc/net/rpc/%s/channel", name);
+	return open(path, O_WRONLY);
+}
+
+static void cache_channel_put(int f)
+{
+	int i;
+
+	for (i=0; cachelist[i].cache_name; i++)
+		if (cachelist[i].f == f)
+			return;
+	close(f);
+}
+
 static int cache_export_ent(char *buf, int buflen, char *domain, struct exportent *exp, char *path)
 {
 	int f, err;
 
-	f = open("/proc/net/rpc/nfsd.export/channel", O_WRONLY);
+	f = cache_channel_get("nfsd.export");
 	if (f < 0) return -1;
 
 	err = dump_to_cache(f, buf, buflen, domain, exp->e_path, exp, 0);
@@ -1490,7 +2662,7 @@ static int cache_export_ent(char *buf, int buflen, char *domain, struct exporten
 		break;
 	}
 
-	close(f);
+	cache_channel_put(f);
 	return err;
 }
 
@@ -1505,7 +2677,7 @@ int cache_export(nfs_export *exp, char *path)
 	char buf[RPC_CHAN_BUF_SIZE], *bp;
 	int blen, f;
 
-	f = open("/proc/net/rpc/auth.unix.ip/channel", O_WRONLY);
+	f = cache_channel_get("auth.unix.ip");
 	if (f < 0)
 		return -1;
 
@@ -1515,13 +2687,95 @@ int cache_export(nfs_export *exp, char *path)
 	qword_adduint(&bp, &blen, time(0) + exp->m_export.e_ttl);
 	qword_add(&bp, &blen, exp->m_client->m_hostname);
 	qword_addeol(&bp, &blen);
-	if (blen <= 0 || write(f, buf, bp - buf) != bp - buf) blen = -1;
-	close(f);
+	if (blen <= 0 || cache_write(f, buf, bp - buf) != bp - buf) blen = -1;
+	cache_channel_put(f);
 	if (blen < 0) return -1;
 
 	return cache_export_ent(buf, sizeof(buf), exp->m_client->m_hostname, &exp->m_export, path);
 }
 
+/**
+ * cache_preseed_client - answer a known client's upcalls in advance
+ * @client: NUL-terminated C string containing the client's IP address
+ * @paths: writable C strings containing paths the client has mounted
+ * @npaths: number of entries in @paths
+ *
+ * Writes the auth.unix.ip entry for @client, and the nfsd.export
+ * entries for each of @paths it may still mount, as answering the
+ * upcalls would have.  Returns the number of paths exported.
+ */
+int cache_preseed_client(const char *client, char **paths, int npaths)
+{
+	char ipaddr[INET6_ADDRSTRLEN + 1];
+	char buf[RPC_CHAN_BUF_SIZE];
+	struct addrinfo *tmp, *ai = NULL;
+	char *dom = NULL;
+	nfs_export *exp;
+	int need_dns, f, i, n = 0;
+
+	tmp = host_pton(client);
+	if (tmp == NULL)
+		return 0;
+	host_ntop(tmp->ai_addr, ipaddr, sizeof(ipaddr) - 1);
+
+	/* As with auth.unix.ip upcalls, don't hold the export
+	 * table while DNS is asked */
+	auth_reload();
+	auth_read_lock();
+	need_dns = !use_ipaddr &&
+		(clientlist[MCL_WILDCARD] || clientlist[MCL_NETGROUP]);
+	auth_read_unlock();
+	if (need_dns)
+		ai = host_reliable_addrinfo(tmp->ai_addr);
+
+	auth_reload();
+	path_ident_begin();
+	auth_read_lock();
+	if (!use_ipaddr) {
+		if (ai == NULL)
+			ai = host_numeric_addrinfo(tmp->ai_addr);
+		if (ai != NULL) {
+			auth_prepare(ai);
+			dom = client_compose(ai);
+		}
+	}
+
+	f = cache_channel_get("auth.unix.ip");
+	if (f < 0)
+		goto out;
+	/* With use_ipaddr, this turns ipaddr into the domain */
+	auth_unix_ip_reply(f, ipaddr, dom);
+	cache_channel_put(f);
+	if (use_ipaddr)
+		dom = strdup(ipaddr);
+	if (dom == NULL)
+		goto out;
+
+	for (i = 0; i < npaths; i++) {
+		char *mp;
+
+		exp = lookup_export(dom, paths[i], use_ipaddr ? tmp : NULL);
+		if (exp == NULL)
+			continue;
+		/* Leave unmounted exports to the upcall */
+		mp = exp->m_export.e_mountpoint;
+		if (mp && !*mp)
+			mp = exp->m_export.e_path;
+		if (mp && !is_mountpoint(mp))
+			continue;
+		if (cache_export_ent(buf, sizeof(buf), dom, &exp->m_export,
+				     paths[i]) == 0)
+			n++;
+	}
+out:
+	auth_read_unlock();
+	path_ident_end();
+	free(dom);
+	freeaddrinfo(ai);
+	freeaddrinfo(tmp);
+	return n;
+}
+
 /**
  * cache_get_filehandle - given an nfs_export, get its root filehandle
  * @exp: target nfs_export
@@ -1569,3 +2823,197 @@ cache_get_filehandle(nfs_export *exp, int len, char *p)
 	fh.fh_size = qword_get(&bp, (char *)fh.fh_handle, NFS3_FHSIZE);
 	return &fh;
 }
+
+/*
+ * MNT requests from autofs clients ask for the same few paths over
+ * and over.  What is learnt about each export's root, and the
+ * filehandles the kernel hands out, are kept until the export table
+ * or the mount table changes.  These are only used by the RPC
+ * service loop, which has the export table read-locked.
+ */
+#define MNT_FH_MAX		4096
+
+struct mnt_root {
+	struct hash_node	r_node;
+	struct mnt_root *	r_next;
+	char *			r_path;
+	char *			r_mountpoint;	/* NULL if not checked */
+	dev_t			r_dev;
+	int			r_mounted;
+};
+
+struct mnt_fh {
+	struct hash_node	m_node;
+	struct mnt_fh *		m_next;
+	char *			m_domain;
+	char *			m_path;
+	int			m_len;
+	dev_t			m_dev;
+	ino_t			m_ino;
+	struct timespec		m_ctime;
+	struct nfs_fh_len	m_fh;
+};
+
+static struct hash_table mnt_root_cache = HASH_TABLE_INIT;
+static struct mnt_root *mnt_root_list;
+static struct hash_table mnt_fh_cache = HASH_TABLE_INIT;
+static struct mnt_fh *mnt_fh_list;
+static unsigned int mnt_cache_etab_gen, mnt_cache_mount_gen;
+
+static void mnt_fh_flush(void)
+{
+	struct mnt_fh *m;
+
+	while ((m = mnt_fh_list) != NULL) {
+		mnt_fh_list = m->m_next;
+		free(m->m_domain);
+		free(m->m_path);
+		free(m);
+	}
+	hash_clear(&mnt_fh_cache);
+}
+
+static void mnt_cache_check(void)
+{
+	unsigned int etab_gen = auth_reload();
+	unsigned int mount_gen = mount_table_gen();
+	struct mnt_root *r;
+
+	if (etab_gen == mnt_cache_etab_gen &&
+	    mount_gen == mnt_cache_mount_gen)
+		return;
+	mnt_cache_etab_gen = etab_gen;
+	mnt_cache_mount_gen = mount_gen;
+
+	while ((r = mnt_root_list) != NULL) {
+		mnt_root_list = r->r_next;
+		free(r->r_path);
+		free(r->r_mountpoint);
+		free(r);
+	}
+	hash_clear(&mnt_root_cache);
+	mnt_fh_flush();
+}
+
+static int mnt_strcmp(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a != b;
+	return strcmp(a, b);
+}
+
+/**
+ * cache_export_root - check the root of an export being mounted
+ * @exp: export found for a MNT request
+ * @dev: filled in with the device number of the export's root
+ * @mounted: set to zero if @exp must be a mount point but isn't
+ *
+ * Returns zero, or -1 with errno set if the root can't be stat'ed.
+ */
+int cache_export_root(nfs_export *exp, dev_t *dev, int *mounted)
+{
+	char *path = exp->m_export.e_path;
+	char *mp = exp->m_export.e_mountpoint;
+	unsigned int hash = hash_string(path);
+	struct mnt_root *r;
+	struct hash_node *n;
+	struct stat stb;
+
+	if (mp && !*mp)
+		mp = path;
+
+	mnt_cache_check();
+	for (n = hash_lookup(&mnt_root_cache, hash); n;
+	     n = hash_lookup_next(n)) {
+		r = hash_entry(n, struct mnt_root, r_node);
+		if (strcmp(r->r_path, path) == 0 &&
+		    mnt_strcmp(r->r_mountpoint, mp) == 0) {
+			*dev = r->r_dev;
+			*mounted = r->r_mounted;
+			return 0;
+		}
+	}
+
+	/* Failures aren't kept: the root may be created at any time */
+	if (stat(path, &stb) < 0)
+		return -1;
+
+	r = xmalloc(sizeof(*r));
+	r->r_path = xstrdup(path);
+	r->r_mountpoint = mp ? xstrdup(mp) : NULL;
+	r->r_dev = stb.st_dev;
+	r->r_mounted = mp ? is_mountpoint(mp) : 1;
+	r->r_next = mnt_root_list;
+	mnt_root_list = r;
+	hash_insert(&mnt_root_cache, &r->r_node, hash);
+
+	*dev = r->r_dev;
+	*mounted = r->r_mounted;
+	return 0;
+}
+
+/**
+ * cache_mount_filehandle - get the filehandle for a MNT reply
+ * @exp: target nfs_export
+ * @len: length of requested file handle
+ * @p: NUL-terminated C string containing the path being mounted
+ * @stb: what stat(2) says about @p
+ *
+ * As cache_export() followed by cache_get_filehandle(), except that
+ * a filehandle already handed to the same client domain for the same
+ * object is reused, without asking the kernel again.
+ */
+struct nfs_fh_len *
+cache_mount_filehandle(nfs_export *exp, int len, char *p,
+		       const struct stat *stb)
+{
+	static struct nfs_fh_len fh;
+	char *domain = exp->m_client->m_hostname;
+	unsigned int hash;
+	struct nfs_fh_len *kfh;
+	struct hash_node *n;
+	struct mnt_fh *m;
+
+	/* The kernel's caches still need the client and the export */
+	if (cache_export(exp, p))
+		return NULL;
+
+	mnt_cache_check();
+	hash = hash_string(p) ^ hash_string(domain) ^ (unsigned int)len;
+	for (n = hash_lookup(&mnt_fh_cache, hash); n; n = hash_lookup_next(n)) {
+		m = hash_entry(n, struct mnt_fh, m_node);
+		if (m->m_len != len || strcmp(m->m_path, p) != 0 ||
+		    strcmp(m->m_domain, domain) != 0)
+			continue;
+		/* Same name, but maybe not the same object */
+		if (m->m_dev != stb->st_dev || m->m_ino != stb->st_ino ||
+		    m->m_ctime.tv_sec != stb->st_ctim.tv_sec ||
+		    m->m_ctime.tv_nsec != stb->st_ctim.tv_nsec)
+			break;
+		fh = m->m_fh;
+		return &fh;
+	}
+
+	kfh = cache_get_filehandle(exp, len, p);
+	if (kfh == NULL)
+		return NULL;
+
+	if (n != NULL) {
+		m = hash_entry(n, struct mnt_fh, m_node);
+	} else {
+		if (mnt_fh_cache.h_count >= MNT_FH_MAX)
+			mnt_fh_flush();
+		m = xmalloc(sizeof(*m));
+		m->m_domain = xstrdup(domain);
+		m->m_path = xstrdup(p);
+		m->m_len = len;
+		m->m_next = mnt_fh_list;
+		mnt_fh_list = m;
+		hash_insert(&mnt_fh_cache, &m->m_node, hash);
+	}
+	m->m_dev = stb->st_dev;
+	m->m_ino = stb->st_ino;
+	m->m_ctime = stb->st_ctim;
+	m->m_fh = *kfh;
+	return kfh;
+}
@@ -0,0 +1,382 @@
+/*
+ * utils/mountd/etabshare.c
+ *
+ * Read etab once for all mountd worker processes.
+ *
+ * With --num-threads, every worker used to parse etab for itself
+ * whenever it changed.  Instead, the first worker to notice a new
+ * etab parses it into an image in a shared memory segment that was
+ * mapped before the workers were forked, and the others build their
+ * export tables from a private copy of that image.  There are two
+ * image slots: a new image is built in the one not in use, and
+ * replaces the old one once it is complete, so a worker that dies
+ * while building leaves the old image intact.  An etab too large for
+ * a slot is read by each worker, as before.
+ *
+ * One robust mutex guards both slots.  It is held while an image is
+ * built or copied, but not while a worker merges its copy into its
+ * export table, which can mean DNS lookups.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "nfslib.h"
+#include "exportfs.h"
+#include "pseudoflavors.h"
+#include "xio.h"
+#include "xlog.h"
+#include "mountd.h"
+
+#define ETAB_SHARE_SLOT_SIZE	(64UL << 20)
+#define ETAB_SHARE_ALIGN	(sizeof(uint64_t))
+
+struct etab_share_hdr {
+	pthread_mutex_t		h_lock;
+	int			h_active;	/* slot of the newest image */
+};
+
+/* At the start of each slot */
+struct etab_image {
+	dev_t			i_dev;
+	ino_t			i_ino;
+	int			i_valid;	/* zero if etab didn't fit */
+	unsigned int		i_count;
+	size_t			i_used;
+};
+
+/*
+ * One etab entry.  Strings and arrays follow it, and are found by
+ * their offset from the start of the slot; zero stands for NULL.
+ */
+struct etab_rec {
+	size_t			r_size;
+	size_t			r_hostname;
+	size_t			r_path;
+	size_t			r_mountpoint;
+	size_t			r_fslocdata;
+	size_t			r_uuid;
+	size_t			r_squids;
+	size_t			r_sqgids;
+	int			r_flags;
+	int			r_anonuid;
+	int			r_anongid;
+	int			r_nsquids;
+	int			r_nsqgids;
+	int			r_fslocmethod;
+	unsigned int		r_fsid;
+	unsigned int		r_ttl;
+	struct {
+		int		s_flav;		/* index into flav_map[] */
+		int		s_flags;
+	}			r_secinfo[SECFLAVOR_COUNT+1];
+};
+
+static struct etab_share_hdr *	share_hdr;
+static char *			share_slots[2];
+
+/* What auth_reload() is currently reading */
+struct etab_share_cursor {
+	char *			c_image;	/* private copy of a slot */
+	size_t			c_pos;
+	unsigned int		c_left;
+	struct exportent	c_ent;
+};
+
+static struct etab_share_cursor	share_cursor;
+
+static size_t share_align(size_t n)
+{
+	return (n + ETAB_SHARE_ALIGN - 1) & ~(ETAB_SHARE_ALIGN - 1);
+}
+
+/* Copy @len bytes to the end of @slot; returns their offset, or 0 */
+static size_t share_put(char *slot, const void *data, size_t len)
+{
+	struct etab_image *img = (struct etab_image *)slot;
+	size_t off = img->i_used;
+
+	if (len > ETAB_SHARE_SLOT_SIZE - off)
+		return 0;
+	memcpy(slot + off, data, len);
+	img->i_used = share_align(off + len);
+	return off;
+}
+
+static size_t share_put_str(char *slot, const char *str, int *full)
+{
+	size_t off;
+
+	if (str == NULL)
+		return 0;
+	off = share_put(slot, str, strlen(str) + 1);
+	if (off == 0)
+		*full = 1;
+	return off;
+}
+
+static size_t share_put_ids(char *slot, const int *ids, int n, int *full)
+{
+	size_t off;
+
+	if (n == 0)
+		return 0;
+	off = share_put(slot, ids, n * sizeof(*ids));
+	if (off == 0)
+		*full = 1;
+	return off;
+}
+
+static int share_add(char *slot, const struct exportent *xp)
+{
+	struct etab_image *img = (struct etab_image *)slot;
+	size_t start = img->i_used;
+	struct etab_rec rec, *r;
+	int full = 0, i;
+
+	memset(&rec, 0, sizeof(rec));
+	if (share_put(slot, &rec, sizeof(rec)) == 0)
+		return -1;
+
+	rec.r_hostname = share_put_str(slot, xp->e_hostname, &full);
+	rec.r_path = share_put_str(slot, xp->e_path, &full);
+	rec.r_mountpoint = share_put_str(slot, xp->e_mountpoint, &full);
+	rec.r_fslocdata = share_put_str(slot, xp->e_fslocdata, &full);
+	rec.r_uuid = share_put_str(slot, xp->e_uuid, &full);
+	rec.r_squids = share_put_ids(slot, xp->e_squids, xp->e_nsquids, &full);
+	rec.r_sqgids = share_put_ids(slot, xp->e_sqgids, xp->e_nsqgids, &full);
+	if (full)
+		return -1;
+
+	rec.r_size = img->i_used - start;
+	rec.r_flags = xp->e_flags;
+	rec.r_anonuid = xp->e_anonuid;
+	rec.r_anongid = xp->e_anongid;
+	rec.r_nsquids = xp->e_nsquids;
+	rec.r_nsqgids = xp->e_nsqgids;
+	rec.r_fslocmethod = xp->e_fslocmethod;
+	rec.r_fsid = xp->e_fsid;
+	rec.r_ttl = xp->e_ttl;
+	for (i = 0; i <= SECFLAVOR_COUNT; i++) {
+		const struct sec_entry *p = &xp->e_secinfo[i];
+
+		rec.r_secinfo[i].s_flav = p->flav ? p->flav - flav_map : -1;
+		rec.r_secinfo[i].s_flags = p->flags;
+		if (p->flav == NULL)
+			break;
+	}
+
+	r = (struct etab_rec *)(slot + start);
+	*r = rec;
+	img->i_count++;
+	return 0;
+}
+
+/* Parse etab into @slot.  Called with h_lock held. */
+static void share_build(char *slot)
+{
+	struct etab_image *img = (struct etab_image *)slot;
+	size_t old_used = img->i_used;
+	struct exportent *xp;
+	struct stat stb;
+	int lockid;
+
+	memset(img, 0, sizeof(*img));
+	img->i_used = share_align(sizeof(*img));
+
+	if ((lockid = xflock(_PATH_ETABLCK, "r")) < 0)
+		return;
+	/* etab is only replaced with the lock held for writing */
+	if (stat(_PATH_ETAB, &stb) < 0) {
+		xfunlock(lockid);
+		return;
+	}
+	img->i_dev = stb.st_dev;
+	img->i_ino = stb.st_ino;
+	img->i_valid = 1;
+	setexportent(_PATH_ETAB, "r");
+	while ((xp = getexportent(0, 0)) != NULL) {
+		if (img->i_valid && share_add(slot, xp) < 0) {
+			xlog(L_WARNING, "%s is too large to share between "
+				"worker processes", _PATH_ETAB);
+			img->i_valid = 0;
+		}
+	}
+	endexportent();
+	xfunlock(lockid);
+
+	/* Give back pages a larger etab used */
+	if (img->i_used < old_used) {
+		size_t keep = (img->i_used + getpagesize() - 1) &
+				~((size_t)getpagesize() - 1);
+
+		if (keep < old_used)
+			madvise(slot + keep, old_used - keep, MADV_REMOVE);
+	}
+	xlog(D_GENERAL, "shared %u etab entries (%zu bytes)",
+		img->i_count, img->i_used);
+}
+
+/**
+ * etab_share_init - set up an etab image for mountd workers to share
+ *
+ * Must be called before the workers are forked.
+ */
+void etab_share_init(void)
+{
+	pthread_mutexattr_t mattr;
+	size_t hdr_size = getpagesize();
+	char *base;
+	int i;
+
+	base = mmap(NULL, hdr_size + 2 * ETAB_SHARE_SLOT_SIZE,
+		    PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		xlog(L_WARNING, "%s: can't map shared memory: %m", __func__);
+		return;
+	}
+
+	share_hdr = (struct etab_share_hdr *)base;
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	/* A worker killed while holding it mustn't hang the rest */
+	pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&share_hdr->h_lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+	for (i = 0; i < 2; i++)
+		share_slots[i] = base + hdr_size + i * ETAB_SHARE_SLOT_SIZE;
+	share_hdr->h_active = -1;
+}
+
+static void share_lock(void)
+{
+	if (pthread_mutex_lock(&share_hdr->h_lock) == EOWNERDEAD) {
+		/* Its owner died mid-build or mid-copy; don't trust
+		 * either slot, but parse etab again */
+		xlog(L_WARNING, "a mountd worker died while sharing %s",
+			_PATH_ETAB);
+		share_hdr->h_active = -1;
+		pthread_mutex_consistent(&share_hdr->h_lock);
+	}
+}
+
+/**
+ * etab_share_get - find the shared image of etab
+ * @stb: what fstat(2) says about the etab file just opened
+ *
+ * Returns a source for etab_share_next(), which must be released
+ * with etab_share_put(), or NULL if etab should be read directly.
+ * If no worker has parsed this etab yet, the caller does.
+ */
+void *etab_share_get(const struct stat *stb)
+{
+	struct etab_image *img;
+	char *copy;
+	int slot;
+
+	if (share_hdr == NULL)
+		return NULL;
+
+	share_lock();
+	slot = share_hdr->h_active;
+	img = slot < 0 ? NULL : (struct etab_image *)share_slots[slot];
+	if (img == NULL || img->i_dev != stb->st_dev ||
+	    img->i_ino != stb->st_ino) {
+		slot = slot == 0 ? 1 : 0;
+		share_build(share_slots[slot]);
+		share_hdr->h_active = slot;
+		img = (struct etab_image *)share_slots[slot];
+	}
+	copy = NULL;
+	if (img->i_valid)
+		copy = malloc(img->i_used);
+	if (copy != NULL)
+		memcpy(copy, img, img->i_used);
+	pthread_mutex_unlock(&share_hdr->h_lock);
+	if (copy == NULL)
+		return NULL;
+
+	img = (struct etab_image *)copy;
+	share_cursor.c_image = copy;
+	share_cursor.c_pos = share_align(sizeof(*img));
+	share_cursor.c_left = img->i_count;
+	return &share_cursor;
+}
+
+static char *share_str(const char *slot, size_t off)
+{
+	return off ? (char *)slot + off : NULL;
+}
+
+/**
+ * etab_share_next - return the next entry of a shared etab image
+ * @src: source returned by etab_share_get()
+ *
+ * Returns NULL after the last entry.  The entry is valid until the
+ * next call.
+ */
+struct exportent *etab_share_next(void *src)
+{
+	struct etab_share_cursor *c = src;
+	const char *slot = c->c_image;
+	const struct etab_rec *r;
+	struct exportent *ee = &c->c_ent;
+	int i;
+
+	if (c->c_left == 0)
+		return NULL;
+	r = (const struct etab_rec *)(slot + c->c_pos);
+	c->c_pos += r->r_size;
+	c->c_left--;
+
+	memset(ee, 0, sizeof(*ee));
+	ee->e_hostname = share_str(slot, r->r_hostname);
+	strncpy(ee->e_path, slot + r->r_path, sizeof(ee->e_path) - 1);
+	ee->e_flags = r->r_flags;
+	ee->e_anonuid = r->r_anonuid;
+	ee->e_anongid = r->r_anongid;
+	ee->e_squids = (int *)share_str(slot, r->r_squids);
+	ee->e_nsquids = r->r_nsquids;
+	ee->e_sqgids = (int *)share_str(slot, r->r_sqgids);
+	ee->e_nsqgids = r->r_nsqgids;
+	ee->e_fsid = r->r_fsid;
+	ee->e_mountpoint = share_str(slot, r->r_mountpoint);
+	ee->e_fslocmethod = r->r_fslocmethod;
+	ee->e_fslocdata = share_str(slot, r->r_fslocdata);
+	ee->e_uuid = share_str(slot, r->r_uuid);
+	ee->e_ttl = r->r_ttl;
+	for (i = 0; i <= SECFLAVOR_COUNT; i++) {
+		if (r->r_secinfo[i].s_flav < 0)
+			break;
+		ee->e_secinfo[i].flav = &flav_map[r->r_secinfo[i].s_flav];
+		ee->e_secinfo[i].flags = r->r_secinfo[i].s_flags;
+	}
+	return ee;
+}
+
+/**
+ * etab_share_put - release a source returned by etab_share_get()
+ * @src: source to release, or NULL
+ *
+ */
+void etab_share_put(void *src)
+{
+	struct etab_share_cursor *c = src;
+
+	if (c != NULL) {
+		free(c->c_image);
+		c->c_image = NULL;
+	}
+}
@@ -0,0 +1,368 @@
+/*
+ * utils/mountd/gidcache.c
+ *
+ * Group list cache for --manage-gids.
+ *
+ * Looking up a user's groups goes through NSS, and with LDAP or SSSD
+ * behind it that can take tens of milliseconds.  Group lists are
+ * remembered for GID_CACHE_TTL seconds, and unknown users for
+ * GID_CACHE_NEG_TTL seconds.  A list that is used during the last
+ * part of its lifetime is looked up again in the background, so
+ * busy users never wait for NSS.  A uid being looked up has a pending
+ * entry: upcalls asking for it meanwhile wait for that lookup instead
+ * of starting their own.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+
+#include "misc.h"
+#include "xlog.h"
+#include "hashtable.h"
+#include "latency.h"
+#include "mountd.h"
+
+#define GID_CACHE_TTL		(5 * 60)
+#define GID_CACHE_NEG_TTL	60
+#define GID_CACHE_REFRESH	(GID_CACHE_TTL / 5)	/* refresh-ahead window */
+#define GID_CACHE_MAX		16384
+
+#define INITIAL_MANAGED_GROUPS	100
+
+struct gid_waiter {
+	struct gid_waiter *	w_next;
+	gid_cache_cb		w_cb;
+	void *			w_data;
+	uint64_t		w_start;
+};
+
+struct gid_cache_ent {
+	struct hash_node	g_node;
+	uid_t			g_uid;
+	gid_t *			g_groups;
+	int			g_ngroups;	/* -1: unknown user */
+	time_t			g_fetched;
+	time_t			g_expires;
+	int			g_pending;	/* no usable list yet */
+	int			g_queued;	/* waiting for a lookup thread */
+	int			g_warned;	/* list was too long */
+	struct gid_waiter *	g_waiters;
+	struct gid_cache_ent *	g_qnext;
+};
+
+static struct hash_table	gid_cache = HASH_TABLE_INIT;
+static pthread_mutex_t		gid_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct gid_cache_ent *	gid_queue;
+static struct gid_cache_ent **	gid_queue_tail = &gid_queue;
+static pthread_cond_t		gid_queue_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int		gid_nthreads;
+
+/*
+ * Ask NSS for @uid's groups.  Returns the number of groups, with the
+ * list in *@groups, or -1.
+ */
+static int gid_cache_fetch(uid_t uid, gid_t **groups)
+{
+	struct passwd pwd, *pw = NULL;
+	char *pwbuf;
+	long pwbuflen;
+	gid_t *list, *more;
+	int ngroups = INITIAL_MANAGED_GROUPS;
+	int rv = -1;
+	uint64_t start = latency_start();
+
+	*groups = NULL;
+	pwbuflen = sysconf(_SC_GETPW_R_SIZE_MAX);
+	if (pwbuflen <= 0)
+		pwbuflen = 16384;
+	pwbuf = malloc(pwbuflen);
+	list = malloc(sizeof(gid_t) * ngroups);
+	if (pwbuf == NULL || list == NULL)
+		goto out;
+
+	getpwuid_r(uid, &pwd, pwbuf, pwbuflen, &pw);
+	if (pw == NULL)
+		goto out;
+	rv = getgrouplist(pw->pw_name, pw->pw_gid, list, &ngroups);
+	if (rv == -1 && ngroups > INITIAL_MANAGED_GROUPS) {
+		more = realloc(list, sizeof(gid_t) * ngroups);
+		if (more == NULL)
+			goto out;
+		list = more;
+		rv = getgrouplist(pw->pw_name, pw->pw_gid, list, &ngroups);
+	}
+	if (rv >= 0) {
+		rv = ngroups;
+		*groups = list;
+		list = NULL;
+	}
+out:
+	latency_record(LAT_NSS_GROUPS, start);
+	free(pwbuf);
+	free(list);
+	return rv;
+}
+
+static unsigned int gid_cache_hash(uid_t uid)
+{
+	return hash_bytes(&uid, sizeof(uid));
+}
+
+static struct gid_cache_ent *gid_cache_find(uid_t uid)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&gid_cache, gid_cache_hash(uid)); n;
+	     n = hash_lookup_next(n)) {
+		struct gid_cache_ent *ent =
+			hash_entry(n, struct gid_cache_ent, g_node);
+
+		if (ent->g_uid == uid)
+			return ent;
+	}
+	return NULL;
+}
+
+/*
+ * Drop entries that have expired.  Entries being looked up are kept,
+ * so nobody loses the entry underneath them.
+ */
+static void gid_cache_prune(time_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < gid_cache.h_size; i++) {
+		struct hash_node *n = gid_cache.h_buckets[i], *next;
+
+		for (; n; n = next) {
+			struct gid_cache_ent *ent =
+				hash_entry(n, struct gid_cache_ent, g_node);
+
+			next = n->h_next;
+			if (ent->g_pending || ent->g_queued ||
+			    ent->g_expires > now)
+				continue;
+			hash_remove(&gid_cache, n);
+			free(ent->g_groups);
+			free(ent);
+		}
+	}
+}
+
+/* Called with gid_cache_lock held */
+static void gid_cache_queue(struct gid_cache_ent *ent)
+{
+	if (ent->g_queued)
+		return;
+	ent->g_queued = 1;
+	ent->g_qnext = NULL;
+	*gid_queue_tail = ent;
+	gid_queue_tail = &ent->g_qnext;
+	pthread_cond_signal(&gid_queue_cond);
+}
+
+/*
+ * Record the result of looking up @ent, then answer everyone who was
+ * waiting for it.  The entry keeps its own copy of @groups.
+ */
+static void gid_cache_complete(struct gid_cache_ent *ent,
+			       const gid_t *groups, int ngroups)
+{
+	struct gid_waiter *w, *next;
+	time_t now = time(NULL);
+	gid_t *copy = NULL;
+	int warn = 0;
+	uid_t uid;
+
+	if (ngroups > 0) {
+		copy = malloc(sizeof(gid_t) * ngroups);
+		if (copy)
+			memcpy(copy, groups, sizeof(gid_t) * ngroups);
+	}
+
+	pthread_mutex_lock(&gid_cache_lock);
+	free(ent->g_groups);
+	ent->g_groups = copy;
+	ent->g_ngroups = ngroups;
+	ent->g_fetched = now;
+	ent->g_expires = now +
+		(ngroups >= 0 ? GID_CACHE_TTL : GID_CACHE_NEG_TTL);
+	if (ngroups > 0 && copy == NULL) {
+		/* Don't remember a list we couldn't keep */
+		ent->g_ngroups = -1;
+		ent->g_expires = now;
+	}
+	ent->g_pending = 0;
+	ent->g_queued = 0;
+	w = ent->g_waiters;
+	ent->g_waiters = NULL;
+	uid = ent->g_uid;
+	/* Once per user: it changes what they may access */
+	if (ngroups > AUTH_UNIX_GID_MAX && !ent->g_warned) {
+		ent->g_warned = 1;
+		warn = 1;
+	}
+	pthread_mutex_unlock(&gid_cache_lock);
+
+	if (warn)
+		xlog(L_WARNING, "uid %u is in %d groups; only the first %d "
+			"are passed to the kernel", uid, ngroups,
+			AUTH_UNIX_GID_MAX);
+
+	for (; w; w = next) {
+		next = w->w_next;
+		w->w_cb(uid, groups, ngroups, now, w->w_data);
+		latency_record(LAT_GROUPS_MISS, w->w_start);
+		free(w);
+	}
+}
+
+static void *gid_cache_thread(void *UNUSED(arg))
+{
+	struct gid_cache_ent *ent;
+	gid_t *groups;
+	int ngroups;
+
+	for (;;) {
+		pthread_mutex_lock(&gid_cache_lock);
+		while (gid_queue == NULL)
+			pthread_cond_wait(&gid_queue_cond, &gid_cache_lock);
+		ent = gid_queue;
+		gid_queue = ent->g_qnext;
+		if (gid_queue == NULL)
+			gid_queue_tail = &gid_queue;
+		pthread_mutex_unlock(&gid_cache_lock);
+
+		ngroups = gid_cache_fetch(ent->g_uid, &groups);
+		gid_cache_complete(ent, groups, ngroups);
+		free(groups);
+	}
+	return NULL;
+}
+
+/**
+ * gid_cache_start - start threads that look up group lists
+ * @nthreads: number of threads to start
+ *
+ * Returns the number of threads started.  Must be called after any
+ * fork().
+ */
+unsigned int gid_cache_start(unsigned int nthreads)
+{
+	sigset_t set, oldset;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	/* Signals are for the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (; nthreads; nthreads--) {
+		int err = pthread_create(&thread, &attr, gid_cache_thread, NULL);
+
+		if (err != 0) {
+			xlog(L_ERROR, "%s: can't start lookup thread: %s",
+				__func__, strerror(err));
+			break;
+		}
+		pthread_mutex_lock(&gid_cache_lock);
+		gid_nthreads++;
+		pthread_mutex_unlock(&gid_cache_lock);
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	return gid_nthreads;
+}
+
+/**
+ * gid_cache_lookup - find the groups a user belongs to
+ * @uid: user to look up
+ * @cb: function to call with the result
+ * @data: passed to @cb
+ *
+ * @cb receives the group list, or a count of -1 if the user is
+ * unknown, and the time the list was read from NSS.  Cached lists
+ * are passed to @cb before this function returns; otherwise @cb is
+ * called from a lookup thread once NSS has answered.  Without lookup
+ * threads, NSS is asked in place.
+ */
+void gid_cache_lookup(uid_t uid, gid_cache_cb cb, void *data)
+{
+	uint64_t start = latency_start();
+	struct gid_cache_ent *ent;
+	struct gid_waiter *w;
+	gid_t *groups = NULL;
+	time_t now = time(NULL), fetched;
+	int ngroups;
+
+	pthread_mutex_lock(&gid_cache_lock);
+	ent = gid_cache_find(uid);
+	if (ent == NULL) {
+		if (gid_cache.h_count >= GID_CACHE_MAX)
+			gid_cache_prune(now);
+		ent = calloc(1, sizeof(*ent));
+		if (ent == NULL)
+			goto out_sync;
+		ent->g_uid = uid;
+		ent->g_pending = 1;
+		hash_insert(&gid_cache, &ent->g_node, gid_cache_hash(uid));
+	} else if (!ent->g_pending && ent->g_expires <= now)
+		ent->g_pending = 1;
+
+	if (!ent->g_pending) {
+		if (ent->g_ngroups > 0)
+			groups = malloc(sizeof(gid_t) * ent->g_ngroups);
+		ngroups = groups || ent->g_ngroups <= 0 ? ent->g_ngroups : -1;
+		if (groups)
+			memcpy(groups, ent->g_groups,
+			       sizeof(gid_t) * ent->g_ngroups);
+		fetched = ent->g_fetched;
+		if (gid_nthreads && ent->g_expires - now <= GID_CACHE_REFRESH)
+			gid_cache_queue(ent);
+		pthread_mutex_unlock(&gid_cache_lock);
+		cb(uid, groups, ngroups, fetched, data);
+		latency_record(LAT_GROUPS_HIT, start);
+		free(groups);
+		return;
+	}
+
+	if (gid_nthreads == 0)
+		goto out_sync;
+	w = malloc(sizeof(*w));
+	if (w == NULL)
+		goto out_sync;
+	w->w_cb = cb;
+	w->w_data = data;
+	w->w_start = start;
+	w->w_next = ent->g_waiters;
+	ent->g_waiters = w;
+	gid_cache_queue(ent);
+	pthread_mutex_unlock(&gid_cache_lock);
+	return;
+
+out_sync:
+	/* A lookup thread has it, and will finish it off */
+	if (ent != NULL && ent->g_queued)
+		ent = NULL;
+	pthread_mutex_unlock(&gid_cache_lock);
+	ngroups = gid_cache_fetch(uid, &groups);
+	if (ent != NULL)
+		gid_cache_complete(ent, groups, ngroups);
+	cb(uid, groups, ngroups, now, data);
+	latency_record(LAT_GROUPS_MISS, start);
+	free(groups);
+}
@@ -14,6 +14,7 @@
 
 #include "mountd.h"
 #include "rpcmisc.h"
+#include "latency.h"
 
 /*
  * Procedures for MNTv1
@@ -24,8 +25,8 @@ static struct rpc_dentry mnt_1_dtable[] = {
 	dtable_ent(mount_dump,1,void,mountlist),	/* DUMP */
 	dtable_ent(mount_umnt,1,dirpath,void),		/* UMNT */
 	dtable_ent(mount_umntall,1,void,void),		/* UMNTALL */
-	dtable_ent(mount_export,1,void,exports),	/* EXPORT */
-	dtable_ent(mount_exportall,1,void,exports),	/* EXPORTALL */
+	dtable_ent(mount_export,1,void,exports_encoded),	/* EXPORT */
+	dtable_ent(mount_exportall,1,void,exports_encoded),	/* EXPORTALL */
 };
 
 /*
@@ -37,8 +38,8 @@ static struct rpc_dentry mnt_2_dtable[] = {
 	dtable_ent(mount_dump,1,void,mountlist),	/* DUMP */
 	dtable_ent(mount_umnt,1,dirpath,void),		/* UMNT */
 	dtable_ent(mount_umntall,1,void,void),		/* UMNTALL */
-	dtable_ent(mount_export,1,void,exports),	/* EXPORT */
-	dtable_ent(mount_exportall,1,void,exports),	/* EXPORTALL */
+	dtable_ent(mount_export,1,void,exports_encoded),	/* EXPORT */
+	dtable_ent(mount_exportall,1,void,exports_encoded),	/* EXPORTALL */
 	dtable_ent(mount_pathconf,2,dirpath,ppathcnf),	/* PATHCONF */
 };
 
@@ -51,7 +52,7 @@ static struct rpc_dentry mnt_3_dtable[] = {
 	dtable_ent(mount_dump,1,void,mountlist),	/* DUMP */
 	dtable_ent(mount_umnt,1,dirpath,void),		/* UMNT */
 	dtable_ent(mount_umntall,1,void,void),		/* UMNTALL */
-	dtable_ent(mount_export,1,void,exports),	/* EXPORT */
+	dtable_ent(mount_export,1,void,exports_encoded),	/* EXPORT */
 };
 
 #define number_of(x)	(sizeof(x)/sizeof(x[0]))
@@ -70,6 +71,7 @@ mount_dispatch(struct svc_req *rqstp, SVCXPRT *transp)
 {
 	union mountd_arguments 	argument;
 	union mountd_results	result;
+	uint64_t		start = latency_start();
 
 #ifdef HAVE_TCP_WRAPPER
 	/* remote host authorization check */
@@ -79,6 +81,13 @@ mount_dispatch(struct svc_req *rqstp, SVCXPRT *transp)
 	}
 #endif
 
+	/* Upcall threads may be using the export table too */
+	auth_reload();
+	auth_read_lock();
 	rpc_dispatch(rqstp, transp, dtable, number_of(dtable),
 			&argument, &result);
+	auth_read_unlock();
+
+	if (rqstp->rq_proc <= MOUNTPROC_PATHCONF)
+		latency_record(LAT_MOUNTPROC_NULL + rqstp->rq_proc, start);
 }
@@ -27,11 +27,12 @@
 #include "mountd.h"
 #include "rpcmisc.h"
 #include "pseudoflavors.h"
+#include "hashtable.h"
 
 extern void my_svc_run(void);
 
 static void		usage(const char *, int exitcode);
-static exports		get_exportlist(void);
+static exports_encoded	get_exportlist(void);
 static struct nfs_fh_len *get_rootfh(struct svc_req *, dirpath *, nfs_export **, mountstat3 *, int v3);
 
 int reverse_resolve = 0;
@@ -51,6 +52,17 @@ static int num_threads = 1;
 /* Arbitrary limit on number of threads */
 #define MAX_THREADS 64
 
+/* Reverse DNS lookups for auth.unix.ip upcalls run on their own threads */
+#define RESOLVER_THREADS 4
+
+/* Number of threads in each process servicing kernel cache
+ * upcalls.  With none, upcalls are handled in the RPC service loop. */
+static int cache_threads = 0;
+
+/* Number of threads loading the kernel caches for the clients in
+ * rmtab before they ask.  With none, nothing is loaded ahead. */
+static int preseed_threads = 0;
+
 static struct option longopts[] =
 {
 	{ "foreground", 0, 0, 'F' },
@@ -65,8 +77,11 @@ static struct option longopts[] =
 	{ "ha-callout", 1, 0, 'H' },
 	{ "state-directory-path", 1, 0, 's' },
 	{ "num-threads", 1, 0, 't' },
+	{ "cache-threads", 1, 0, 'T' },
 	{ "reverse-lookup", 0, 0, 'r' },
 	{ "manage-gids", 0, 0, 'g' },
+	{ "netgroup-refresh", 1, 0, 'G' },
+	{ "preseed", 1, 0, 'S' },
 	{ "no-udp", 0, 0, 'u' },
 	{ NULL, 0, 0, 0 }
 };
@@ -170,6 +185,10 @@ fork_workers(void)
 			sigaction(SIGINT, &sa, NULL);
 			sigaction(SIGTERM, &sa, NULL);
 
+			/* One worker is enough to load the caches */
+			if (i > 0)
+				preseed_threads = 0;
+
 			/* fall into my_svc_run in caller */
 			return;
 		}
@@ -179,6 +198,7 @@ fork_workers(void)
 	wait_for_workers();
 	unregister_services();
 	cleanup_lockfiles();
+	stats_close();
 	xlog(L_NOTICE, "mountd: no more workers, exiting\n");
 	exit(0);
 }
@@ -196,6 +216,7 @@ killer (int sig)
 		wait_for_workers();
 	}
 	cleanup_lockfiles();
+	stats_close();
 	xlog (L_NOTICE, "Caught signal %d, un-registering and exiting.", sig);
 	exit(0);
 }
@@ -297,7 +318,8 @@ mount_umntall_1_svc(struct svc_req *rqstp, void *UNUSED(argp),
 }
 
 bool_t
-mount_export_1_svc(struct svc_req *rqstp, void *UNUSED(argp), exports *resp)
+mount_export_1_svc(struct svc_req *rqstp, void *UNUSED(argp),
+		   exports_encoded *resp)
 {
 	struct sockaddr *sap = nfs_getrpccaller(rqstp->rq_xprt);
 	char buf[INET6_ADDRSTRLEN];
@@ -311,7 +333,8 @@ mount_export_1_svc(struct svc_req *rqstp, void *UNUSED(argp), exports *resp)
 }
 
 bool_t
-mount_exportall_1_svc(struct svc_req *rqstp, void *UNUSED(argp), exports *resp)
+mount_exportall_1_svc(struct svc_req *rqstp, void *UNUSED(argp),
+		      exports_encoded *resp)
 {
 	struct sockaddr *sap = nfs_getrpccaller(rqstp->rq_xprt);
 	char buf[INET6_ADDRSTRLEN];
@@ -445,6 +468,40 @@ mount_mnt_3_svc(struct svc_req *rqstp, dirpath *path, mountres3 *res)
 	return 1;
 }
 
+/*
+ * Resolve @path as realpath(3) would, and stat the result, with the
+ * same few system calls however deep the path is: the name of an
+ * O_PATH descriptor is its canonical path.  Returns zero, or -1 if
+ * the caller should fall back to realpath(3).
+ */
+static int
+resolve_path(const char *path, char *rpath, size_t size, struct stat *stb)
+{
+#ifdef O_PATH
+	char proc[32];
+	ssize_t len;
+	int fd, ret = -1;
+
+	fd = open(path, O_PATH | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	if (fstat(fd, stb) == 0) {
+		len = readlink(proc, rpath, size - 1);
+		/* An unreachable or deleted object has no usable name */
+		if (len > 0 && (size_t)len < size - 1 && rpath[0] == '/' &&
+		    stb->st_nlink != 0) {
+			rpath[len] = '\0';
+			ret = 0;
+		}
+	}
+	close(fd);
+	return ret;
+#else
+	return -1;
+#endif
+}
+
 static struct nfs_fh_len *
 get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 		mountstat3 *error, int v3)
@@ -456,6 +513,8 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 	char		rpath[MAXPATHLEN+1];
 	char		*p = *path;
 	char		buf[INET6_ADDRSTRLEN];
+	int		have_stb = 0, mounted;
+	dev_t		edev;
 
 	if (*p == '\0')
 		p = "/";
@@ -464,7 +523,10 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 	auth_reload();
 
 	/* Resolve symlinks */
-	if (realpath(p, rpath) != NULL) {
+	if (resolve_path(p, rpath, sizeof(rpath), &stb) == 0) {
+		p = rpath;
+		have_stb = 1;
+	} else if (realpath(p, rpath) != NULL) {
 		rpath[sizeof (rpath) - 1] = '\0';
 		p = rpath;
 	}
@@ -475,7 +537,7 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 		*error = MNT3ERR_ACCES;
 		return NULL;
 	}
-	if (stat(p, &stb) < 0) {
+	if (!have_stb && stat(p, &stb) < 0) {
 		xlog(L_WARNING, "can't stat exported dir %s: %s",
 				p, strerror(errno));
 		if (errno == ENOENT)
@@ -489,13 +551,27 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 		*error = MNT3ERR_NOTDIR;
 		return NULL;
 	}
-	if (stat(exp->m_export.e_path, &estb) < 0) {
-		xlog(L_WARNING, "can't stat export point %s: %s",
-		     p, strerror(errno));
-		*error = MNT3ERR_NOENT;
-		return NULL;
+	if (new_cache) {
+		if (cache_export_root(exp, &edev, &mounted) < 0) {
+			xlog(L_WARNING, "can't stat export point %s: %s",
+			     p, strerror(errno));
+			*error = MNT3ERR_NOENT;
+			return NULL;
+		}
+	} else {
+		if (stat(exp->m_export.e_path, &estb) < 0) {
+			xlog(L_WARNING, "can't stat export point %s: %s",
+			     p, strerror(errno));
+			*error = MNT3ERR_NOENT;
+			return NULL;
+		}
+		edev = estb.st_dev;
+		mounted = !exp->m_export.e_mountpoint ||
+			is_mountpoint(exp->m_export.e_mountpoint[0]?
+				      exp->m_export.e_mountpoint:
+				      exp->m_export.e_path);
 	}
-	if (estb.st_dev != stb.st_dev
+	if (edev != stb.st_dev
 		   && (!new_cache
 			   || !(exp->m_export.e_flags & NFSEXP_CROSSMOUNT))) {
 		xlog(L_WARNING, "request to export directory %s below nearest filesystem %s",
@@ -503,10 +579,7 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 		*error = MNT3ERR_ACCES;
 		return NULL;
 	}
-	if (exp->m_export.e_mountpoint &&
-		   !is_mountpoint(exp->m_export.e_mountpoint[0]?
-				  exp->m_export.e_mountpoint:
-				  exp->m_export.e_path)) {
+	if (!mounted) {
 		xlog(L_WARNING, "request to export an unmounted filesystem: %s",
 		     p);
 		*error = MNT3ERR_NOENT;
@@ -516,14 +589,9 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 	if (new_cache) {
 		/* This will be a static private nfs_export with just one
 		 * address.  We feed it to kernel then extract the filehandle,
-		 * 
+		 * unless this client domain was already given one for p.
 		 */
-
-		if (cache_export(exp, p)) {
-			*error = MNT3ERR_ACCES;
-			return NULL;
-		}
-		fh = cache_get_filehandle(exp, v3?64:32, p);
+		fh = cache_mount_filehandle(exp, v3?64:32, p, &stb);
 		if (fh == NULL) {
 			*error = MNT3ERR_ACCES;
 			return NULL;
@@ -566,14 +634,66 @@ get_rootfh(struct svc_req *rqstp, dirpath *path, nfs_export **expret,
 	return fh;
 }
 
+/*
+ * The export list is built once per export table generation, and
+ * kept only in its XDR encoded form, which EXPORT and EXPORTALL
+ * replies copy out as is.  While it is built, paths and the clients
+ * of each path are found through hash tables.
+ *
+ * A subnet, wildcard or netgroup client absorbs the FQDN clients of
+ * the same path that it contains.  Those FQDN clients are resolved
+ * once each, with the export table let go, and then looked up in the
+ * client indexes; a match absorbs the client if that path is
+ * exported to it.
+ */
+struct elist_path {
+	struct exportnode	p_node;		/* XDR list linkage */
+	struct hash_node	p_hash;
+	int			p_absorbs;	/* may absorb FQDN clients */
+	nfs_client **		p_netgroups;	/* exported to this path */
+	unsigned int		p_nnetgroups;
+};
+
+struct elist_group {
+	struct groupnode	g_node;		/* XDR list linkage */
+	struct hash_node	g_hash;
+	struct elist_path *	g_path;
+	int			g_type;
+	struct addrinfo *	g_ai;
+};
+
+/* A subnet or wildcard client that a path is exported to */
+struct elist_client {
+	struct hash_node	c_hash;
+	struct elist_client *	c_next;
+	struct elist_path *	c_path;
+	nfs_client *		c_client;
+};
+
+static struct hash_table	elist_paths = HASH_TABLE_INIT;
+static struct hash_table	elist_groups = HASH_TABLE_INIT;
+static struct hash_table	elist_clients = HASH_TABLE_INIT;
+static struct elist_client *	elist_client_list;
+
+#define elist_group_of(g)	hash_entry(g, struct elist_group, g_node)
+#define elist_path_of(e)	hash_entry(e, struct elist_path, p_node)
+
+static void elist_group_free(struct elist_group *g)
+{
+	hash_remove(&elist_groups, &g->g_hash);
+	if (g->g_ai)
+		freeaddrinfo(g->g_ai);
+	xfree(g->g_node.gr_name);
+	xfree(g);
+}
+
 static void remove_all_clients(exportnode *e)
 {
 	struct groupnode *g, *ng;
 
 	for (g = e->ex_groups; g; g = ng) {
 		ng = g->gr_next;
-		xfree(g->gr_name);
-		xfree(g);
+		elist_group_free(elist_group_of(g));
 	}
 	e->ex_groups = NULL;
 }
@@ -581,108 +701,296 @@ static void remove_all_clients(exportnode *e)
 static void free_exportlist(exports *elist)
 {
 	struct exportnode *e, *ne;
+	struct elist_client *c;
 
 	for (e = *elist; e != NULL; e = ne) {
 		ne = e->ex_next;
 		remove_all_clients(e);
 		xfree(e->ex_dir);
-		xfree(e);
+		xfree(elist_path_of(e)->p_netgroups);
+		xfree(elist_path_of(e));
 	}
 	*elist = NULL;
+	while ((c = elist_client_list) != NULL) {
+		elist_client_list = c->c_next;
+		xfree(c);
+	}
+	hash_clear(&elist_paths);
+	hash_clear(&elist_groups);
+	hash_clear(&elist_clients);
+}
+
+static unsigned int elist_client_hash(const struct elist_path *p,
+				      const nfs_client *clp)
+{
+	return hash_bytes(&p, sizeof(p)) ^ hash_bytes(&clp, sizeof(clp));
+}
+
+static int elist_client_find(const struct elist_path *p, const nfs_client *clp)
+{
+	struct hash_node *n;
+
+	for (n = hash_lookup(&elist_clients, elist_client_hash(p, clp)); n;
+	     n = hash_lookup_next(n)) {
+		struct elist_client *c =
+			hash_entry(n, struct elist_client, c_hash);
+
+		if (c->c_path == p && c->c_client == clp)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Note that @e is exported to @clp, for prune_clients().  Anonymous
+ * clients absorb everything as the list is built, and gss clients
+ * match no address.
+ */
+static void elist_add_client(struct exportnode *e, nfs_client *clp)
+{
+	struct elist_path *p = elist_path_of(e);
+	struct elist_client *c;
+
+	switch (clp->m_type) {
+	case MCL_SUBNETWORK:
+	case MCL_WILDCARD:
+		if (elist_client_find(p, clp))
+			break;
+		c = xmalloc(sizeof(*c));
+		c->c_path = p;
+		c->c_client = clp;
+		c->c_next = elist_client_list;
+		elist_client_list = c;
+		hash_insert(&elist_clients, &c->c_hash,
+			    elist_client_hash(p, clp));
+		p->p_absorbs = 1;
+		break;
+	case MCL_NETGROUP:
+		p->p_netgroups = xrealloc(p->p_netgroups,
+				(p->p_nnetgroups + 1) * sizeof(*p->p_netgroups));
+		p->p_netgroups[p->p_nnetgroups++] = clp;
+		p->p_absorbs = 1;
+		break;
+	}
 }
 
-static void prune_clients(nfs_export *exp, struct exportnode *e)
+/*
+ * Resolve @g, and look up what matching it against the clients of
+ * @p needs, with the export table let go.  Returns zero if the
+ * table changed meanwhile.
+ */
+static int elist_group_resolve(struct elist_path *p, struct elist_group *g,
+			       unsigned int gen)
 {
-	struct addrinfo *ai = NULL;
+	char **names;
+	unsigned int i;
+	int depth;
+
+	names = xmalloc((p->p_nnetgroups + 1) * sizeof(*names));
+	for (i = 0; i < p->p_nnetgroups; i++)
+		names[i] = xstrdup(p->p_netgroups[i]->m_hostname);
+
+	depth = auth_read_suspend();
+	g->g_ai = host_addrinfo(g->g_node.gr_name);
+	if (g->g_ai)
+		client_check_prepare(g->g_ai, names, p->p_nnetgroups);
+	auth_read_resume(depth);
+
+	for (i = 0; i < p->p_nnetgroups; i++)
+		xfree(names[i]);
+	xfree(names);
+	return auth_reload() == gen;
+}
+
+/*
+ * Returns 1 if a subnet, wildcard or netgroup client that @p is
+ * exported to matches @ai.
+ */
+static int elist_absorbed(struct elist_path *p, const struct addrinfo *ai)
+{
+	nfs_client **clients;
+	unsigned int i, count;
+	int found = 0;
+
+	clients = client_match_list(ai, &count);
+	for (i = 0; i < count && !found; i++)
+		if (clients[i]->m_type != MCL_FQDN)
+			found = elist_client_find(p, clients[i]);
+	free(clients);
+
+	for (i = 0; i < p->p_nnetgroups && !found; i++)
+		found = client_check(p->p_netgroups[i], ai);
+	return found;
+}
+
+/*
+ * Drop the FQDN clients of @e that another of its clients contains.
+ * Returns zero if the export table changed meanwhile.
+ */
+static int prune_clients(struct exportnode *e, unsigned int gen)
+{
+	struct elist_path *p = elist_path_of(e);
 	struct groupnode *c, **cp;
 
 	cp = &e->ex_groups;
 	while ((c = *cp) != NULL) {
-		if (client_gettype(c->gr_name) == MCL_FQDN
-		    && (ai = host_addrinfo(c->gr_name))) {
-			if (client_check(exp->m_client, ai)) {
+		struct elist_group *g = elist_group_of(c);
+
+		if (g->g_type == MCL_FQDN) {
+			if (!elist_group_resolve(p, g, gen))
+				return 0;
+			if (g->g_ai && elist_absorbed(p, g->g_ai)) {
 				*cp = c->gr_next;
-				xfree(c->gr_name);
-				xfree(c);
-				freeaddrinfo(ai);
+				elist_group_free(g);
 				continue;
 			}
-			freeaddrinfo(ai);
 		}
 		cp = &(c->gr_next);
 	}
+	return 1;
 }
 
 static exportnode *lookup_or_create_elist_entry(exports *elist, nfs_export *exp)
 {
-	exportnode *e;
-
-	for (e = *elist; e != NULL; e = e->ex_next) {
-		if (!strcmp(exp->m_export.e_path, e->ex_dir))
-			return e;
+	unsigned int hash = hash_string(exp->m_export.e_path);
+	struct elist_path *p;
+	struct hash_node *n;
+
+	for (n = hash_lookup(&elist_paths, hash); n; n = hash_lookup_next(n)) {
+		p = hash_entry(n, struct elist_path, p_hash);
+		if (!strcmp(exp->m_export.e_path, p->p_node.ex_dir))
+			return &p->p_node;
 	}
-	e = xmalloc(sizeof(*e));
-	e->ex_next = *elist;
-	e->ex_groups = NULL;
-	e->ex_dir = xstrdup(exp->m_export.e_path);
-	*elist = e;
-	return e;
+	p = xmalloc(sizeof(*p));
+	p->p_node.ex_next = *elist;
+	p->p_node.ex_groups = NULL;
+	p->p_node.ex_dir = xstrdup(exp->m_export.e_path);
+	p->p_absorbs = 0;
+	p->p_netgroups = NULL;
+	p->p_nnetgroups = 0;
+	hash_insert(&elist_paths, &p->p_hash, hash);
+	*elist = &p->p_node;
+	return &p->p_node;
 }
 
 static void insert_group(struct exportnode *e, char *newname)
 {
-	struct groupnode *g;
-
-	for (g = e->ex_groups; g; g = g->gr_next)
-		if (!strcmp(g->gr_name, newname))
+	struct elist_path *p = elist_path_of(e);
+	unsigned int hash = hash_string(newname) ^ hash_bytes(&p, sizeof(p));
+	struct elist_group *g;
+	struct hash_node *n;
+
+	for (n = hash_lookup(&elist_groups, hash); n; n = hash_lookup_next(n)) {
+		g = hash_entry(n, struct elist_group, g_hash);
+		if (g->g_path == p && !strcmp(g->g_node.gr_name, newname))
 			return;
+	}
 
 	g = xmalloc(sizeof(*g));
-	g->gr_name = xstrdup(newname);
-	g->gr_next = e->ex_groups;
-	e->ex_groups = g;
+	g->g_node.gr_name = xstrdup(newname);
+	g->g_node.gr_next = e->ex_groups;
+	g->g_path = p;
+	g->g_type = client_gettype(newname);
+	g->g_ai = NULL;
+	hash_insert(&elist_groups, &g->g_hash, hash);
+	e->ex_groups = &g->g_node;
 }
 
-static exports
-get_exportlist(void)
+/*
+ * Build the export list of table generation @gen into @elist.
+ * Returns zero if the table changed while FQDN clients were being
+ * resolved; the caller frees @elist and starts again.
+ */
+static int
+build_exportlist(exports *elist, unsigned int gen)
 {
-	static exports		elist = NULL;
 	struct exportnode	*e;
 	nfs_export		*exp;
 	int			i;
-	static unsigned int	ecounter;
-	unsigned int		acounter;
-
-	acounter = auth_reload();
-	if (elist && acounter == ecounter)
-		return elist;
-
-	ecounter = acounter;
-
-	free_exportlist(&elist);
 
 	for (i = 0; i < MCL_MAXTYPES; i++) {
 		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
 			 /* Don't show pseudo exports */
 			if (exp->m_export.e_flags & NFSEXP_V4ROOT)
 				continue;
-			e = lookup_or_create_elist_entry(&elist, exp);
+			e = lookup_or_create_elist_entry(elist, exp);
 
 			/* exports to "*" absorb any others */
 			if (i == MCL_ANONYMOUS && e->ex_groups) {
 				remove_all_clients(e);
 				continue;
 			}
-			/* non-FQDN's absorb FQDN's they contain: */
-			if (i != MCL_FQDN && e->ex_groups)
-				prune_clients(exp, e);
+			/* non-FQDN's absorb FQDN's they contain, which
+			 * all come first; see prune_clients() */
+			if (i != MCL_FQDN)
+				elist_add_client(e, exp->m_client);
 
 			if (exp->m_export.e_hostname[0] != '\0')
 				insert_group(e, exp->m_export.e_hostname);
 		}
 	}
 
-	return elist;
+	for (e = *elist; e; e = e->ex_next)
+		if (elist_path_of(e)->p_absorbs && !prune_clients(e, gen))
+			return 0;
+	return 1;
+}
+
+/**
+ * xdr_exports_encoded - send an export list encoded in advance
+ * @xdrs: XDR stream
+ * @objp: encoded export list
+ *
+ */
+bool_t
+xdr_exports_encoded(XDR *xdrs, exports_encoded *objp)
+{
+	if (xdrs->x_op != XDR_ENCODE)
+		return TRUE;
+	return xdr_opaque(xdrs, objp->ee_buf, objp->ee_len);
+}
+
+static exports_encoded
+get_exportlist(void)
+{
+	static exports_encoded	encoded;
+	static int		valid;
+	static unsigned int	ecounter;
+	unsigned int		acounter;
+	exports			elist;
+	unsigned long		len;
+	XDR			xdrs;
+
+	acounter = auth_reload();
+	if (valid && acounter == ecounter)
+		return encoded;
+
+	for (;;) {
+		elist = NULL;
+		if (build_exportlist(&elist, acounter))
+			break;
+		free_exportlist(&elist);
+		acounter = auth_reload();
+	}
+
+	xfree(encoded.ee_buf);
+	encoded.ee_buf = NULL;
+	encoded.ee_len = 0;
+	valid = 0;
+
+	len = xdr_sizeof((xdrproc_t)xdr_exports, &elist);
+	encoded.ee_buf = xmalloc(len ? len : 1);
+	xdrmem_create(&xdrs, encoded.ee_buf, len, XDR_ENCODE);
+	if (xdr_exports(&xdrs, &elist)) {
+		encoded.ee_len = xdr_getpos(&xdrs);
+		ecounter = acounter;
+		valid = 1;
+	} else
+		xlog(L_ERROR, "%s: can't encode the export list", __func__);
+	xdr_destroy(&xdrs);
+
+	free_exportlist(&elist);
+	return encoded;
 }
 
 int
@@ -694,6 +1002,7 @@ main(int argc, char **argv)
 	int	foreground = 0;
 	int	port = 0;
 	int	descriptors = 0;
+	int	netgroup_ttl;
 	int	c;
 	int	vers;
 	struct sigaction sa;
@@ -707,11 +1016,20 @@ main(int argc, char **argv)
 
 	/* Parse the command line options and arguments. */
 	opterr = 0;
-	while ((c = getopt_long(argc, argv, "o:nFd:p:P:hH:N:V:vurs:t:g", longopts, NULL)) != EOF)
+	while ((c = getopt_long(argc, argv, "o:nFd:p:P:hH:N:V:vurs:t:T:gG:S:", longopts, NULL)) != EOF)
 		switch (c) {
 		case 'g':
 			manage_gids = 1;
 			break;
+		case 'G':
+			netgroup_ttl = atoi(optarg);
+			if (netgroup_ttl < 0) {
+				fprintf(stderr, "%s: bad netgroup refresh interval: %s\n",
+					progname, optarg);
+				usage(progname, 1);
+			}
+			client_netgroup_ttl(netgroup_ttl);
+			break;
 		case 'o':
 			descriptors = atoi(optarg);
 			if (descriptors <= 0) {
@@ -766,6 +1084,22 @@ main(int argc, char **argv)
 		case 't':
 			num_threads = atoi (optarg);
 			break;
+		case 'T':
+			cache_threads = atoi (optarg);
+			if (cache_threads < 0 || cache_threads > MAX_THREADS) {
+				fprintf(stderr, "%s: bad cache thread count: %s\n",
+					progname, optarg);
+				usage(progname, 1);
+			}
+			break;
+		case 'S':
+			preseed_threads = atoi (optarg);
+			if (preseed_threads < 0 || preseed_threads > MAX_THREADS) {
+				fprintf(stderr, "%s: bad preseed thread count: %s\n",
+					progname, optarg);
+				usage(progname, 1);
+			}
+			break;
 		case 'V':
 			vers = atoi(optarg);
 			if (vers < 2 || vers > 4) {
@@ -803,10 +1137,12 @@ main(int argc, char **argv)
 		fprintf(stderr, "%s: getrlimit (RLIMIT_NOFILE) failed: %s\n",
 				progname, strerror(errno));
 	else {
+#ifndef HAVE_LIBTIRPC
 		/* glibc sunrpc code dies if getdtablesize > FD_SETSIZE */
 		if ((descriptors == 0 && rlim.rlim_cur > FD_SETSIZE) ||
 		    descriptors > FD_SETSIZE)
 			descriptors = FD_SETSIZE;
+#endif
 		if (descriptors) {
 			rlim.rlim_cur = descriptors;
 			if (setrlimit (RLIMIT_NOFILE, &rlim) != 0) {
@@ -857,6 +1193,9 @@ main(int argc, char **argv)
 	sa.sa_handler = sig_hup;
 	sigaction(SIGHUP, &sa, NULL);
 
+	/* Before anything is timed, and before any fork */
+	stats_open(_PATH_MOUNTD_STATS);
+
 	auth_init();
 
 	if (!foreground) {
@@ -887,8 +1226,20 @@ main(int argc, char **argv)
 	else if (num_threads > MAX_THREADS)
 		num_threads = MAX_THREADS;
 
-	if (num_threads > 1)
+	if (num_threads > 1) {
+		etab_share_init();
 		fork_workers();
+	}
+
+	if (new_cache) {
+		if (cache_threads > 0)
+			cache_start_threads(cache_threads);
+		host_resolver_start(RESOLVER_THREADS);
+		if (manage_gids)
+			gid_cache_start(RESOLVER_THREADS);
+		if (preseed_threads > 0)
+			cache_preseed_start(preseed_threads);
+	}
 
 	xlog(L_NOTICE, "Version " VERSION " starting");
 	my_svc_run();
@@ -908,6 +1259,8 @@ usage(const char *prog, int n)
 "	[-N version|--no-nfs-version version] [-n|--no-tcp]\n"
 "	[-H prog |--ha-callout prog] [-r |--reverse-lookup]\n"
 "	[-s|--state-directory-path path] [-g|--manage-gids]\n"
-"	[-t num|--num-threads=num] [-u|--no-udp]\n", prog);
+"	[-G secs|--netgroup-refresh secs]\n"
+"	[-t num|--num-threads=num] [-T num|--cache-threads=num]\n"
+"	[-S num|--preseed=num] [-u|--no-udp]\n", prog);
 	exit(n);
 }
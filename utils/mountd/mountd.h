@@ -9,6 +9,7 @@
 #ifndef MOUNTD_H
 #define MOUNTD_H
 
+#include <sys/stat.h>
 #include <rpc/rpc.h>
 #include <rpc/svc.h>
 #include "nfslib.h"
@@ -19,10 +20,16 @@ union mountd_arguments {
 	dirpath			dirpath;
 };
 
+/* An EXPORT reply, XDR encoded in advance */
+typedef struct {
+	char *			ee_buf;
+	u_int			ee_len;
+} exports_encoded;
+
 union mountd_results {
 	fhstatus		fstatus;
 	mountlist		mountlist;
-	exports			exports;
+	exports_encoded		exports;
 };
 
 /*
@@ -33,14 +40,28 @@ bool_t		mount_mnt_1_svc(struct svc_req *, dirpath *, fhstatus *);
 bool_t		mount_dump_1_svc(struct svc_req *, void *, mountlist *);
 bool_t		mount_umnt_1_svc(struct svc_req *, dirpath *, void *);
 bool_t		mount_umntall_1_svc(struct svc_req *, void *, void *);
-bool_t		mount_export_1_svc(struct svc_req *, void *, exports *);
-bool_t		mount_exportall_1_svc(struct svc_req *, void *, exports *);
+bool_t		mount_export_1_svc(struct svc_req *, void *, exports_encoded *);
+bool_t		mount_exportall_1_svc(struct svc_req *, void *,
+					exports_encoded *);
+bool_t		xdr_exports_encoded(XDR *, exports_encoded *);
 bool_t		mount_pathconf_2_svc(struct svc_req *, dirpath *, ppathcnf *);
 bool_t		mount_mnt_3_svc(struct svc_req *, dirpath *, mountres3 *);
 
 void		mount_dispatch(struct svc_req *, SVCXPRT *);
 void		auth_init(void);
 unsigned int	auth_reload(void);
+void		etab_share_init(void);
+void *		etab_share_get(const struct stat *stb);
+struct exportent *
+		etab_share_next(void *src);
+void		etab_share_put(void *src);
+void		auth_read_lock(void);
+void		auth_read_unlock(void);
+int		auth_read_suspend(void);
+void		auth_read_resume(int depth);
+void		auth_prepare(const struct addrinfo *ai);
+struct addrinfo *
+		auth_resolve(const struct sockaddr *sap);
 nfs_export *	auth_authenticate(const char *what,
 					const struct sockaddr *caller,
 					const char *path);
@@ -50,11 +71,39 @@ void		mountlist_add(char *host, const char *path);
 void		mountlist_del(char *host, const char *path);
 void		mountlist_del_all(const struct sockaddr *sap);
 mountlist	mountlist_list(void);
+mountlist	mountlist_copy(void);
+void		mountlist_freeall(mountlist list);
 
 void		cache_open(void);
+void		cache_start_threads(int nthreads);
 struct nfs_fh_len *
 		cache_get_filehandle(nfs_export *exp, int len, char *p);
 int		cache_export(nfs_export *exp, char *path);
+int		cache_export_root(nfs_export *exp, dev_t *dev, int *mounted);
+struct nfs_fh_len *
+		cache_mount_filehandle(nfs_export *exp, int len, char *p,
+					const struct stat *stb);
+void		cache_forget_export(nfs_export *exp);
+void		cache_forget_exports(void);
+int		cache_preseed_client(const char *client, char **paths,
+					int npaths);
+unsigned int	cache_preseed_start(unsigned int nthreads);
+
+/*
+ * Most groups an auth.unix.gid reply has room for: each group id
+ * takes at most 11 characters of a RPC_CHAN_BUF_SIZE buffer.
+ */
+#define AUTH_UNIX_GID_MAX	((RPC_CHAN_BUF_SIZE - 64) / 11)
+
+typedef void	(*gid_cache_cb)(uid_t uid, const gid_t *groups, int ngroups,
+				time_t fetched, void *data);
+unsigned int	gid_cache_start(unsigned int nthreads);
+void		gid_cache_lookup(uid_t uid, gid_cache_cb cb, void *data);
+
+void		stats_open(const char *path);
+void		stats_close(void);
+void		stats_watch_fd(void);
+int		stats_process_req(int fd);
 
 bool ipaddr_client_matches(nfs_export *exp, struct addrinfo *ai);
 bool namelist_client_matches(nfs_export *exp, char *dom);
@@ -0,0 +1,245 @@
+/*
+ * utils/mountd/preseed.c
+ *
+ * Load the kernel's export caches for known clients ahead of demand.
+ *
+ * After a restart, or once the export table changes, the kernel
+ * caches are empty, and each client's first requests wait on
+ * auth.unix.ip and nfsd.export upcalls.  With --preseed, the clients
+ * recorded in rmtab are answered up front instead: a pool of threads
+ * writes each client's auth.unix.ip entry, and the nfsd.export
+ * entries for the paths it has mounted, as the upcalls would have.
+ * The export table is checked for changes every PRESEED_INTERVAL
+ * seconds.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "xlog.h"
+#include "hashtable.h"
+#include "latency.h"
+#include "mountd.h"
+
+#define PRESEED_INTERVAL	5
+
+/* One client, and the paths it has mounted */
+struct preseed_client {
+	struct hash_node	p_node;
+	struct preseed_client *	p_next;
+	char *			p_client;
+	char **			p_paths;
+	int			p_npaths;
+};
+
+static pthread_mutex_t		preseed_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		preseed_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t		preseed_done = PTHREAD_COND_INITIALIZER;
+static struct preseed_client *	preseed_queue;
+static unsigned int		preseed_pending;	/* queued or running */
+static unsigned int		preseed_written;
+
+static struct preseed_client *
+preseed_find(struct hash_table *tbl, struct preseed_client **list,
+		const char *client)
+{
+	unsigned int hash = hash_string(client);
+	struct preseed_client *c;
+	struct hash_node *n;
+
+	for (n = hash_lookup(tbl, hash); n; n = hash_lookup_next(n)) {
+		c = hash_entry(n, struct preseed_client, p_node);
+		if (strcmp(c->p_client, client) == 0)
+			return c;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return NULL;
+	c->p_client = strdup(client);
+	if (c->p_client == NULL) {
+		free(c);
+		return NULL;
+	}
+	hash_insert(tbl, &c->p_node, hash);
+	c->p_next = *list;
+	*list = c;
+	return c;
+}
+
+static void preseed_free(struct preseed_client *c)
+{
+	int i;
+
+	for (i = 0; i < c->p_npaths; i++)
+		free(c->p_paths[i]);
+	free(c->p_paths);
+	free(c->p_client);
+	free(c);
+}
+
+/*
+ * Group the mount list by client, so each client's auth.unix.ip
+ * entry is written once.
+ */
+static struct preseed_client *preseed_clients(unsigned int *count)
+{
+	struct hash_table tbl = HASH_TABLE_INIT;
+	struct preseed_client *list = NULL, *c;
+	mountlist mlist, m;
+	char **paths;
+
+	*count = 0;
+	mlist = mountlist_copy();
+	for (m = mlist; m; m = m->ml_next) {
+		c = preseed_find(&tbl, &list, m->ml_hostname);
+		if (c == NULL)
+			goto out_nomem;
+		paths = realloc(c->p_paths,
+				(c->p_npaths + 1) * sizeof(*paths));
+		if (paths == NULL)
+			goto out_nomem;
+		c->p_paths = paths;
+		/* The entry now owns the path */
+		paths[c->p_npaths++] = m->ml_directory;
+		m->ml_directory = NULL;
+	}
+	for (c = list; c; c = c->p_next)
+		(*count)++;
+	goto out;
+
+out_nomem:
+	xlog(L_ERROR, "%s: memory allocation failed", __func__);
+	while ((c = list) != NULL) {
+		list = c->p_next;
+		preseed_free(c);
+	}
+out:
+	hash_clear(&tbl);
+	mountlist_freeall(mlist);
+	return list;
+}
+
+static void *preseed_worker(void *UNUSED(arg))
+{
+	struct preseed_client *c;
+	uint64_t start;
+	int n;
+
+	for (;;) {
+		pthread_mutex_lock(&preseed_lock);
+		while (preseed_queue == NULL)
+			pthread_cond_wait(&preseed_cond, &preseed_lock);
+		c = preseed_queue;
+		preseed_queue = c->p_next;
+		pthread_mutex_unlock(&preseed_lock);
+
+		start = latency_start();
+		n = cache_preseed_client(c->p_client, c->p_paths,
+					 c->p_npaths);
+		preseed_free(c);
+		latency_record(LAT_PRESEED_CLIENT, start);
+
+		pthread_mutex_lock(&preseed_lock);
+		preseed_written += n;
+		if (--preseed_pending == 0)
+			pthread_cond_signal(&preseed_done);
+		pthread_mutex_unlock(&preseed_lock);
+	}
+	return NULL;
+}
+
+/* Hand every known client to the workers, and wait for them */
+static void preseed_pass(void)
+{
+	struct preseed_client *list, *tail;
+	unsigned int nclients, written;
+	uint64_t start;
+
+	start = latency_start();
+	list = preseed_clients(&nclients);
+	if (list == NULL)
+		return;
+	for (tail = list; tail->p_next; tail = tail->p_next)
+		;
+
+	pthread_mutex_lock(&preseed_lock);
+	tail->p_next = preseed_queue;
+	preseed_queue = list;
+	preseed_pending += nclients;
+	preseed_written = 0;
+	pthread_cond_broadcast(&preseed_cond);
+	while (preseed_pending)
+		pthread_cond_wait(&preseed_done, &preseed_lock);
+	written = preseed_written;
+	pthread_mutex_unlock(&preseed_lock);
+
+	latency_record(LAT_PRESEED_PASS, start);
+	xlog(D_GENERAL, "preseeded %u exports for %u clients",
+	     written, nclients);
+}
+
+static void *preseed_thread(void *UNUSED(arg))
+{
+	unsigned int gen, last = 0;
+
+	for (;;) {
+		gen = auth_reload();
+		if (gen != last) {
+			last = gen;
+			preseed_pass();
+		}
+		sleep(PRESEED_INTERVAL);
+	}
+	return NULL;
+}
+
+/**
+ * cache_preseed_start - keep the kernel caches loaded for known clients
+ * @nthreads: number of threads writing cache entries
+ *
+ * Returns the number of worker threads started.  Must be called after
+ * any fork().
+ */
+unsigned int cache_preseed_start(unsigned int nthreads)
+{
+	sigset_t set, oldset;
+	pthread_attr_t attr;
+	pthread_t thread;
+	unsigned int started = 0;
+	int err;
+
+	/* Signals are for the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (; nthreads; nthreads--) {
+		err = pthread_create(&thread, &attr, preseed_worker, NULL);
+		if (err != 0) {
+			xlog(L_ERROR, "%s: can't start preseed thread: %s",
+				__func__, strerror(err));
+			break;
+		}
+		started++;
+	}
+	if (started) {
+		err = pthread_create(&thread, &attr, preseed_thread, NULL);
+		if (err != 0)
+			xlog(L_ERROR, "%s: can't start preseed thread: %s",
+				__func__, strerror(err));
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	return started;
+}
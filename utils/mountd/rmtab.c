@@ -3,6 +3,19 @@
  *
  * Manage the rmtab file for mountd.
  *
+ * The mount list is kept in memory, indexed by client and path.
+ * Changes are appended to rmtab as entries carrying the new mount
+ * count, so a MNT or UMNT writes one line instead of the whole file.
+ * When an entry appears more than once, the last one wins, and a
+ * count of zero means the client has unmounted.  Once most of the
+ * file is superseded entries, it is rewritten from memory.
+ *
+ * Worker processes share the file: before using its copy, each one
+ * reads whatever the others have appended since it last looked, and
+ * starts over when another process has rewritten the file.  Within
+ * a process, rmtab_mutex serializes threads, which the file lock
+ * does not.
+ *
  * Copyright (C) 1995, 1996 Olaf Kirch <okir@monad.swb.de>
  */
 
@@ -16,10 +29,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <pthread.h>
 
 #include "misc.h"
 #include "exportfs.h"
 #include "xio.h"
+#include "xmalloc.h"
+#include "hashtable.h"
 #include "mountd.h"
 #include "ha-callout.h"
 
@@ -28,6 +44,32 @@
 
 extern int reverse_resolve;
 
+/* Don't bother rewriting rmtab until it has this many entries */
+#define RMTAB_COMPACT_MIN	1024
+
+struct rmtab_entry {
+	struct hash_node	r_node;
+	struct rmtab_entry *	r_next;
+	struct rmtab_entry **	r_pprev;
+	char *			r_client;
+	char *			r_path;
+	int			r_count;
+};
+
+static struct hash_table	rmtab_hash = HASH_TABLE_INIT;
+static struct rmtab_entry *	rmtab_head;
+static struct rmtab_entry **	rmtab_tail = &rmtab_head;
+
+/*
+ * The file the in-memory table was read from.  Keeping it open
+ * stops its inode number from being reused by a later rewrite.
+ */
+static FILE *		rmtab_fp;
+static off_t		rmtab_offset;
+static unsigned int	rmtab_lines;	/* entries in the file */
+static unsigned long	rmtab_gen;	/* bumped on every change */
+static pthread_mutex_t	rmtab_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* If new path is a link do not destroy it but place the
  * file where the link points.
  */
@@ -51,95 +93,298 @@ slink_safe_rename(const char * oldpath, const char * newpath)
 	return rename(oldpath, real_newpath);
 }
 
+static unsigned int
+rmtab_hashval(const char *client, const char *path)
+{
+	return hash_string(client) * 31 + hash_string(path);
+}
+
+static struct rmtab_entry *
+rmtab_lookup(const char *client, const char *path)
+{
+	unsigned int hash = rmtab_hashval(client, path);
+	struct hash_node *node;
+
+	for (node = hash_lookup(&rmtab_hash, hash); node;
+	     node = hash_lookup_next(node)) {
+		struct rmtab_entry *r;
+
+		r = hash_entry(node, struct rmtab_entry, r_node);
+		if (strcmp(r->r_client, client) == 0 &&
+		    strcmp(r->r_path, path) == 0)
+			return r;
+	}
+	return NULL;
+}
+
+static void
+rmtab_unlink(struct rmtab_entry *r)
+{
+	hash_remove(&rmtab_hash, &r->r_node);
+	*r->r_pprev = r->r_next;
+	if (r->r_next)
+		r->r_next->r_pprev = r->r_pprev;
+	else
+		rmtab_tail = r->r_pprev;
+	free(r->r_client);
+	free(r->r_path);
+	free(r);
+	rmtab_gen++;
+}
+
+/*
+ * Record that @client has @count mounts of @path.
+ */
+static void
+rmtab_set(const char *client, const char *path, int count)
+{
+	struct rmtab_entry *r = rmtab_lookup(client, path);
+
+	if (count <= 0) {
+		if (r)
+			rmtab_unlink(r);
+		return;
+	}
+	if (r == NULL) {
+		r = xmalloc(sizeof(*r));
+		r->r_client = xstrdup(client);
+		r->r_path = xstrdup(path);
+		r->r_next = NULL;
+		r->r_pprev = rmtab_tail;
+		*rmtab_tail = r;
+		rmtab_tail = &r->r_next;
+		hash_insert(&rmtab_hash, &r->r_node,
+				rmtab_hashval(client, path));
+	} else if (r->r_count == count)
+		return;
+	r->r_count = count;
+	rmtab_gen++;
+}
+
+/*
+ * Drop the file; the next rmtab_sync() reads it again from scratch.
+ */
+static void
+rmtab_forget(void)
+{
+	if (rmtab_fp)
+		fclose(rmtab_fp);
+	rmtab_fp = NULL;
+	rmtab_offset = 0;
+}
+
+static void
+rmtab_clear(void)
+{
+	while (rmtab_head)
+		rmtab_unlink(rmtab_head);
+	hash_clear(&rmtab_hash);
+	rmtab_lines = 0;
+}
+
+/*
+ * Bring the in-memory table up to date with rmtab.  The caller
+ * holds the rmtab lock.
+ */
+static int
+rmtab_sync(void)
+{
+	struct rmtabent	*rep;
+	struct stat	stb, cur;
+
+	if (stat(_PATH_RMTAB, &stb) < 0) {
+		if (errno != ENOENT) {
+			xlog(L_ERROR, "can't stat %s: %s",
+					_PATH_RMTAB, strerror(errno));
+			return -1;
+		}
+		rmtab_clear();
+		rmtab_forget();
+		return 0;
+	}
+
+	/* Rewritten or truncated by someone else */
+	if (rmtab_fp == NULL || fstat(fileno(rmtab_fp), &cur) < 0 ||
+	    cur.st_dev != stb.st_dev || cur.st_ino != stb.st_ino ||
+	    stb.st_size < rmtab_offset) {
+		rmtab_clear();
+		rmtab_forget();
+		if (!(rmtab_fp = fsetrmtabent(_PATH_RMTAB, "r")))
+			return -1;
+	}
+	if (stb.st_size == rmtab_offset)
+		return 0;
+
+	if (fseeko(rmtab_fp, rmtab_offset, SEEK_SET) < 0) {
+		rmtab_forget();
+		return -1;
+	}
+	for (;;) {
+		if ((rep = fgetrmtabent(rmtab_fp, 1, NULL)) == NULL) {
+			if (errno == EINVAL)
+				continue;
+			break;
+		}
+		rmtab_set(rep->r_client, rep->r_path, rep->r_count);
+		rmtab_lines++;
+	}
+	rmtab_offset = ftello(rmtab_fp);
+	return 0;
+}
+
+/*
+ * Rewrite rmtab with one entry per live mount.  The caller holds
+ * the rmtab lock exclusively.
+ */
+static void
+rmtab_compact(void)
+{
+	struct rmtab_entry *r;
+	struct rmtabent	xe;
+	struct stat	stb;
+	FILE		*fp;
+	unsigned int	n = 0;
+
+	if (!(fp = fsetrmtabent(_PATH_RMTABTMP, "w")))
+		return;
+	for (r = rmtab_head; r; r = r->r_next) {
+		strcpy(xe.r_client, r->r_client);
+		strcpy(xe.r_path, r->r_path);
+		xe.r_count = r->r_count;
+		fputrmtabent(fp, &xe, NULL);
+		n++;
+	}
+	if (fflush(fp) != 0 || fstat(fileno(fp), &stb) < 0) {
+		xlog(L_ERROR, "couldn't write %s: %m", _PATH_RMTABTMP);
+		fendrmtabent(fp);
+		unlink(_PATH_RMTABTMP);
+		return;
+	}
+	fendrmtabent(fp);
+	if (slink_safe_rename(_PATH_RMTABTMP, _PATH_RMTAB) < 0) {
+		xlog(L_ERROR, "couldn't rename %s to %s",
+				_PATH_RMTABTMP, _PATH_RMTAB);
+		unlink(_PATH_RMTABTMP);
+		return;
+	}
+	rmtab_forget();
+	if (!(rmtab_fp = fsetrmtabent(_PATH_RMTAB, "r")))
+		return;
+	rmtab_offset = stb.st_size;
+	rmtab_lines = n;
+}
+
+/*
+ * Append the current state of @client's mounts of @path to rmtab.
+ * The caller holds the rmtab lock exclusively.
+ */
+static void
+rmtab_append(const char *client, const char *path, int count)
+{
+	static int	have_new_cache = -1;
+	struct rmtabent	xe;
+	struct stat	stb, cur;
+	FILE		*fp;
+
+	if (have_new_cache == -1)
+		have_new_cache = check_new_cache();
+
+	strcpy(xe.r_client, client);
+	strcpy(xe.r_path, path);
+	xe.r_count = count;
+	if (!(fp = fsetrmtabent(_PATH_RMTAB, "a")))
+		return;
+	fputrmtabent(fp, &xe, NULL);
+	if (rmtab_fp && fflush(fp) == 0 && fstat(fileno(fp), &stb) == 0 &&
+	    fstat(fileno(rmtab_fp), &cur) == 0 &&
+	    stb.st_dev == cur.st_dev && stb.st_ino == cur.st_ino) {
+		rmtab_offset = stb.st_size;
+		rmtab_lines++;
+	} else {
+		/* Created just now, or gone wrong: read it all again */
+		rmtab_forget();
+	}
+	fendrmtabent(fp);
+
+	/*
+	 * With the old caching interface, exportfs reads rmtab and
+	 * expects one entry per mount, so keep the file compact.
+	 */
+	if (!have_new_cache ||
+	    (rmtab_lines >= RMTAB_COMPACT_MIN &&
+	     rmtab_lines > 2 * rmtab_hash.h_count))
+		rmtab_compact();
+}
+
 void
 mountlist_add(char *host, const char *path)
 {
+	struct rmtab_entry *r;
 	struct rmtabent	xe;
-	struct rmtabent	*rep;
 	int		lockid;
-	long		pos;
+	int		count;
 
+	pthread_mutex_lock(&rmtab_mutex);
 	if ((lockid = xflock(_PATH_RMTABLCK, "a")) < 0)
-		return;
-	setrmtabent("r+");
-	while ((rep = getrmtabent(1, &pos)) != NULL) {
-		if (strcmp (rep->r_client,
-			    host) == 0
-		    && strcmp(rep->r_path, path) == 0) {
-			rep->r_count++;
-			/* PRC: do the HA callout: */
-			ha_callout("mount", rep->r_client, rep->r_path, rep->r_count);
-			putrmtabent(rep, &pos);
-			endrmtabent();
-			xfunlock(lockid);
-			return;
-		}
-	}
-	endrmtabent();
+		goto out;
+	if (rmtab_sync() < 0)
+		goto out_unlock;
+
 	strncpy(xe.r_client, host,
 		sizeof (xe.r_client) - 1);
 	xe.r_client [sizeof (xe.r_client) - 1] = '\0';
 	strncpy(xe.r_path, path, sizeof (xe.r_path) - 1);
 	xe.r_path [sizeof (xe.r_path) - 1] = '\0';
-	xe.r_count = 1;
-	if (setrmtabent("a")) {
-		/* PRC: do the HA callout: */
-		ha_callout("mount", xe.r_client, xe.r_path, xe.r_count);
-		putrmtabent(&xe, NULL);
-		endrmtabent();
-	}
+
+	r = rmtab_lookup(xe.r_client, xe.r_path);
+	count = r ? r->r_count + 1 : 1;
+	rmtab_set(xe.r_client, xe.r_path, count);
+	/* PRC: do the HA callout: */
+	ha_callout("mount", xe.r_client, xe.r_path, count);
+	rmtab_append(xe.r_client, xe.r_path, count);
+out_unlock:
 	xfunlock(lockid);
+out:
+	pthread_mutex_unlock(&rmtab_mutex);
 }
 
 void
 mountlist_del(char *hname, const char *path)
 {
-	struct rmtabent	*rep;
-	FILE		*fp;
+	struct rmtab_entry *r;
 	int		lockid;
-	int		match;
+	int		count;
 
+	pthread_mutex_lock(&rmtab_mutex);
 	if ((lockid = xflock(_PATH_RMTABLCK, "w")) < 0)
-		return;
-	if (!setrmtabent("r")) {
-		xfunlock(lockid);
-		return;
-	}
-	if (!(fp = fsetrmtabent(_PATH_RMTABTMP, "w"))) {
-		endrmtabent();
-		xfunlock(lockid);
-		return;
-	}
-	while ((rep = getrmtabent(1, NULL)) != NULL) {
-		match = !strcmp (rep->r_client, hname)
-			&& !strcmp(rep->r_path, path);
-		if (match) {
-			rep->r_count--;
-			/* PRC: do the HA callout: */
-			ha_callout("unmount", rep->r_client, rep->r_path, rep->r_count);
-		}
-		if (!match || rep->r_count)
-			fputrmtabent(fp, rep, NULL);
-	}
-	if (slink_safe_rename(_PATH_RMTABTMP, _PATH_RMTAB) < 0) {
-		xlog(L_ERROR, "couldn't rename %s to %s",
-				_PATH_RMTABTMP, _PATH_RMTAB);
+		goto out;
+	if (rmtab_sync() < 0)
+		goto out_unlock;
+
+	r = rmtab_lookup(hname, path);
+	if (r != NULL) {
+		count = r->r_count - 1;
+		/* PRC: do the HA callout: */
+		ha_callout("unmount", r->r_client, r->r_path, count);
+		rmtab_set(hname, path, count);
+		rmtab_append(hname, path, count);
 	}
-	endrmtabent();	/* close & unlink */
-	fendrmtabent(fp);
+out_unlock:
 	xfunlock(lockid);
+out:
+	pthread_mutex_unlock(&rmtab_mutex);
 }
 
 void
 mountlist_del_all(const struct sockaddr *sap)
 {
+	struct rmtab_entry *r, *next;
 	char		*hostname;
-	struct rmtabent	*rep;
-	FILE		*fp;
 	int		lockid;
 
+	pthread_mutex_lock(&rmtab_mutex);
 	if ((lockid = xflock(_PATH_RMTABLCK, "w")) < 0)
-		return;
+		goto out;
 	hostname = host_canonname(sap);
 	if (hostname == NULL) {
 		char buf[INET6_ADDRSTRLEN];
@@ -147,33 +392,35 @@ mountlist_del_all(const struct sockaddr *sap)
 			host_ntop(sap, buf, sizeof(buf)));
 		goto out_unlock;
 	}
-
-	if (!setrmtabent("r"))
+	if (rmtab_sync() < 0)
 		goto out_free;
 
-	if (!(fp = fsetrmtabent(_PATH_RMTABTMP, "w")))
-		goto out_close;
+	for (r = rmtab_head; r; r = next) {
+		struct rmtabent	xe;
 
-	while ((rep = getrmtabent(1, NULL)) != NULL) {
-		if (strcmp(rep->r_client, hostname) == 0 &&
-		    auth_authenticate("umountall", sap, rep->r_path) != NULL)
+		next = r->r_next;
+		if (strcmp(r->r_client, hostname) != 0 ||
+		    auth_authenticate("umountall", sap, r->r_path) == NULL)
 			continue;
-		fputrmtabent(fp, rep, NULL);
-	}
-	if (slink_safe_rename(_PATH_RMTABTMP, _PATH_RMTAB) < 0) {
-		xlog(L_ERROR, "couldn't rename %s to %s",
-				_PATH_RMTABTMP, _PATH_RMTAB);
+		strcpy(xe.r_client, r->r_client);
+		strcpy(xe.r_path, r->r_path);
+		rmtab_unlink(r);
+		rmtab_append(xe.r_client, xe.r_path, 0);
 	}
-	fendrmtabent(fp);
-out_close:
-	endrmtabent();	/* close & unlink */
 out_free:
 	free(hostname);
 out_unlock:
 	xfunlock(lockid);
+out:
+	pthread_mutex_unlock(&rmtab_mutex);
 }
 
-static void
+/**
+ * mountlist_freeall - free a list returned by mountlist_copy()
+ * @list: list to free
+ *
+ */
+void
 mountlist_freeall(mountlist list)
 {
 	while (list != NULL) {
@@ -189,31 +436,34 @@ mountlist
 mountlist_list(void)
 {
 	static mountlist	mlist = NULL;
-	static time_t		last_mtime = 0;
+	static unsigned long	mlist_gen = 0;
+	static int		mlist_valid = 0;
 	mountlist		m;
-	struct rmtabent		*rep;
-	struct stat		stb;
+	struct rmtab_entry	*r;
 	int			lockid;
 
-	if ((lockid = xflock(_PATH_RMTABLCK, "r")) < 0)
+	pthread_mutex_lock(&rmtab_mutex);
+	if ((lockid = xflock(_PATH_RMTABLCK, "r")) < 0) {
+		pthread_mutex_unlock(&rmtab_mutex);
 		return NULL;
-	if (stat(_PATH_RMTAB, &stb) < 0) {
-		xlog(L_ERROR, "can't stat %s: %s",
-				_PATH_RMTAB, strerror(errno));
+	}
+	if (rmtab_sync() < 0) {
 		xfunlock(lockid);
+		pthread_mutex_unlock(&rmtab_mutex);
 		return NULL;
 	}
-	if (stb.st_mtime != last_mtime) {
+	if (!mlist_valid || rmtab_gen != mlist_gen) {
 		mountlist_freeall(mlist);
 		mlist = NULL;
-		last_mtime = stb.st_mtime;
+		mlist_gen = rmtab_gen;
+		mlist_valid = 1;
 
-		setrmtabent("r");
-		while ((rep = getrmtabent(1, NULL)) != NULL) {
+		for (r = rmtab_head; r; r = r->r_next) {
 			m = calloc(1, sizeof(*m));
 			if (m == NULL) {
 				mountlist_freeall(mlist);
 				mlist = NULL;
+				mlist_valid = 0;
 				xlog(L_ERROR, "%s: memory allocation failed",
 						__func__);
 				break;
@@ -221,20 +471,21 @@ mountlist_list(void)
 
 			if (reverse_resolve) {
 				struct addrinfo *ai;
-				ai = host_pton(rep->r_client);
+				ai = host_pton(r->r_client);
 				if (ai != NULL) {
 					m->ml_hostname = host_canonname(ai->ai_addr);
 					freeaddrinfo(ai);
 				}
 			}
 			if (m->ml_hostname == NULL)
-				m->ml_hostname = strdup(rep->r_client);
+				m->ml_hostname = strdup(r->r_client);
 
-			m->ml_directory = strdup(rep->r_path);
+			m->ml_directory = strdup(r->r_path);
 
 			if (m->ml_hostname == NULL || m->ml_directory == NULL) {
 				mountlist_freeall(mlist);
 				mlist = NULL;
+				mlist_valid = 0;
 				xlog(L_ERROR, "%s: memory allocation failed",
 						__func__);
 				break;
@@ -243,9 +494,54 @@ mountlist_list(void)
 			m->ml_next = mlist;
 			mlist = m;
 		}
-		endrmtabent();
 	}
 	xfunlock(lockid);
+	pthread_mutex_unlock(&rmtab_mutex);
+
+	return mlist;
+}
 
+/**
+ * mountlist_copy - take a private copy of the mount list
+ *
+ * Unlike mountlist_list(), no reverse lookups are done, and the
+ * result belongs to the caller, so any thread may use it.  Returns
+ * a list to be freed with mountlist_freeall(), or NULL if there are
+ * no mounts or something went wrong.
+ */
+mountlist
+mountlist_copy(void)
+{
+	mountlist		mlist = NULL, m;
+	struct rmtab_entry	*r;
+	int			lockid;
+
+	pthread_mutex_lock(&rmtab_mutex);
+	if ((lockid = xflock(_PATH_RMTABLCK, "r")) < 0)
+		goto out;
+	if (rmtab_sync() < 0)
+		goto out_unlock;
+
+	for (r = rmtab_head; r; r = r->r_next) {
+		m = calloc(1, sizeof(*m));
+		if (m == NULL)
+			goto out_nomem;
+		m->ml_next = mlist;
+		mlist = m;
+		m->ml_hostname = strdup(r->r_client);
+		m->ml_directory = strdup(r->r_path);
+		if (m->ml_hostname == NULL || m->ml_directory == NULL)
+			goto out_nomem;
+	}
+	goto out_unlock;
+
+out_nomem:
+	xlog(L_ERROR, "%s: memory allocation failed", __func__);
+	mountlist_freeall(mlist);
+	mlist = NULL;
+out_unlock:
+	xfunlock(lockid);
+out:
+	pthread_mutex_unlock(&rmtab_mutex);
 	return mlist;
 }
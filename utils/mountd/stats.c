@@ -0,0 +1,160 @@
+/*
+ * utils/mountd/stats.c
+ *
+ * Report mountd's counters on a local socket.
+ *
+ * Every connection to the socket gets a text dump of the counters
+ * kept by latency.c, and is then closed.  All mountd processes watch
+ * the same listening socket; whichever accepts a connection answers
+ * it, and the counters are shared, so the answer covers them all.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "nfslib.h"
+#include "rpcmisc.h"
+#include "latency.h"
+#include "mountd.h"
+
+static int stats_fd = -1;
+static const char *stats_path;
+static pid_t stats_owner;	/* the process that created the socket */
+
+/**
+ * stats_open - start collecting counters and create the stats socket
+ * @path: pathname of the socket
+ *
+ * Call before forking worker processes.  Failure is logged and
+ * mountd carries on without the socket.
+ */
+void stats_open(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (latency_init() < 0)
+		return;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		xlog(L_ERROR, "stats socket path %s is too long", path);
+		return;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		xlog(L_ERROR, "can't create stats socket: %m");
+		return;
+	}
+	/* A socket left behind by an earlier mountd */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    chmod(path, S_IRUSR | S_IWUSR) < 0 ||
+	    listen(fd, 8) < 0) {
+		xlog(L_ERROR, "can't set up stats socket %s: %m", path);
+		close(fd);
+		unlink(path);
+		return;
+	}
+	stats_fd = fd;
+	stats_path = path;
+	stats_owner = getpid();
+}
+
+/**
+ * stats_close - remove the stats socket
+ *
+ * Only the process that created the socket removes it, so a worker
+ * exiting leaves it to the others.  Safe to call from a signal
+ * handler.
+ */
+void stats_close(void)
+{
+	if (stats_path && getpid() == stats_owner)
+		unlink(stats_path);
+}
+
+/**
+ * stats_watch_fd - add the stats socket to the service loop
+ *
+ */
+void stats_watch_fd(void)
+{
+	if (stats_fd >= 0 && nfs_svc_epoll_watch(stats_fd) < 0)
+		xlog(L_ERROR, "can't watch stats socket: %m");
+}
+
+/*
+ * The report fits in the socket buffer, so a reader that can't take
+ * it at once is not reading; it is dropped rather than waited for.
+ */
+static void stats_write(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/**
+ * stats_process_req - answer a connection to the stats socket
+ * @fd: descriptor reported ready by the service loop
+ *
+ * Returns 1 if @fd was the stats socket, otherwise zero.
+ */
+int stats_process_req(int fd)
+{
+	struct cache_io_stats cs;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int conn;
+
+	if (stats_fd < 0 || fd != stats_fd)
+		return 0;
+
+	/* Another process may have taken it */
+	conn = accept4(stats_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (conn < 0)
+		return 1;
+
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL) {
+		close(conn);
+		return 1;
+	}
+	latency_report(fp);
+	cache_io_get_stats(&cs);
+	fprintf(fp, "# cache channel I/O of process %d\n", getpid());
+	fprintf(fp, "cacheio upcalls %lu wakeups %lu replies %lu "
+		"writes %lu errors %lu\n", cs.cs_upcalls, cs.cs_wakeups,
+		cs.cs_replies, cs.cs_writes, cs.cs_errors);
+	fclose(fp);
+
+	stats_write(conn, buf, len);
+	free(buf);
+	close(conn);
+	return 1;
+}
@@ -37,7 +37,6 @@
 /* 
  * Allow svc_run to listen to other file descriptors as well
  */
-
 /* 
  * This is the RPC server side idle loop.
  * Wait for input, call server program.
@@ -49,74 +48,54 @@
 
 #include <sys/types.h>
 #include <rpc/rpc.h>
+#include "rpcmisc.h"
 #include "xlog.h"
 #include <errno.h>
 #include <time.h>
 
-#ifdef HAVE_LIBTIRPC
-#include <rpc/rpc_com.h>
-#endif
-
-void cache_set_fds(fd_set *fdset);
-int cache_process_req(fd_set *readfds);
-
-#if defined(__GLIBC__) && LONG_MAX != INT_MAX
-/* bug in glibc 2.3.6 and earlier, we need
- * our own svc_getreqset
- */
-static void
-my_svc_getreqset (fd_set *readfds)
-{
-	fd_mask mask;
-	fd_mask *maskp;
-	int setsize;
-	int sock;
-	int bit;
+#define MY_SVC_MAXEVENTS	32
 
-	setsize = _rpc_dtablesize ();
-	if (setsize > FD_SETSIZE)
-		setsize = FD_SETSIZE;
-	maskp = readfds->fds_bits;
-	for (sock = 0; sock < setsize; sock += NFDBITS)
-		for (mask = *maskp++;
-		     (bit = ffsl (mask));
-		     mask ^= (1L << (bit - 1)))
-			svc_getreq_common (sock + bit - 1);
-}
-#define svc_getreqset my_svc_getreqset
-
-#endif
+void cache_watch_fds(void);
+int cache_process_req(int fd);
+void stats_watch_fd(void);
+int stats_process_req(int fd);
 
 /*
  * The heart of the server.  A crib from libc for the most part...
+ *
+ * Descriptors are waited on with epoll(7) rather than select(2), so
+ * the cost of a wakeup does not grow with the number of idle client
+ * connections, and descriptor numbers are not limited to FD_SETSIZE.
  */
 void
 my_svc_run(void)
 {
-	fd_set	readfds;
-	int	selret;
-
-	for (;;) {
+	int	fds[MY_SVC_MAXEVENTS];
+	int	i, n;
 
-		readfds = svc_fdset;
-		cache_set_fds(&readfds);
-
-		selret = select(FD_SETSIZE, &readfds,
-				(void *) 0, (void *) 0, (struct timeval *) 0);
+	if (nfs_svc_epoll_init() < 0) {
+		xlog(L_ERROR, "my_svc_run() - epoll: %m");
+		return;
+	}
+	cache_watch_fds();
+	stats_watch_fd();
 
+	for (;;) {
+		n = nfs_svc_epoll_wait(fds, MY_SVC_MAXEVENTS, -1);
 
-		switch (selret) {
+		switch (n) {
 		case -1:
 			if (errno == EINTR || errno == ECONNREFUSED
 			 || errno == ENETUNREACH || errno == EHOSTUNREACH)
 				continue;
-			xlog(L_ERROR, "my_svc_run() - select: %m");
+			xlog(L_ERROR, "my_svc_run() - epoll_wait: %m");
 			return;
 
 		default:
-			selret -= cache_process_req(&readfds);
-			if (selret)
-				svc_getreqset(&readfds);
+			for (i = 0; i < n; i++)
+				if (!cache_process_req(fds[i]) &&
+				    !stats_process_req(fds[i]))
+					nfs_svc_epoll_getreq(fds[i]);
 		}
 	}
 }
@@ -16,6 +16,7 @@
 #include <sys/queue.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 #include <unistd.h>
@@ -25,11 +26,21 @@
 #include "exportfs.h"
 #include "nfslib.h"
 #include "misc.h"
+#include "xmalloc.h"
+#include "hashtable.h"
 #include "v4root.h"
 #include "pseudoflavors.h"
+#include "mountd.h"
 
 int v4root_needed;
 
+/* Set while the real exports carry what v4root_set() did to them */
+static int v4root_active;
+
+/* Clients whose pseudo exports must be rebuilt by v4root_update() */
+static nfs_client **v4root_dirty;
+static unsigned int v4root_ndirty, v4root_dirty_size;
+
 static nfs_export pseudo_root = {
 	.m_next = NULL,
 	.m_client = NULL,
@@ -80,30 +91,6 @@ set_pseudofs_security(struct exportent *pseudo, int flags)
 	}
 }
 
-/*
- * Create a pseudo export
- */
-static struct exportent *
-v4root_create(char *path, nfs_export *export)
-{
-	nfs_export *exp;
-	struct exportent eep;
-	struct exportent *curexp = &export->m_export;
-
-	dupexportent(&eep, &pseudo_root.m_export);
-	eep.e_hostname = curexp->e_hostname;
-	strncpy(eep.e_path, path, sizeof(eep.e_path));
-	if (strcmp(path, "/") != 0)
-		eep.e_flags &= ~NFSEXP_FSID;
-	set_pseudofs_security(&eep, curexp->e_flags);
-	exp = export_create(&eep, 0);
-	if (exp == NULL)
-		return NULL;
-	xlog(D_CALL, "v4root_create: path '%s' flags 0x%x", 
-		exp->m_export.e_path, exp->m_export.e_flags);
-	return &exp->m_export;
-}
-
 /*
  * Make sure the kernel has pseudo root support.
  */
@@ -126,53 +113,309 @@ v4root_support(void)
 	return 0;
 }
 
+/*
+ * Set (@force > 0) or clear (@force == 0) the fsid=0 that v4root_set()
+ * forces on exports of "/".  While pseudo roots are in use, etab has
+ * no fsid=0 export, so any real export of "/" with fsid=0 got it from
+ * here.  With @forget, their file system identities are looked up
+ * again, since the fsid is one of them.
+ */
+static void
+v4root_force_root(int force, int forget)
+{
+	nfs_export	*exp;
+	int		i;
+
+	for (i = 0; i < MCL_MAXTYPES; i++) {
+		for (exp = export_first_by_path(i, "/"); exp;
+		     exp = export_next_by_path(exp)) {
+			struct exportent *ep = &exp->m_export;
+
+			if (ep->e_flags & NFSEXP_V4ROOT)
+				continue;
+			if (forget)
+				cache_forget_export(exp);
+			if (force > 0 && !(ep->e_flags & NFSEXP_FSID)) {
+				ep->e_flags |= NFSEXP_FSID;
+				ep->e_fsid = 0;
+			} else if (force == 0 && (ep->e_flags & NFSEXP_FSID) &&
+				   ep->e_fsid == 0)
+				ep->e_flags &= ~NFSEXP_FSID;
+		}
+	}
+}
+
+/**
+ * v4root_reset - prepare the export table to be compared with etab
+ *
+ * Undoes what v4root_set() did to the real exports, so that those
+ * whose etab entry did not change compare equal to it.  Must be
+ * followed by v4root_update().
+ */
+void
+v4root_reset(void)
+{
+	if (v4root_active)
+		v4root_force_root(0, 0);
+}
+
+/**
+ * v4root_changed - note an export added, changed or removed by a reload
+ * @exp: the export
+ *
+ * The pseudo exports of @exp's client are rebuilt by the next
+ * v4root_update().
+ */
+void
+v4root_changed(nfs_export *exp)
+{
+	nfs_client *clp = exp->m_client;
+
+	if (v4root_ndirty && v4root_dirty[v4root_ndirty - 1] == clp)
+		return;
+	if (v4root_ndirty == v4root_dirty_size) {
+		v4root_dirty_size = v4root_dirty_size ?
+					v4root_dirty_size << 1 : 16;
+		v4root_dirty = xrealloc(v4root_dirty, v4root_dirty_size *
+					sizeof(*v4root_dirty));
+	}
+	v4root_dirty[v4root_ndirty++] = clp;
+}
+
+static int
+v4root_client_cmp(const void *a, const void *b)
+{
+	const nfs_client *u = *(nfs_client * const *)a;
+	const nfs_client *v = *(nfs_client * const *)b;
+
+	return u < v ? -1 : u > v;
+}
+
 static int
-pseudofs_update(char *hostname, char *path, nfs_export *source)
+v4root_is_dirty(const nfs_client *clp)
+{
+	return bsearch(&clp, v4root_dirty, v4root_ndirty,
+		       sizeof(*v4root_dirty), v4root_client_cmp) != NULL;
+}
+
+/*
+ * Pseudo exports are worked out on a trie of the real exports' paths.
+ * Each node stands for a path prefix ending just before a '/', and
+ * the empty prefix, like "/" itself, stands for the root.  A client needs a pseudo export
+ * at every node above one of its exports, unless it has a real
+ * export there too.  All of this is found by walking each export's
+ * path once, without looking anything up in the export table.
+ */
+struct v4root_node {
+	struct hash_node	n_hash;
+	struct v4root_node *	n_parent;
+	const char *		n_name;		/* in some export's e_path */
+	size_t			n_len;
+};
+
+/* What one client has at one node */
+struct v4root_entry {
+	struct hash_node	v_hash;
+	struct v4root_entry *	v_next;		/* in the order first seen */
+	struct v4root_node *	v_node;
+	nfs_client *		v_client;
+	nfs_export *		v_source;	/* first export at or below */
+	size_t			v_len;		/* of the prefix of its path */
+	int			v_flags;	/* security of all of them */
+	int			v_real;
+};
+
+#define V4ROOT_SECURITY		(NFSEXP_INSECURE_PORT | NFSEXP_ROOTSQUASH)
+
+struct v4root_trie {
+	struct hash_table	t_nodes;
+	struct hash_table	t_entries;
+	struct v4root_entry *	t_head;
+	struct v4root_entry **	t_tail;
+};
+
+static struct v4root_node *
+v4root_child(struct v4root_trie *t, struct v4root_node *parent,
+	     const char *name, size_t len)
 {
+	unsigned int hash = hash_bytes(name, len) ^
+			    hash_bytes(&parent, sizeof(parent));
+	struct v4root_node *node;
+	struct hash_node *n;
+
+	for (n = hash_lookup(&t->t_nodes, hash); n; n = hash_lookup_next(n)) {
+		node = hash_entry(n, struct v4root_node, n_hash);
+		if (node->n_parent == parent && node->n_len == len &&
+		    memcmp(node->n_name, name, len) == 0)
+			return node;
+	}
+
+	node = xmalloc(sizeof(*node));
+	node->n_parent = parent;
+	node->n_name = name;
+	node->n_len = len;
+	hash_insert(&t->t_nodes, &node->n_hash, hash);
+	return node;
+}
+
+/*
+ * Note that @exp's client has @exp at (@real), or below, @node.
+ * @len is the length of @node's prefix of @exp's path.
+ */
+static void
+v4root_note(struct v4root_trie *t, struct v4root_node *node,
+	    nfs_export *exp, size_t len, int real)
+{
+	struct {
+		struct v4root_node *	node;
+		nfs_client *		clp;
+	} key = { node, exp->m_client };
+	unsigned int hash = hash_bytes(&key, sizeof(key));
+	int flags = exp->m_export.e_flags;
+	struct v4root_entry *v;
+	struct hash_node *n;
+
+	for (n = hash_lookup(&t->t_entries, hash); n; n = hash_lookup_next(n)) {
+		v = hash_entry(n, struct v4root_entry, v_hash);
+		if (v->v_node != node || v->v_client != key.clp)
+			continue;
+		if (real)
+			v->v_real = 1;
+		/* As repeated set_pseudofs_security() calls would */
+		v->v_flags |= flags & NFSEXP_INSECURE_PORT;
+		if (!(flags & NFSEXP_ROOTSQUASH))
+			v->v_flags &= ~NFSEXP_ROOTSQUASH;
+		return;
+	}
+
+	v = xmalloc(sizeof(*v));
+	v->v_next = NULL;
+	v->v_node = node;
+	v->v_client = key.clp;
+	v->v_source = exp;
+	v->v_len = len;
+	v->v_flags = flags & V4ROOT_SECURITY;
+	v->v_real = real;
+	hash_insert(&t->t_entries, &v->v_hash, hash);
+	*t->t_tail = v;
+	t->t_tail = &v->v_next;
+}
+
+static void
+v4root_walk(struct v4root_trie *t, nfs_export *exp)
+{
+	const char *path = exp->m_export.e_path;
+	const char *name = path, *slash;
+	struct v4root_node *node = NULL, *top = NULL;
+
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		node = v4root_child(t, node, name, slash - name);
+		if (top == NULL)
+			top = node;
+		/* The prefixes "" and "/" both stand for "/" */
+		v4root_note(t, slash - path == 1 ? top : node, exp,
+			    slash - path, 0);
+		name = slash + 1;
+	}
+	node = v4root_child(t, node, name, strlen(name));
+	v4root_note(t, strcmp(path, "/") == 0 ? top : node, exp,
+		    strlen(path), 1);
+}
+
+/*
+ * Pseudo exports depend only on the security flags of the first
+ * export below them, and those of all of them, so ones that agree
+ * share a template.
+ */
+static struct exportent *
+v4root_template(int root, int first, int flags)
+{
+	static struct exportent	templates[2][4][4];
+	static unsigned char	valid[2][4][4];
+	int f = (first & NFSEXP_INSECURE_PORT ? 1 : 0) |
+		(first & NFSEXP_ROOTSQUASH ? 2 : 0);
+	int a = (flags & NFSEXP_INSECURE_PORT ? 1 : 0) |
+		(flags & NFSEXP_ROOTSQUASH ? 2 : 0);
+	struct exportent *eep = &templates[root][f][a];
+
+	if (!valid[root][f][a]) {
+		dupexportent(eep, &pseudo_root.m_export);
+		if (!root)
+			eep->e_flags &= ~NFSEXP_FSID;
+		set_pseudofs_security(eep, first);
+		set_pseudofs_security(eep, flags);
+		valid[root][f][a] = 1;
+	}
+	return eep;
+}
+
+/*
+ * Create a pseudo export
+ */
+static void
+v4root_create(struct v4root_entry *v)
+{
+	struct exportent *src = &v->v_source->m_export;
+	int root = v->v_len <= 1;
+	struct exportent eep;
 	nfs_export *exp;
 
-	exp = export_lookup(hostname, path, 0);
-	if (exp && !(exp->m_export.e_flags & NFSEXP_V4ROOT))
-		return 0;
-	if (!exp) {
-		if (v4root_create(path, source) == NULL) {
-			xlog(L_WARNING, "v4root_set: Unable to create "
-					"pseudo export for '%s'", path);
-			return -ENOMEM;
-		}
-		return 0;
+	eep = *v4root_template(root, src->e_flags, v->v_flags);
+	eep.e_hostname = src->e_hostname;
+	if (root)
+		strcpy(eep.e_path, "/");
+	else {
+		memcpy(eep.e_path, src->e_path, v->v_len);
+		eep.e_path[v->v_len] = '\0';
 	}
-	/* Update an existing V4ROOT export: */
-	set_pseudofs_security(&exp->m_export, source->m_export.e_flags);
-	return 0;
+	exp = export_create_client(&eep, v->v_client);
+	xlog(D_CALL, "v4root_create: path '%s' flags 0x%x",
+		exp->m_export.e_path, exp->m_export.e_flags);
 }
 
-static int v4root_add_parents(nfs_export *exp)
+/*
+ * Add the pseudo exports of every client (@all), or of those passed
+ * to v4root_changed().
+ */
+static void
+v4root_build(int all)
 {
-	char *hostname = exp->m_export.e_hostname;
-	char *path;
-	char *ptr;
-	int ret = 0;
-
-	path = strdup(exp->m_export.e_path);
-	if (!path) {
-		xlog(L_WARNING, "v4root_add_parents: Unable to create "
-				"pseudo export for '%s'", exp->m_export.e_path);
-		return -ENOMEM;
+	struct v4root_trie	t = {
+		.t_nodes	= HASH_TABLE_INIT,
+		.t_entries	= HASH_TABLE_INIT,
+		.t_head		= NULL,
+		.t_tail		= &t.t_head,
+	};
+	struct v4root_entry	*v, *vnext;
+	nfs_export		*exp;
+	int			i;
+
+	for (i = 0; i < MCL_MAXTYPES; i++) {
+		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
+			if (exp->m_export.e_flags & NFSEXP_V4ROOT)
+				continue;
+			if (!all && !v4root_is_dirty(exp->m_client))
+				continue;
+			v4root_walk(&t, exp);
+		}
+	}
+
+	for (v = t.t_head; v; v = vnext) {
+		vnext = v->v_next;
+		if (!v->v_real)
+			v4root_create(v);
+		free(v);
 	}
-	for (ptr = path; ptr; ptr = strchr(ptr, '/')) {
-		char saved;
-
-		saved = *ptr;
-		*ptr = '\0';
-		ret = pseudofs_update(hostname, *path ? path : "/", exp);
-		if (ret)
-			break;
-		*ptr = saved;
-		ptr++;
+	for (i = 0; i < (int)t.t_nodes.h_size; i++) {
+		struct hash_node *n, *nnext;
+
+		for (n = t.t_nodes.h_buckets[i]; n; n = nnext) {
+			nnext = n->h_next;
+			free(hash_entry(n, struct v4root_node, n_hash));
+		}
 	}
-	free(path);
-	return ret;
+	hash_clear(&t.t_nodes);
+	hash_clear(&t.t_entries);
 }
 
 /*
@@ -185,32 +428,57 @@ static int v4root_add_parents(nfs_export *exp)
 void
 v4root_set()
 {
-	nfs_export	*exp;
-	int	i;
-
+	v4root_active = 0;
 	if (!v4root_needed)
 		return;
 	if (!v4root_support())
 		return;
+	v4root_active = 1;
 
-	for (i = 0; i < MCL_MAXTYPES; i++) {
-		for (exp = exportlist[i].p_head; exp; exp = exp->m_next) {
-			if (exp->m_export.e_flags & NFSEXP_V4ROOT)
-				/*
-				 * We just added this one, so its
-				 * parents are already dealt with!
-				 */
-				continue;
+	/* Force '/' to be exported as fsid == 0 */
+	v4root_force_root(1, 0);
+	v4root_build(1);
+}
+
+/**
+ * v4root_update - redo v4root_set() after an incremental reload
+ *
+ * Only the clients passed to v4root_changed() get their pseudo
+ * exports rebuilt, unless pseudo roots were just turned on or off.
+ */
+void
+v4root_update(void)
+{
+	nfs_export	*exp, *next;
+	int		was = v4root_active, all, i;
+
+	v4root_active = v4root_needed && v4root_support();
+	all = was != v4root_active;
+	if (!all && v4root_ndirty == 0) {
+		if (v4root_active)
+			v4root_force_root(1, 0);
+		return;
+	}
 
-			if (strcmp(exp->m_export.e_path, "/") == 0 &&
-			    !(exp->m_export.e_flags & NFSEXP_FSID)) {
-				/* Force '/' to be exported as fsid == 0*/
-				exp->m_export.e_flags |= NFSEXP_FSID;
-				exp->m_export.e_fsid = 0;
-			}
+	qsort(v4root_dirty, v4root_ndirty, sizeof(*v4root_dirty),
+	      v4root_client_cmp);
 
-			v4root_add_parents(exp);
-			/* XXX: error handling! */
+	for (i = 0; i < MCL_MAXTYPES; i++) {
+		for (exp = exportlist[i].p_head; exp; exp = next) {
+			next = exp->m_next;
+			if (!(exp->m_export.e_flags & NFSEXP_V4ROOT))
+				continue;
+			if (!all && !v4root_is_dirty(exp->m_client))
+				continue;
+			cache_forget_export(exp);
+			export_remove(exp);
 		}
 	}
+
+	if (v4root_active) {
+		v4root_force_root(1, all);
+		v4root_build(all);
+	} else if (was)
+		v4root_force_root(-1, 1);
+	v4root_ndirty = 0;
 }
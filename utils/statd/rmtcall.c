@@ -221,17 +221,14 @@ process_entry(notify_list *lp)
  * Process a datagram received on the notify socket
  */
 int
-process_reply(FD_SET_TYPE *rfds)
+process_reply(int fd)
 {
 	notify_list		*lp;
 	u_long			port;
 
-	if (sockfd == -1 || !FD_ISSET(sockfd, rfds))
+	if (sockfd == -1 || fd != sockfd)
 		return 0;
 
-	/* Should not be processed again. */
-	FD_CLR (sockfd, rfds);
-
 	if (!(lp = recv_rply(&port)))
 		return 1;
 
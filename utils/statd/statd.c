@@ -246,7 +246,9 @@ int main (int argc, char **argv)
 	int arg;
 	int port = 0, out_port = 0;
 	int nlm_udp = 0, nlm_tcp = 0;
+#ifndef HAVE_LIBTIRPC
 	struct rlimit rlim;
+#endif
 	int notify_sockfd;
 
 	/* Default: daemon mode, no other options */
@@ -370,6 +372,7 @@ int main (int argc, char **argv)
 						   daemon mode. */
 	}
 
+#ifndef HAVE_LIBTIRPC
 	if (getrlimit (RLIMIT_NOFILE, &rlim) != 0)
 		fprintf(stderr, "%s: getrlimit (RLIMIT_NOFILE) failed: %s\n",
 				argv [0], strerror(errno));
@@ -384,6 +387,7 @@ int main (int argc, char **argv)
 			}
 		}
 	}
+#endif
 
 	set_nlm_port("tcp", nlm_tcp);
 	set_nlm_port("udp", nlm_udp);
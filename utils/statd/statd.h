@@ -33,7 +33,7 @@ extern void	notify_hosts(void);
 extern void	shuffle_dirs(void);
 extern int	statd_get_socket(void);
 extern int	process_notify_list(void);
-extern int	process_reply(FD_SET_TYPE *);
+extern int	process_reply(int);
 extern char *	xstrdup(const char *);
 extern void *	xmalloc(size_t);
 extern void	load_state(void);
@@ -55,6 +55,9 @@
 #include <time.h>
 #include "statd.h"
 #include "notlist.h"
+#include "rpcmisc.h"
+
+#define MY_SVC_MAXEVENTS	32
 
 static int	svc_stop = 0;
 
@@ -80,12 +83,22 @@ my_svc_exit(void)
 void
 my_svc_run(int sockfd)
 {
-	FD_SET_TYPE	readfds;
-	int             selret;
+	int		fds[MY_SVC_MAXEVENTS];
+	int		i, n, timeout;
 	time_t		now;
 
 	svc_stop = 0;
 
+	if (nfs_svc_epoll_init() < 0) {
+		xlog(L_ERROR, "my_svc_run() - epoll: %m");
+		return;
+	}
+	/* Watch notify sockfd for waiting for reply */
+	if (nfs_svc_epoll_watch(sockfd) < 0) {
+		xlog(L_ERROR, "my_svc_run() - epoll: %m");
+		return;
+	}
+
 	for (;;) {
 		if (svc_stop)
 			return;
@@ -95,30 +108,23 @@ my_svc_run(int sockfd)
 			process_notify_list();
 		}
 
-		readfds = SVC_FDSET;
-		/* Set notify sockfd for waiting for reply */
-		FD_SET(sockfd, &readfds);
 		if (notify) {
-			struct timeval	tv;
-
-			tv.tv_sec  = NL_WHEN(notify) - now;
-			tv.tv_usec = 0;
+			timeout = NL_WHEN(notify) - now;
 			xlog(D_GENERAL, "Waiting for reply... (timeo %d)",
-							tv.tv_sec);
-			selret = select(FD_SETSIZE, &readfds,
-				(void *) 0, (void *) 0, &tv);
+							timeout);
+			timeout *= 1000;
 		} else {
 			xlog(D_GENERAL, "Waiting for client connections");
-			selret = select(FD_SETSIZE, &readfds,
-				(void *) 0, (void *) 0, (struct timeval *) 0);
+			timeout = -1;
 		}
+		n = nfs_svc_epoll_wait(fds, MY_SVC_MAXEVENTS, timeout);
 
-		switch (selret) {
+		switch (n) {
 		case -1:
 			if (errno == EINTR || errno == ECONNREFUSED
 			 || errno == ENETUNREACH || errno == EHOSTUNREACH)
 				continue;
-			xlog(L_ERROR, "my_svc_run() - select: %m");
+			xlog(L_ERROR, "my_svc_run() - epoll_wait: %m");
 			return;
 
 		case 0:
@@ -126,11 +132,9 @@ my_svc_run(int sockfd)
 			continue;
 
 		default:
-			selret -= process_reply(&readfds);
-			if (selret) {
-				FD_CLR(sockfd, &readfds);
-				svc_getreqset(&readfds);
-			}
+			for (i = 0; i < n; i++)
+				if (!process_reply(fds[i]))
+					nfs_svc_epoll_getreq(fds[i]);
 		}
 	}
 }